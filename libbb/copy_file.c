@@ -168,8 +168,16 @@ int copy_file(const char *source, const char *dest, int flags)
 			goto end;
 		}
 
-		if (copy_file_chunk(sfp, dfp, -1) < 0)
+		/* nothing is buffered in either stream yet */
+		switch (copy_file_fd(fileno(sfp), fileno(dfp))) {
+		case 1:
+			if (copy_file_chunk(sfp, dfp, -1) < 0)
+				status = -1;
+			break;
+		case -1:
 			status = -1;
+			break;
+		}
 
 		if (fclose(dfp) < 0) {
 			perror_msg("unable to close `%s'", dest);
@@ -21,10 +21,87 @@
  * USA
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE	/* copy_file_range() */
+#endif
+
+#include "config.h"
+
 #include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
 #include <sys/stat.h>
+#include <sys/ioctl.h>
+#ifdef HAVE_LINUX_FS_H
+#include <linux/fs.h>
+#endif
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
 #include "libbb.h"
 
+#define KERNEL_COPY_MAX	(1 << 30)
+
+/* Whether errno says the kernel can't copy between these two files, as
+ * opposed to a real I/O error. */
+static int
+kernel_copy_unsupported(void)
+{
+	return errno == ENOSYS || errno == EINVAL || errno == EXDEV
+		|| errno == EOPNOTSUPP || errno == EBADF;
+}
+
+/* Copy the rest of SRC_FD to DST_FD inside the kernel: as a reflink
+ * sharing the blocks where the filesystem can, else with
+ * copy_file_range() or sendfile(). Returns 0 when done, -1 on error, and
+ * 1 if the kernel can't do it for these files, the file offsets then
+ * telling where copy_file_chunk() has to carry on.  */
+extern int copy_file_fd(int src_fd, int dst_fd)
+{
+#if defined(HAVE_COPY_FILE_RANGE) || defined(HAVE_SYS_SENDFILE_H)
+	ssize_t n;
+#endif
+
+#ifdef FICLONE
+	if (lseek(src_fd, 0, SEEK_CUR) == 0 && lseek(dst_fd, 0, SEEK_CUR) == 0
+			&& ioctl(dst_fd, FICLONE, src_fd) == 0)
+		return 0;
+#endif
+
+#ifdef HAVE_COPY_FILE_RANGE
+	while ((n = copy_file_range(src_fd, NULL, dst_fd, NULL,
+					KERNEL_COPY_MAX, 0)) != 0) {
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			if (kernel_copy_unsupported())
+				break;
+			perror_msg("copy_file_range");
+			return -1;
+		}
+	}
+	if (n == 0)
+		return 0;
+#endif
+
+#ifdef HAVE_SYS_SENDFILE_H
+	while ((n = sendfile(dst_fd, src_fd, NULL, KERNEL_COPY_MAX)) != 0) {
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			if (kernel_copy_unsupported())
+				break;
+			perror_msg("sendfile");
+			return -1;
+		}
+	}
+	if (n == 0)
+		return 0;
+#endif
+
+	return 1;
+}
+
 /* Copy CHUNKSIZE bytes (or until EOF if CHUNKSIZE equals -1) from SRC_FILE
  * to DST_FILE.  */
 extern int copy_file_chunk(FILE *src_file, FILE *dst_file, unsigned long long chunksize)
@@ -0,0 +1,352 @@
+/* decompress.c - the opkg package management system
+
+   Javier Palacios
+
+   Copyright (C) 2010 Javier Palacios
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+/*
+ * Decompressing streams for package members and feed lists, picked by
+ * the suffix of the file name or else by the magic bytes of the data.
+ * gzip is always available, xz and zstd when configured in.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE	/* fopencookie() */
+#endif
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#ifdef HAVE_XZ
+#include <lzma.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "libbb.h"
+
+#define DECOMPRESS_BUFSIZE	(64 * 1024)
+
+#define MAGIC_MAX		6
+
+struct decompressor {
+	const char *suffix;
+	const char *magic;
+	size_t magic_len;
+	FILE *(*open)(FILE *compressed_file);
+};
+
+#if defined(HAVE_XZ) || defined(HAVE_ZSTD)
+static FILE *
+cookie_stream_open(void *cookie, cookie_read_function_t *readfn,
+		cookie_close_function_t *closefn)
+{
+	cookie_io_functions_t io = { readfn, NULL, NULL, closefn };
+	FILE *stream;
+
+	stream = fopencookie(cookie, "r", io);
+	if (stream == NULL) {
+		perror_msg("fopencookie");
+		closefn(cookie);
+	}
+
+	return stream;
+}
+#endif
+
+#ifdef HAVE_XZ
+struct xz_cookie {
+	FILE *in;
+	lzma_stream strm;
+	int eof;		/* end of the xz stream */
+	int err;
+	uint8_t buf[DECOMPRESS_BUFSIZE];
+};
+
+static ssize_t
+xz_cookie_read(void *cookie, char *buf, size_t size)
+{
+	struct xz_cookie *xz = cookie;
+	lzma_action action = LZMA_RUN;
+	lzma_ret ret;
+
+	xz->strm.next_out = (uint8_t *) buf;
+	xz->strm.avail_out = size;
+
+	while (xz->strm.avail_out && !xz->eof && !xz->err) {
+		if (xz->strm.avail_in == 0) {
+			xz->strm.next_in = xz->buf;
+			xz->strm.avail_in = fread(xz->buf, 1, sizeof(xz->buf), xz->in);
+			if (xz->strm.avail_in == 0)
+				action = LZMA_FINISH;
+		}
+
+		ret = lzma_code(&xz->strm, action);
+		if (ret == LZMA_STREAM_END) {
+			xz->eof = 1;
+		} else if (ret == LZMA_BUF_ERROR) {
+			error_msg("invalid compressed data--unexpected end of file");
+			xz->err = 1;
+		} else if (ret != LZMA_OK) {
+			error_msg("invalid compressed data--xz error %d", ret);
+			xz->err = 1;
+		}
+	}
+
+	if (xz->strm.avail_out == size && xz->err) {
+		errno = EIO;
+		return -1;
+	}
+
+	return size - xz->strm.avail_out;
+}
+
+static int
+xz_cookie_close(void *cookie)
+{
+	struct xz_cookie *xz = cookie;
+	int err = xz->err;
+
+	lzma_end(&xz->strm);
+	free(xz);
+
+	return err ? -1 : 0;
+}
+
+static FILE *
+xz_stream_open(FILE *compressed_file)
+{
+	lzma_stream init = LZMA_STREAM_INIT;
+	struct xz_cookie *xz;
+
+	xz = xcalloc(1, sizeof(*xz));
+	xz->in = compressed_file;
+	xz->strm = init;
+
+	if (lzma_stream_decoder(&xz->strm, UINT64_MAX, 0) != LZMA_OK) {
+		error_msg("Couldn't initialize the xz decoder");
+		free(xz);
+		return NULL;
+	}
+
+	return cookie_stream_open(xz, xz_cookie_read, xz_cookie_close);
+}
+#endif
+
+#ifdef HAVE_ZSTD
+struct zstd_cookie {
+	FILE *in;
+	ZSTD_DStream *ds;
+	ZSTD_inBuffer input;
+	int eof;		/* end of the zstd frame */
+	int err;
+	char buf[DECOMPRESS_BUFSIZE];
+};
+
+static ssize_t
+zstd_cookie_read(void *cookie, char *buf, size_t size)
+{
+	struct zstd_cookie *zs = cookie;
+	ZSTD_outBuffer output = { buf, size, 0 };
+	size_t ret;
+
+	while (output.pos < output.size && !zs->eof && !zs->err) {
+		if (zs->input.pos == zs->input.size) {
+			zs->input.src = zs->buf;
+			zs->input.size = fread(zs->buf, 1, sizeof(zs->buf), zs->in);
+			zs->input.pos = 0;
+			if (zs->input.size == 0) {
+				error_msg("invalid compressed data--unexpected end of file");
+				zs->err = 1;
+				break;
+			}
+		}
+
+		ret = ZSTD_decompressStream(zs->ds, &output, &zs->input);
+		if (ZSTD_isError(ret)) {
+			error_msg("invalid compressed data--%s",
+					ZSTD_getErrorName(ret));
+			zs->err = 1;
+		} else if (ret == 0) {
+			zs->eof = 1;
+		}
+	}
+
+	if (output.pos == 0 && zs->err) {
+		errno = EIO;
+		return -1;
+	}
+
+	return output.pos;
+}
+
+static int
+zstd_cookie_close(void *cookie)
+{
+	struct zstd_cookie *zs = cookie;
+	int err = zs->err;
+
+	ZSTD_freeDStream(zs->ds);
+	free(zs);
+
+	return err ? -1 : 0;
+}
+
+static FILE *
+zstd_stream_open(FILE *compressed_file)
+{
+	struct zstd_cookie *zs;
+
+	zs = xcalloc(1, sizeof(*zs));
+	zs->in = compressed_file;
+
+	zs->ds = ZSTD_createDStream();
+	if (zs->ds == NULL || ZSTD_isError(ZSTD_initDStream(zs->ds))) {
+		error_msg("Couldn't initialize the zstd decoder");
+		ZSTD_freeDStream(zs->ds);
+		free(zs);
+		return NULL;
+	}
+
+	return cookie_stream_open(zs, zstd_cookie_read, zstd_cookie_close);
+}
+#endif
+
+static const struct decompressor decompressors[] = {
+	{ "gz", "\037\213", 2, gunzip_stream_open },
+#ifdef HAVE_XZ
+	{ "xz", "\3757zXZ\0", 6, xz_stream_open },
+#endif
+#ifdef HAVE_ZSTD
+	{ "zst", "\050\265\057\375", 4, zstd_stream_open },
+#endif
+	{ NULL, NULL, 0, NULL }
+};
+
+static const struct decompressor *
+decompressor_by_name(const char *name)
+{
+	const struct decompressor *d;
+	const char *suffix;
+
+	suffix = strrchr(name, '.');
+	if (suffix == NULL)
+		return NULL;
+
+	for (d = decompressors; d->suffix; d++)
+		if (strcmp(suffix + 1, d->suffix) == 0)
+			return d;
+
+	return NULL;
+}
+
+/* Only for seekable streams, which are left where they were. */
+static const struct decompressor *
+decompressor_by_magic(FILE *in)
+{
+	const struct decompressor *d;
+	unsigned char magic[MAGIC_MAX];
+	size_t n;
+	long pos;
+
+	pos = ftell(in);
+	if (pos == -1)
+		return NULL;
+
+	n = fread(magic, 1, sizeof(magic), in);
+	if (fseek(in, pos, SEEK_SET) == -1)
+		return NULL;
+
+	for (d = decompressors; d->suffix; d++)
+		if (n >= d->magic_len && memcmp(magic, d->magic, d->magic_len) == 0)
+			return d;
+
+	return NULL;
+}
+
+/*
+ * Whether name ends in the suffix of a compression format we can read.
+ */
+int
+decompress_supported(const char *name)
+{
+	return decompressor_by_name(name) != NULL;
+}
+
+/*
+ * A stream of the data of compressed_file, decompressed as it is read.
+ * name, if not NULL, picks the format by its suffix. Otherwise the
+ * format is told by the magic bytes at the current position.
+ */
+FILE *
+decompress_stream_open(FILE *compressed_file, const char *name)
+{
+	const struct decompressor *d = NULL;
+
+	if (name)
+		d = decompressor_by_name(name);
+	if (d == NULL)
+		d = decompressor_by_magic(compressed_file);
+	if (d == NULL) {
+		error_msg("%s: unsupported compression",
+				name ? name : "stream");
+		return NULL;
+	}
+
+	return d->open(compressed_file);
+}
+
+/* Returns -1 if the data turned out to be corrupted. */
+int
+decompress_stream_close(FILE *stream)
+{
+	return fclose(stream) == 0 ? 0 : -1;
+}
+
+/*
+ * Decompress all of in to out. Returns 0 on success.
+ */
+int
+decompress(FILE *in, FILE *out, const char *name)
+{
+	FILE *stream;
+	char *buf;
+	size_t n;
+	int err = 0;
+
+	stream = decompress_stream_open(in, name);
+	if (stream == NULL)
+		return 1;
+
+	buf = xmalloc(DECOMPRESS_BUFSIZE);
+	while ((n = fread(buf, 1, DECOMPRESS_BUFSIZE, stream)) > 0) {
+		if (fwrite(buf, 1, n, out) != n) {
+			perror_msg("Couldn't write");
+			err = 1;
+			break;
+		}
+	}
+	if (ferror(stream))
+		err = 1;
+	free(buf);
+
+	if (decompress_stream_close(stream))
+		err = 1;
+
+	return err;
+}
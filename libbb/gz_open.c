@@ -21,75 +21,107 @@
  * USA
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE	/* fopencookie() */
+#endif
+
 #include <sys/types.h>
-#include <sys/wait.h>
-#include <signal.h>
 #include <stdlib.h>
 #include <string.h>
-#include <unistd.h>
+#include <errno.h>
 #include "libbb.h"
 
-FILE *
-gz_open(FILE *compressed_file, int *pid)
-{
-	int unzip_pipe[2];
+/*
+ * The stream inflates the data as it is read, in-process. Each stream has
+ * an inflate state of its own, so they can be nested.
+ */
+struct gunzip_cookie {
+	gunzip_t *state;
+	unsigned char *buf;	/* inflated data not read yet */
+	int len;
+	int eof;
+	int err;
+};
 
-	if (pipe(unzip_pipe)!=0) {
-		perror_msg("pipe");
-		return(NULL);
-	}
+static ssize_t
+gunzip_cookie_read(void *cookie, char *buf, size_t size)
+{
+	struct gunzip_cookie *gz = cookie;
+	size_t n = 0, chunk;
 
-    /* If we don't flush, we end up with two copies of anything pending, 
-       one from the parent, one from the child */
-    fflush(stdout);
-    fflush(stderr);
+	while (n < size) {
+		if (gz->len == 0) {
+			if (gz->eof || gz->err)
+				break;
+			gz->len = gunzip_read_window(gz->state, &gz->buf);
+			if (gz->len == 0) {
+				gz->eof = 1;
+				break;
+			}
+			if (gz->len < 0) {
+				gz->len = 0;
+				gz->err = 1;
+				break;
+			}
+		}
 
-	if ((*pid = fork()) == -1) {
-		perror_msg("fork");
-		return(NULL);
+		chunk = size - n < gz->len ? size - n : gz->len;
+		memcpy(buf + n, gz->buf, chunk);
+		gz->buf += chunk;
+		gz->len -= chunk;
+		n += chunk;
 	}
-	if (*pid==0) {
-		/* child process */
-		close(unzip_pipe[0]);
-		unzip(compressed_file, fdopen(unzip_pipe[1], "w"));
-		fflush(NULL);
-		fclose(compressed_file);
-		close(unzip_pipe[1]);
-		_exit(EXIT_SUCCESS);
+
+	if (n == 0 && gz->err) {
+		errno = EIO;
+		return -1;
 	}
-	close(unzip_pipe[1]);
-	return(fdopen(unzip_pipe[0], "r"));
+
+	return n;
 }
 
-int
-gz_close(int gunzip_pid)
+static int
+gunzip_cookie_close(void *cookie)
 {
-	int status;
-	int ret;
+	struct gunzip_cookie *gz = cookie;
+	int err = gz->err;
 
-	if (waitpid(gunzip_pid, &status, 0) == -1) {
-		perror_msg("waitpid");
-		return -1;
-	}
-	
-	if (WIFSIGNALED(status)) {
-		error_msg("Unzip process killed by signal %d.\n",
-			WTERMSIG(status));
-		return -1;
-	}
+	gunzip_free(gz->state);
+	free(gz);
 
-	if (!WIFEXITED(status)) {
-		/* shouldn't happen */
-		error_msg("Your system is broken: got status %d from waitpid.\n",
-				status);
-		return -1;
+	return err ? -1 : 0;
+}
+
+FILE *
+gunzip_stream_open(FILE *compressed_file)
+{
+	cookie_io_functions_t io = {
+		gunzip_cookie_read, NULL, NULL, gunzip_cookie_close
+	};
+	struct gunzip_cookie *gz;
+	FILE *stream;
+
+	gz = xcalloc(1, sizeof(*gz));
+	gz->state = gunzip_new(compressed_file);
+	if (gz->state == NULL) {
+		free(gz);
+		return NULL;
 	}
 
-	if ((ret = WEXITSTATUS(status))) {
-		error_msg("Unzip process failed with return code %d.\n",
-				ret);
-		return -1;
+	stream = fopencookie(gz, "r", io);
+	if (stream == NULL) {
+		perror_msg("fopencookie");
+		gunzip_free(gz->state);
+		free(gz);
+		return NULL;
 	}
 
-	return 0;
+	return stream;
+}
+
+/* Returns -1 if the data turned out to be corrupted. */
+int
+gunzip_stream_close(FILE *stream)
+{
+	return fclose(stream) == 0 ? 0 : -1;
 }
@@ -57,6 +57,7 @@ const char *time_string(time_t timeVal);
 
 int copy_file(const char *source, const char *dest, int flags);
 int copy_file_chunk(FILE *src_file, FILE *dst_file, unsigned long long chunksize);
+int copy_file_fd(int src_fd, int dst_fd);
 ssize_t safe_read(int fd, void *buf, size_t count);
 ssize_t full_read(int fd, char *buf, int len);
 
@@ -100,16 +101,47 @@ enum extract_functions_e {
 	extract_unconditional = 512,
 	extract_create_leading_dirs = 1024,
 	extract_quiet = 2048,
-	extract_exclude_list = 4096
+	extract_exclude_list = 4096,
+	extract_atomic = 8192
 };
 
 char *deb_extract(const char *package_filename, FILE *out_stream,
 		const int extract_function, const char *prefix,
 		const char *filename, int *err);
 
+/* One member for deb_extract_members(), ared_file being "control.tar" or
+ * "data.tar" and the rest as for deb_extract(). If list_entry is set, it
+ * is called with the name of each entry in the member. */
+struct deb_member {
+	const char *ared_file;
+	FILE *out_stream;
+	int extract_function;
+	const char *prefix;
+	const char *filename;
+	void (*list_entry)(const char *name, void *data);
+	void *list_data;
+};
+
+int deb_extract_members(const char *package_filename,
+		const struct deb_member *members, int count);
+
+/* If set, called after each block of file data extracted or skipped, so
+ * that other work can go on while archives are read. */
+extern void (*extract_progress)(void);
+
 extern int unzip(FILE *l_in_file, FILE *l_out_file);
-extern int gz_close(int gunzip_pid);
-extern FILE *gz_open(FILE *compressed_file, int *pid);
+extern FILE *gunzip_stream_open(FILE *compressed_file);
+extern int gunzip_stream_close(FILE *stream);
+
+typedef struct gunzip_s gunzip_t;
+extern gunzip_t *gunzip_new(FILE *in);
+extern int gunzip_read_window(gunzip_t *gz, unsigned char **buf);
+extern void gunzip_free(gunzip_t *gz);
+
+extern int decompress_supported(const char *name);
+extern FILE *decompress_stream_open(FILE *compressed_file, const char *name);
+extern int decompress_stream_close(FILE *stream);
+extern int decompress(FILE *in, FILE *out, const char *name);
 
 int make_directory (const char *path, long mode, int flags);
 
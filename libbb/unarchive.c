@@ -19,13 +19,19 @@
  *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE	/* fopencookie() */
+#endif
+
 #include <stdio.h>
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <utime.h>
 #include <libgen.h>
+#include <sys/stat.h>
 
 #include "libbb.h"
 
@@ -38,6 +44,14 @@ static char *linkname = NULL;
 #endif
 
 off_t archive_offset;
+void (*extract_progress)(void);
+
+#define EXTRACT_BUFSIZE	(128 * 1024)
+
+/* The directory of the last file extracted, kept open so the files next
+ * to it are created with openat() rather than a lookup of the full path. */
+static char *dir_cache_path;
+static int dir_cache_fd = -1;
 
 #define SEEK_BUF 4096
 static ssize_t
@@ -45,6 +59,7 @@ seek_by_read(FILE* fd, size_t len)
 {
         ssize_t cc, total = 0;
         char buf[SEEK_BUF];
+        int n = 0;
 
         while (len) {
                 cc = fread(buf, sizeof(buf[0]), 
@@ -54,6 +69,9 @@ seek_by_read(FILE* fd, size_t len)
                 total += cc;
                 len -= cc;
 
+                if (extract_progress && ++n % (EXTRACT_BUFSIZE / SEEK_BUF) == 0)
+                        extract_progress();
+
                 if(feof(fd) || ferror(fd))
                         break;
         }
@@ -74,6 +92,156 @@ seek_sub_file(FILE *fd, const int count)
 }
 
 
+static void
+dir_cache_drop(void)
+{
+	if (dir_cache_fd != -1)
+		close(dir_cache_fd);
+	dir_cache_fd = -1;
+	free(dir_cache_path);
+	dir_cache_path = NULL;
+}
+
+/* A descriptor for the directory of path and the name of path in it, or
+ * AT_FDCWD and path itself if the directory can't be opened. */
+static int
+dir_cache_lookup(const char *path, const char **base)
+{
+	const char *slash = strrchr(path, '/');
+	int len;
+
+	*base = path;
+	if (slash == NULL)
+		return AT_FDCWD;
+
+	len = slash == path ? 1 : slash - path;
+	if (dir_cache_path == NULL || strlen(dir_cache_path) != len
+			|| strncmp(dir_cache_path, path, len) != 0) {
+		dir_cache_drop();
+		dir_cache_path = xstrndup(path, len);
+		dir_cache_fd = open(dir_cache_path, O_RDONLY | O_DIRECTORY);
+		if (dir_cache_fd == -1) {
+			dir_cache_drop();
+			return AT_FDCWD;
+		}
+	}
+
+	*base = slash + 1;
+	return dir_cache_fd;
+}
+
+static int
+copy_to_fd(FILE *src_stream, int fd, off_t size, const char *name)
+{
+	static char *buffer;
+	size_t len, nread;
+	ssize_t nwritten;
+	char *p;
+
+	if (buffer == NULL)
+		buffer = xmalloc(EXTRACT_BUFSIZE);
+
+	while (size > 0) {
+		len = size > EXTRACT_BUFSIZE ? EXTRACT_BUFSIZE : size;
+		nread = fread(buffer, 1, len, src_stream);
+		if (nread == 0) {
+			if (ferror(src_stream))
+				perror_msg("read");
+			else
+				error_msg("Unable to read all data");
+			return -1;
+		}
+		size -= nread;
+		if (extract_progress)
+			extract_progress();
+
+		for (p = buffer; nread > 0; p += nwritten, nread -= nwritten) {
+			nwritten = write(fd, p, nread);
+			if (nwritten == -1) {
+				if (errno == EINTR) {
+					nwritten = 0;
+					continue;
+				}
+				perror_msg("Cannot write %s", name);
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * A regular file from src_stream to full_name. The owner, mode and date
+ * are set through the open descriptor. With extract_atomic the data goes
+ * to a temporary name first, renamed over full_name once complete, so a
+ * file is never seen half written.
+ */
+static int
+extract_regular_file(FILE *src_stream, const file_header_t *file_entry,
+		const char *full_name, const int function)
+{
+	const char *base;
+	char *tmp_name = NULL;
+	int dir_fd, fd = -1;
+	int err;
+
+	dir_fd = dir_cache_lookup(full_name, &base);
+
+	if (function & extract_atomic) {
+		tmp_name = xmalloc(strlen(base) + sizeof(".opkg-new"));
+		strcpy(tmp_name, base);
+		strcat(tmp_name, ".opkg-new");
+		fd = openat(dir_fd, tmp_name,
+				O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW, 0600);
+		if (fd == -1 && errno == ENAMETOOLONG) {
+			free(tmp_name);
+			tmp_name = NULL;
+			unlinkat(dir_fd, base, 0);
+		}
+	}
+	if (tmp_name == NULL && fd == -1)
+		fd = openat(dir_fd, base, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd == -1) {
+		perror_msg("%s", full_name);
+		free(tmp_name);
+		seek_sub_file(src_stream, file_entry->size);
+		return -1;
+	}
+
+	archive_offset += file_entry->size;
+	err = copy_to_fd(src_stream, fd, file_entry->size, full_name);
+
+	if (!err) {
+		struct timespec times[2];
+
+		fchown(fd, file_entry->uid, file_entry->gid);
+		fchmod(fd, file_entry->mode);
+		if (function & extract_preserve_date) {
+			times[0].tv_sec = times[1].tv_sec = file_entry->mtime;
+			times[0].tv_nsec = times[1].tv_nsec = 0;
+			futimens(fd, times);
+		}
+	}
+
+	if (close(fd) == -1 && !err) {
+		perror_msg("Cannot write %s", full_name);
+		err = -1;
+	}
+
+	if (tmp_name) {
+		if (!err && renameat(dir_fd, tmp_name, dir_fd, base) == -1) {
+			perror_msg("Cannot rename %s", full_name);
+			err = -1;
+		}
+		if (err)
+			unlinkat(dir_fd, tmp_name, 0);
+		free(tmp_name);
+	}
+
+	return err;
+}
+
 /* Extract the data postioned at src_stream to either filesystem, stdout or 
  * buffer depending on the value of 'function' which is defined in libbb.h 
  *
@@ -92,7 +260,6 @@ extract_archive(FILE *src_stream, FILE *out_stream,
 		const char *prefix,
 		int *err)
 {
-	FILE *dst_stream = NULL;
 	char *full_name = NULL;
 	char *full_link_name = NULL;
 	char *buffer = NULL;
@@ -148,7 +315,11 @@ extract_archive(FILE *src_stream, FILE *out_stream,
 		stat_res = lstat (full_name, &oldfile);
 		if (stat_res == 0) { /* The file already exists */
 			if ((function & extract_unconditional) || (oldfile.st_mtime < file_entry->mtime)) {
-				if (!S_ISDIR(oldfile.st_mode)) {
+				/* A regular file is renamed over the old one */
+				int renamed = (function & extract_atomic)
+					&& S_ISREG(file_entry->mode)
+					&& !file_entry->link_name;
+				if (!S_ISDIR(oldfile.st_mode) && !renamed) {
 					unlink(full_name); /* Directories might not be empty etc */
 				}
 			} else {
@@ -172,6 +343,9 @@ extract_archive(FILE *src_stream, FILE *out_stream,
 			}
 			free (buf);
 		}
+		/* anything else may change the directories on the way */
+		if (!S_ISREG(file_entry->mode))
+			dir_cache_drop();
 		switch(file_entry->mode & S_IFMT) {
 			case S_IFREG:
 				if (file_entry->link_name) { /* Found a cpio hard link */
@@ -183,14 +357,11 @@ extract_archive(FILE *src_stream, FILE *out_stream,
 						}
 					}
 				} else {
-					if ((dst_stream = wfopen(full_name, "w")) == NULL) {
-						*err = -1;
-						seek_sub_file(src_stream, file_entry->size);
-						goto cleanup;
-					}
-					archive_offset += file_entry->size;
-					*err = copy_file_chunk(src_stream, dst_stream, file_entry->size);			
-					fclose(dst_stream);
+					/* owner, mode and date are set already */
+					*err = extract_regular_file(src_stream,
+							file_entry, full_name,
+							function);
+					goto list;
 				}
 				break;
 			case S_IFDIR:
@@ -253,6 +424,7 @@ extract_archive(FILE *src_stream, FILE *out_stream,
 		seek_sub_file(src_stream, file_entry->size);
 	}
 
+list:
 	/* extract_list and extract_verbose_list can be used in conjunction
 	 * with one of the above four extraction functions, so do this seperately */
 	if (function & extract_verbose_list) {
@@ -280,6 +452,8 @@ unarchive(FILE *src_stream, FILE *out_stream,
 		const int extract_function,
 		const char *prefix,
 		const char **extract_names,
+		void (*list_entry)(const char *name, void *data),
+		void *list_data,
 		int *err)
 {
 	file_header_t *file_entry;
@@ -314,6 +488,8 @@ unarchive(FILE *src_stream, FILE *out_stream,
 		}
 
 		if (extract_flag == TRUE) {
+			if (list_entry)
+				list_entry(file_entry->name, list_data);
 			buffer = extract_archive(src_stream, out_stream,
 					file_entry, extract_function,
 					prefix, err);
@@ -328,6 +504,7 @@ unarchive(FILE *src_stream, FILE *out_stream,
 		}
 		free_headers(file_entry);
 	}
+	dir_cache_drop();
 
 	return buffer;
 }
@@ -618,155 +795,266 @@ free_header_tar(file_header_t *tar_entry)
 	free(tar_entry);
 }
 
-char *
-deb_extract(const char *package_filename, FILE *out_stream, 
-	const int extract_function, const char *prefix,
-	const char *filename, int *err)
+/*
+ * Whether an archive member is ared_file compressed in a format we can
+ * read, like data.tar.gz or data.tar.xz.
+ */
+static int
+ared_member_match(const char *member, const char *ared_file)
 {
-	FILE *deb_stream = NULL;
-	file_header_t *ar_header = NULL;
-	const char **file_list = NULL;
-	char *output_buffer = NULL;
-	char *ared_file = NULL;
-	char ar_magic[8];
-	int gz_err;
+	size_t len = strlen(ared_file);
 
-	*err = 0;
+	if (strncmp(member, ared_file, len) != 0 || member[len] != '.'
+			|| strchr(member + len + 1, '.') != NULL)
+		return 0;
 
-	if (filename != NULL) {
-		file_list = xmalloc(sizeof(char *) * 2);
-		file_list[0] = filename;
-		file_list[1] = NULL;
+	if (!decompress_supported(member)) {
+		error_msg("%s: unsupported compression", member);
+		return 0;
 	}
-	
-	if (extract_function & extract_control_tar_gz) {
-		ared_file = "control.tar.gz";
+
+	return 1;
+}
+
+/* A read-only view of the next size bytes of a stream. */
+struct sub_stream {
+	FILE *in;
+	size_t left;
+};
+
+static ssize_t
+sub_stream_read(void *cookie, char *buf, size_t size)
+{
+	struct sub_stream *sub = cookie;
+	size_t n;
+
+	if (size > sub->left)
+		size = sub->left;
+
+	n = fread(buf, 1, size, sub->in);
+	sub->left -= n;
+	if (n < size && ferror(sub->in)) {
+		errno = EIO;
+		return -1;
 	}
-	else if (extract_function & extract_data_tar_gz) {		
-		ared_file = "data.tar.gz";
-	} else {
-                opkg_msg(ERROR, "Internal error: extract_function=%x\n",
-				extract_function);
-		*err = -1;
-		goto cleanup;
-        }
+
+	return n;
+}
+
+static FILE *
+sub_stream_open(struct sub_stream *sub)
+{
+	cookie_io_functions_t io = { sub_stream_read, NULL, NULL, NULL };
+	FILE *stream;
+
+	stream = fopencookie(sub, "r", io);
+	if (stream == NULL)
+		perror_msg("fopencookie");
+
+	return stream;
+}
+
+/* The first of members not yet in done which member names. */
+static const struct deb_member *
+deb_member_find(const char *member, const struct deb_member *members,
+		int count, unsigned int *done)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (*done & (1 << i))
+			continue;
+		if (ared_member_match(member, members[i].ared_file)) {
+			*done |= 1 << i;
+			return &members[i];
+		}
+	}
+
+	return NULL;
+}
+
+static int
+deb_member_extract(FILE *compressed_stream, const char *name,
+		const struct deb_member *member, char **output_buffer)
+{
+	FILE *uncompressed_stream;
+	const char *file_list[2] = { member->filename, NULL };
+	char *buffer;
+	int err;
+
+	/* open a stream of decompressed data */
+	uncompressed_stream = decompress_stream_open(compressed_stream, name);
+	if (uncompressed_stream == NULL)
+		return -1;
+
+	archive_offset = 0;
+	buffer = unarchive(uncompressed_stream, member->out_stream,
+			get_header_tar, free_header_tar,
+			member->extract_function, member->prefix,
+			member->filename ? file_list : NULL,
+			member->list_entry, member->list_data, &err);
+
+	if (decompress_stream_close(uncompressed_stream))
+		err = -1;
+
+	if (output_buffer && buffer)
+		*output_buffer = buffer;
+	else
+		free(buffer);
+
+	return err;
+}
+
+/*
+ * Extract members from a package in a single walk through it, so each
+ * member is read and decompressed once. Members missing from the package
+ * are not an error, as with deb_extract().
+ */
+static int
+deb_extract_walk(const char *package_filename,
+		const struct deb_member *members, int count,
+		char **output_buffer)
+{
+	FILE *deb_stream;
+	const struct deb_member *member;
+	unsigned int done = 0, all = (1 << count) - 1;
+	char ar_magic[8];
+	int err = 0;
 
 	/* open the debian package to be worked on */
 	deb_stream = wfopen(package_filename, "r");
-	if (deb_stream == NULL) {
-		*err = -1;
-		goto cleanup;
-	}
+	if (deb_stream == NULL)
+		return -1;
 	/* set the buffer size */
 	setvbuf(deb_stream, NULL, _IOFBF, 0x8000);
 
 	/* check ar magic */
-	fread(ar_magic, 1, 8, deb_stream);
+	if (fread(ar_magic, 1, 8, deb_stream) != 8)
+		memset(ar_magic, 0, sizeof(ar_magic));
 
 	if (strncmp(ar_magic,"!<arch>",7) == 0) {
+		file_header_t *ar_header;
 		archive_offset = 8;
 
-		while ((ar_header = get_header_ar(deb_stream)) != NULL) {
-			if (strcmp(ared_file, ar_header->name) == 0) {
-				int gunzip_pid = 0;
-				FILE *uncompressed_stream;
-				/* open a stream of decompressed data */
-				uncompressed_stream = gz_open(deb_stream, &gunzip_pid);
-				if (uncompressed_stream == NULL) {
-					*err = -1;
-					goto cleanup;
-				}
-
-				archive_offset = 0;
-				output_buffer = unarchive(uncompressed_stream,
-						out_stream, get_header_tar,
-						free_header_tar,
-						extract_function, prefix,
-						file_list, err);
-				fclose(uncompressed_stream);
-				gz_err = gz_close(gunzip_pid);
-				if (gz_err)
-					*err = -1;
-				free_header_ar(ar_header);
-				break;
-			}
-			if (fseek(deb_stream, ar_header->size, SEEK_CUR) == -1) {
-				opkg_perror(ERROR, "Couldn't fseek into %s", package_filename);
-				*err = -1;
-				free_header_ar(ar_header);
-				goto cleanup;
+		while (done != all
+			&& (ar_header = get_header_ar(deb_stream)) != NULL) {
+			long start = ftell(deb_stream);
+
+			member = deb_member_find(ar_header->name, members,
+					count, &done);
+			if (member)
+				err = deb_member_extract(deb_stream,
+						ar_header->name, member,
+						output_buffer);
+
+			/* the decompressor may have read past the member */
+			if (!err && done != all && fseek(deb_stream,
+					start + ar_header->size, SEEK_SET) == -1) {
+				opkg_perror(ERROR, "Couldn't fseek into %s",
+						package_filename);
+				err = -1;
 			}
 			free_header_ar(ar_header);
+			if (err)
+				break;
 		}
-		goto cleanup;
 	} else if (strncmp(ar_magic, "\037\213", 2) == 0) {
 		/* it's a gz file, let's assume it's an opkg */
-		int unzipped_opkg_pid;
 		FILE *unzipped_opkg_stream;
 		file_header_t *tar_header;
 		archive_offset = 0;
 		if (fseek(deb_stream, 0, SEEK_SET) == -1) {
 			opkg_perror(ERROR, "Couldn't fseek into %s", package_filename);
-			*err = -1;
-			goto cleanup;
+			fclose(deb_stream);
+			return -1;
 		}
-		unzipped_opkg_stream = gz_open(deb_stream, &unzipped_opkg_pid);
+		unzipped_opkg_stream = gunzip_stream_open(deb_stream);
 		if (unzipped_opkg_stream == NULL) {
-			*err = -1;
-			goto cleanup;
+			fclose(deb_stream);
+			return -1;
 		}
-		
-		/* walk through outer tar file to find ared_file */
-		while ((tar_header = get_header_tar(unzipped_opkg_stream)) != NULL) {
-                        int name_offset = 0;
-                        if (strncmp(tar_header->name, "./", 2) == 0)
-                                name_offset = 2;
-			if (strcmp(ared_file, tar_header->name+name_offset) == 0) {
-				int gunzip_pid = 0;
-				FILE *uncompressed_stream;
-				/* open a stream of decompressed data */
-				uncompressed_stream = gz_open(unzipped_opkg_stream, &gunzip_pid);
-				if (uncompressed_stream == NULL) {
-					*err = -1;
-					goto cleanup;
+
+		/* walk through outer tar file to find the members */
+		while (done != all
+			&& (tar_header = get_header_tar(unzipped_opkg_stream)) != NULL) {
+			off_t offset = archive_offset;
+			int name_offset = 0;
+			if (strncmp(tar_header->name, "./", 2) == 0)
+				name_offset = 2;
+
+			member = deb_member_find(tar_header->name + name_offset,
+					members, count, &done);
+			if (member) {
+				struct sub_stream sub = { unzipped_opkg_stream,
+						tar_header->size };
+				FILE *member_stream = sub_stream_open(&sub);
+
+				if (member_stream == NULL) {
+					err = -1;
+				} else {
+					err = deb_member_extract(member_stream,
+						tar_header->name + name_offset,
+						member, output_buffer);
+					fclose(member_stream);
 				}
-				archive_offset = 0;
-
-				output_buffer = unarchive(uncompressed_stream, 
-							  out_stream, 
-							  get_header_tar,
-							  free_header_tar,
-							  extract_function, 
-							  prefix, 
-							  file_list,
-							  err);
-
-				free_header_tar(tar_header);
-				fclose(uncompressed_stream);
-				gz_err = gz_close(gunzip_pid);
-				if (gz_err)
-					*err = -1;
-				break;
+				/* skip what the member left unread */
+				seek_by_read(unzipped_opkg_stream, sub.left);
+				archive_offset = offset + tar_header->size;
+			} else {
+				seek_sub_file(unzipped_opkg_stream,
+						tar_header->size);
 			}
-			seek_sub_file(unzipped_opkg_stream, tar_header->size);
 			free_header_tar(tar_header);
+			if (err)
+				break;
 		}
-		fclose(unzipped_opkg_stream);
-		gz_err = gz_close(unzipped_opkg_pid);
-		if (gz_err)
-			*err = -1;
-
-		goto cleanup;
+		if (gunzip_stream_close(unzipped_opkg_stream))
+			err = -1;
 	} else {
-		*err = -1;
+		err = -1;
 		error_msg("%s: invalid magic", package_filename);
 	}
 
-cleanup:
-	if (deb_stream)
-		fclose(deb_stream);
-	if (file_list)
-		free(file_list);
+	fclose(deb_stream);
+
+	return err;
+}
+
+char *
+deb_extract(const char *package_filename, FILE *out_stream, 
+	const int extract_function, const char *prefix,
+	const char *filename, int *err)
+{
+	struct deb_member member;
+	char *output_buffer = NULL;
+
+	memset(&member, 0, sizeof(member));
+
+	if (extract_function & extract_control_tar_gz) {
+		member.ared_file = "control.tar";
+	}
+	else if (extract_function & extract_data_tar_gz) {		
+		member.ared_file = "data.tar";
+	} else {
+                opkg_msg(ERROR, "Internal error: extract_function=%x\n",
+				extract_function);
+		*err = -1;
+		return NULL;
+        }
+
+	member.out_stream = out_stream;
+	member.extract_function = extract_function;
+	member.prefix = prefix;
+	member.filename = filename;
+
+	*err = deb_extract_walk(package_filename, &member, 1, &output_buffer);
 
 	return output_buffer;
 }
+
+int
+deb_extract_members(const char *package_filename,
+		const struct deb_member *members, int count)
+{
+	return deb_extract_walk(package_filename, members, count, NULL);
+}
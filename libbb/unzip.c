@@ -41,22 +41,13 @@
  */
 
 #include <sys/types.h>
-#include <sys/wait.h>
-#include <signal.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
 #include "libbb.h"
 
-static FILE *in_file, *out_file;
-
-/* these are freed by gz_close */
-static unsigned char *window;
-static unsigned long *crc_table = NULL;
-
-static unsigned long crc; /* shift register contents */
-
 /*
  * window size--must be a power of two, and
  *  at least 32K for zip's deflate method 
@@ -67,13 +58,6 @@ static const int WSIZE = 0x8000;
 static const int BMAX = 16;		/* maximum bit length of any code (16 for explode) */
 static const int N_MAX = 288;		/* maximum number of codes in any set */
 
-static long bytes_out;		/* number of output bytes */
-static unsigned long outcnt;	/* bytes in output buffer */
-
-static unsigned hufts;		/* track memory usage */
-static unsigned long bb;			/* bit buffer */
-static unsigned bk;		/* bits in bit buffer */
-
 typedef struct huft_s {
 	unsigned char e;		/* number of extra bits or operation */
 	unsigned char b;		/* number of bits in this code or subcode */
@@ -83,24 +67,86 @@ typedef struct huft_s {
 	} v;
 } huft_t;
 
-static const unsigned short mask_bits[] = {
-	0x0000,
-	0x0001, 0x0003, 0x0007, 0x000f, 0x001f, 0x003f, 0x007f, 0x00ff,
-	0x01ff, 0x03ff, 0x07ff, 0x0fff, 0x1fff, 0x3fff, 0x7fff, 0xffff
+/*
+ * inflate_get_next_window() stops whenever the window is full, and picks
+ * up from here on the next call.
+ */
+enum {
+	STAGE_BLOCK,		/* at a block header */
+	STAGE_STORED,		/* in a stored block */
+	STAGE_CODES,		/* in a fixed or dynamic Huffman block */
+	STAGE_DONE		/* past the last block */
 };
 
-//static int error_number = 0;
-/* ========================================================================
- * Signal and error handler.
+/*
+ * Everything needed to inflate one stream. Nothing is shared between
+ * streams, so any number of them can be inflated at once.
  */
- 
-static void abort_gzip()
+struct gunzip_s {
+	FILE *in_file, *out_file;
+
+	unsigned char *window;
+	uint32_t crc_table[8][256];	/* slice-by-8 tables */
+	uint32_t crc;			/* shift register contents */
+
+	long bytes_out;			/* number of output bytes */
+	unsigned long outcnt;		/* bytes in output buffer */
+
+	unsigned hufts;			/* track memory usage */
+	uint64_t bb;			/* bit buffer */
+	unsigned bk;			/* bits in bit buffer */
+	int in_eof;			/* ran out of input */
+
+	int inflate_stage;
+	int inflate_last;		/* the current block is the last one */
+	unsigned long stored_n;		/* bytes left in a stored block */
+	huft_t *codes_tl, *codes_td;	/* tables of the current block */
+	int codes_bl, codes_bd;
+	unsigned long copy_n, copy_d;	/* rest of a match cut short by a full window */
+};
+
+#define WINDOW_FULL	(-1)
+
+/* error code for a stream cut short, besides those of huft_build() */
+#define INFLATE_EOF	4
+
+/*
+ * The bit buffer is filled a byte at a time, and is 64 bits wide so that
+ * inflate_codes() can load a whole length/distance pair in one go.
+ * Running out of input is only noted here, inflate_get_next_window()
+ * reports it.
+ */
+static inline unsigned next_byte(gunzip_t *gz)
 {
-	error_msg("gzip aborted\n");
-	_exit(-1);
+	int c = getc_unlocked(gz->in_file);
+
+	if (c == EOF) {
+		gz->in_eof = 1;
+		return 0;
+	}
+	return c;
 }
 
-static void make_crc_table()
+#define NEEDBITS(b, k, n) \
+	while ((k) < (unsigned) (n)) { \
+		(b) |= (uint64_t) next_byte(gz) << (k); \
+		(k) += 8; \
+	}
+
+/* fill the bit buffer with whole bytes, up to 57 bits at least */
+#define REFILL(b, k) \
+	while ((k) <= 56) { \
+		(b) |= (uint64_t) next_byte(gz) << (k); \
+		(k) += 8; \
+	}
+
+static const unsigned short mask_bits[] = {
+	0x0000,
+	0x0001, 0x0003, 0x0007, 0x000f, 0x001f, 0x003f, 0x007f, 0x00ff,
+	0x01ff, 0x03ff, 0x07ff, 0x0fff, 0x1fff, 0x3fff, 0x7fff, 0xffff
+};
+
+static void make_crc_table(gunzip_t *gz)
 {
 	unsigned long table_entry;      /* crc shift register */
 	unsigned long poly = 0;      /* polynomial exclusive-or pattern */
@@ -111,8 +157,7 @@ static void make_crc_table()
 	static int p[] = {0,1,2,4,5,7,8,10,11,12,16,22,23,26};
 
 	/* initial shift register value */
-	crc = 0xffffffffL;	
-	crc_table = (unsigned long *) xmalloc(256 * sizeof(unsigned long));
+	gz->crc = 0xffffffffL;	
 
 	/* Make exclusive-or pattern from polynomial (0xedb88320) */
 	for (i = 0; i < sizeof(p)/sizeof(int); i++)
@@ -127,39 +172,58 @@ static void make_crc_table()
 		for (k = 8; k; k--) {
 			table_entry = table_entry & 1 ? (table_entry >> 1) ^ poly : table_entry >> 1;
 		}
-		crc_table[i]=table_entry;
+		gz->crc_table[0][i]=table_entry;
+	}
+
+	/* crc_table[j][i] is the crc of byte i followed by j zero bytes */
+	for (i = 0; i < 256; i++) {
+		table_entry = gz->crc_table[0][i];
+		for (k = 1; k < 8; k++) {
+			table_entry = gz->crc_table[0][table_entry & 0xff] ^ (table_entry >> 8);
+			gz->crc_table[k][i] = table_entry;
+		}
 	}
 }
 
-/* ===========================================================================
- * Write the output window window[0..outcnt-1] and update crc and bytes_out.
- * (Used for the decompressed data only.)
+/*
+ * Run n bytes of buf through the crc, eight at a time (slice-by-8).
  */
-static void flush_window(void)
+static void crc_update(gunzip_t *gz, const unsigned char *buf, unsigned long n)
 {
-	int n;
+	uint32_t (*t)[256] = gz->crc_table;
+	uint32_t c = gz->crc;
+	uint32_t lo, hi;
+
+	while (n >= 8) {
+		lo = c ^ (buf[0] | buf[1] << 8 | buf[2] << 16 | (uint32_t) buf[3] << 24);
+		hi = buf[4] | buf[5] << 8 | buf[6] << 16 | (uint32_t) buf[7] << 24;
+		c = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^
+			t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+			t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^
+			t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+		buf += 8;
+		n -= 8;
+	}
+	while (n--)
+		c = t[0][(c ^ *buf++) & 0xff] ^ (c >> 8);
 
-	if (outcnt == 0)
-		return;
+	gz->crc = c;
+}
 
-	for (n = 0; n < outcnt; n++) {
-		crc = crc_table[((int) crc ^ (window[n])) & 0xff] ^ (crc >> 8);
-	}
+/* ===========================================================================
+ * Write the output window window[0..outcnt-1].
+ */
+static int flush_window(gunzip_t *gz)
+{
+	if (gz->outcnt == 0)
+		return 0;
 
-	if (fwrite(window, 1, outcnt, out_file) != outcnt) {
-		/*
-		 * The Parent process may not be interested in all the data we have,
-		 * in which case it will rudely close its end of the pipe and
-		 * wait for us to exit.
-		 */
-		if (errno == EPIPE)
-			_exit(EXIT_SUCCESS);
-
-		error_msg("Couldnt write");
-		_exit(EXIT_FAILURE);
+	if (fwrite(gz->window, 1, gz->outcnt, gz->out_file) != gz->outcnt) {
+		perror_msg("Couldnt write");
+		return 1;
 	}
-	bytes_out += (unsigned long) outcnt;
-	outcnt = 0;
+
+	return 0;
 }
 
 /*
@@ -196,7 +260,7 @@ static int huft_free(huft_t *t)
  * t:	result: starting table
  * m:	maximum lookup bits, returns actual
  */
-static int huft_build(unsigned int *b, const unsigned int n, const unsigned int s, 
+static int huft_build(gunzip_t *gz, unsigned int *b, const unsigned int n, const unsigned int s, 
 	const unsigned short *d, const unsigned short *e, huft_t **t, int *m)
 {
 	unsigned a;		/* counter for codes of length k */
@@ -312,7 +376,7 @@ static int huft_build(unsigned int *b, const unsigned int n, const unsigned int
 					}
 					return 3;	/* not enough memory */
 				}
-				hufts += z + 1;	/* track memory usage */
+				gz->hufts += z + 1;	/* track memory usage */
 				*t = q + 1;		/* link to list for huft_free() */
 				*(t = &(q->v.t)) = NULL;
 				u[h] = ++q;		/* table starts after link */
@@ -363,58 +427,111 @@ static int huft_build(unsigned int *b, const unsigned int n, const unsigned int
 }
 
 /*
- * inflate (decompress) the codes in a deflated (compressed) block.
- * Return an error code or zero if it all goes ok.
- *
- * tl, td: literal/length and distance decoder tables
- * bl, bd: number of bits decoded by tl[] and td[]
+ * inflate (decompress) the codes in a deflated (compressed) block, with the
+ * tables in codes_tl, codes_td. Return an error code, zero at the end of
+ * the block, or WINDOW_FULL when the window has to be handed out first.
  */
-static int inflate_codes(huft_t *tl, huft_t *td, int bl, int bd)
+static int inflate_codes(gunzip_t *gz)
 {
+	huft_t *tl = gz->codes_tl, *td = gz->codes_td;	/* literal/length and distance decoder tables */
+	int bl = gz->codes_bl, bd = gz->codes_bd;	/* number of bits decoded by tl[] and td[] */
 	unsigned long e;		/* table entry flag/number of extra bits */
 	unsigned long n, d;				/* length and index for copy */
 	unsigned long w;				/* current window position */
 	huft_t *t;				/* pointer to table entry */
 	unsigned ml, md;			/* masks for bl and bd bits */
-	unsigned long b;				/* bit buffer */
+	uint64_t b;				/* bit buffer */
 	unsigned k;		/* number of bits in bit buffer */
 
-	/* make local copies of globals */
-	b = bb;					/* initialize bit buffer */
-	k = bk;
-	w = outcnt;				/* initialize window position */
+	/* make local copies of the stream state */
+	b = gz->bb;					/* initialize bit buffer */
+	k = gz->bk;
+	w = gz->outcnt;				/* initialize window position */
 
 	/* inflate the coded data */
 	ml = mask_bits[bl];			/* precompute masks for speed */
 	md = mask_bits[bd];
 	for (;;) {				/* do until end of block */
-		while (k < (unsigned) bl) {
-			b |= ((unsigned long)fgetc(in_file)) << k;
-			k += 8;
-		}
-		if ((e = (t = tl + ((unsigned) b & ml))->e) > 16)
-		do {
-			if (e == 99) {
-				return 1;
+		if (gz->copy_n == 0 && w < WSIZE - 258) {
+			/*
+			 * Fast path: the longest match fits in the window, and
+			 * a single refill covers a whole length/distance pair,
+			 * at most 15+5+15+13 bits, so no NEEDBITS in between.
+			 */
+			if (k < 48)
+				REFILL(b, k);
+			t = tl + ((unsigned) b & ml);
+			while ((e = t->e) > 16) {
+				if (e == 99)
+					return 1;
+				b >>= t->b;
+				k -= t->b;
+				t = t->v.t + ((unsigned) b & mask_bits[e - 16]);
 			}
 			b >>= t->b;
 			k -= t->b;
-			e -= 16;
-			while (k < e) {
-				b |= ((unsigned long)fgetc(in_file)) << k;
-				k += 8;
+			if (e == 16) {		/* literal */
+				gz->window[w++] = (unsigned char) t->v.n;
+				continue;
 			}
-		} while ((e = (t = t->v.t + ((unsigned) b & mask_bits[e]))->e) > 16);
-		b >>= t->b;
-		k -= t->b;
-		if (e == 16) {		/* then it's a literal */
-			window[w++] = (unsigned char) t->v.n;
-			if (w == WSIZE) {
-				outcnt=(w),
-				flush_window();
-				w = 0;
+			if (e == 15)		/* end of block */
+				break;
+
+			n = t->v.n + ((unsigned) b & mask_bits[e]);
+			b >>= e;
+			k -= e;
+
+			t = td + ((unsigned) b & md);
+			while ((e = t->e) > 16) {
+				if (e == 99)
+					return 1;
+				b >>= t->b;
+				k -= t->b;
+				t = t->v.t + ((unsigned) b & mask_bits[e - 16]);
 			}
-		} else {				/* it's an EOB or a length */
+			b >>= t->b;
+			k -= t->b;
+			d = t->v.n + ((unsigned) b & mask_bits[e]);
+			b >>= e;
+			k -= e;
+
+			if (d <= w) {
+				/* no wrap around the window */
+				unsigned char *out = gz->window + w;
+				unsigned char *from = out - d;
+
+				w += n;
+				if (d >= n)
+					memcpy(out, from, n);
+				else
+					do {
+						*out++ = *from++;
+					} while (--n);
+				continue;
+			}
+			d = w - d;
+		} else if (gz->copy_n == 0) {
+			NEEDBITS(b, k, bl);
+			if ((e = (t = tl + ((unsigned) b & ml))->e) > 16)
+			do {
+				if (e == 99) {
+					return 1;
+				}
+				b >>= t->b;
+				k -= t->b;
+				e -= 16;
+				NEEDBITS(b, k, e);
+			} while ((e = (t = t->v.t + ((unsigned) b & mask_bits[e]))->e) > 16);
+			b >>= t->b;
+			k -= t->b;
+			if (e == 16) {		/* then it's a literal */
+				gz->window[w++] = (unsigned char) t->v.n;
+				if (w == WSIZE)
+					goto window_full;
+				continue;
+			}
+
+			/* it's an EOB or a length */
 
 			/* exit if end of block */
 			if (e == 15) {
@@ -422,19 +539,13 @@ static int inflate_codes(huft_t *tl, huft_t *td, int bl, int bd)
 			}
 
 			/* get length of block to copy */
-			while (k < e) {
-				b |= ((unsigned long)fgetc(in_file)) << k;
-				k += 8;
-			}
+			NEEDBITS(b, k, e);
 			n = t->v.n + ((unsigned) b & mask_bits[e]);
 			b >>= e;
 			k -= e;
 
 			/* decode distance of block to copy */
-			while (k < (unsigned) bd) {
-				b |= ((unsigned long)fgetc(in_file)) << k;
-				k += 8;
-			}
+			NEEDBITS(b, k, bd);
 
 			if ((e = (t = td + ((unsigned) b & md))->e) > 16)
 				do {
@@ -443,62 +554,111 @@ static int inflate_codes(huft_t *tl, huft_t *td, int bl, int bd)
 					b >>= t->b;
 					k -= t->b;
 					e -= 16;
-					while (k < e) {
-						b |= ((unsigned long)fgetc(in_file)) << k;
-						k += 8;
-					}
+					NEEDBITS(b, k, e);
 				} while ((e = (t = t->v.t + ((unsigned) b & mask_bits[e]))->e) > 16);
 			b >>= t->b;
 			k -= t->b;
-			while (k < e) {
-				b |= ((unsigned long)fgetc(in_file)) << k;
-				k += 8;
-			}
+			NEEDBITS(b, k, e);
 			d = w - t->v.n - ((unsigned) b & mask_bits[e]);
 			b >>= e;
 			k -= e;
+		} else {
+			/* resume a copy cut short by a full window */
+			n = gz->copy_n;
+			d = gz->copy_d;
+		}
 
-			/* do the copy */
-			do {
-				n -= (e = (e = WSIZE - ((d &= WSIZE - 1) > w ? d : w)) > n ? n : e);
+		/* do the copy */
+		do {
+			n -= (e = (e = WSIZE - ((d &= WSIZE - 1) > w ? d : w)) > n ? n : e);
 #if !defined(NOMEMCPY) && !defined(DEBUG)
-				if (w - d >= e) {	/* (this test assumes unsigned comparison) */
-					memcpy(window + w, window + d, e);
-					w += e;
-					d += e;
-				} else			/* do it slow to avoid memcpy() overlap */
+			if (w - d >= e) {	/* (this test assumes unsigned comparison) */
+				memcpy(gz->window + w, gz->window + d, e);
+				w += e;
+				d += e;
+			} else			/* do it slow to avoid memcpy() overlap */
 #endif							/* !NOMEMCPY */
-					do {
-						window[w++] = window[d++];
-					} while (--e);
-				if (w == WSIZE) {
-					outcnt=(w),
-					flush_window();
-					w = 0;
-				}
-			} while (n);
-		}
+				do {
+					gz->window[w++] = gz->window[d++];
+				} while (--e);
+			if (w == WSIZE) {
+				gz->copy_n = n;
+				gz->copy_d = d;
+				goto window_full;
+			}
+		} while (n);
+		gz->copy_n = 0;
 	}
 
-	/* restore the globals from the locals */
-	outcnt = w;			/* restore global window pointer */
-	bb = b;				/* restore global bit buffer */
-	bk = k;
+	/* restore the stream state from the locals */
+	gz->outcnt = w;			/* restore window pointer */
+	gz->bb = b;				/* restore bit buffer */
+	gz->bk = k;
 
 	/* done */
 	return 0;
+
+window_full:
+	gz->outcnt = w;
+	gz->bb = b;
+	gz->bk = k;
+	return WINDOW_FULL;
 }
 
 /*
- * decompress an inflated block
+ * copy the rest of a stored block, stored_n bytes, to the window
+ */
+static int inflate_stored(gunzip_t *gz)
+{
+	unsigned long w;			/* current window position */
+	unsigned long n;
+	uint64_t b_stored;			/* bit buffer */
+	unsigned long k_stored;		/* number of bits in bit buffer */
+	int r = 0;
+
+	/* make local copies of the stream state */
+	b_stored = gz->bb;				/* initialize bit buffer */
+	k_stored = gz->bk;
+	w = gz->outcnt;			/* initialize window position */
+
+	/* first the bytes already in the bit buffer */
+	while (gz->stored_n && k_stored && w < (unsigned long)WSIZE) {
+		gz->window[w++] = (unsigned char) b_stored;
+		b_stored >>= 8;
+		k_stored -= 8;
+		gz->stored_n--;
+	}
+
+	/* then straight from the input */
+	while (gz->stored_n && k_stored == 0 && w < (unsigned long)WSIZE) {
+		n = WSIZE - w < gz->stored_n ? WSIZE - w : gz->stored_n;
+		if (fread(gz->window + w, 1, n, gz->in_file) != n) {
+			gz->in_eof = 1;
+			break;
+		}
+		w += n;
+		gz->stored_n -= n;
+	}
+
+	if (w == (unsigned long)WSIZE)
+		r = WINDOW_FULL;
+
+	/* restore the stream state from the locals */
+	gz->outcnt = w;			/* restore window pointer */
+	gz->bb = b_stored;				/* restore bit buffer */
+	gz->bk = k_stored;
+	return r;
+}
+
+/*
+ * read the header of an inflated block and get ready to decompress it,
+ * setting inflate_stage accordingly
  * e: last block flag
- *
- * GLOBAL VARIABLES: bb, kk,
  */
-static int inflate_block(int *e)
+static int inflate_block_setup(gunzip_t *gz, int *e)
 {
 	unsigned t;			/* block type */
-	unsigned long b;			/* bit buffer */
+	uint64_t b;			/* bit buffer */
 	unsigned k;		/* number of bits in bit buffer */
 	static unsigned short cplens[] = {		/* Copy lengths for literal codes 257..285 */
 		3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
@@ -521,44 +681,36 @@ static int inflate_block(int *e)
 	};
 
 	/* make local bit buffer */
-	b = bb;
-	k = bk;
+	b = gz->bb;
+	k = gz->bk;
 
 	/* read in last block bit */
-	while (k < 1) {
-		b |= ((unsigned long)fgetc(in_file)) << k;
-		k += 8;
-	}
+	NEEDBITS(b, k, 1);
 	*e = (int) b & 1;
 	b >>= 1;
 	k -= 1;
 
 	/* read in block type */
-	while (k < 2) {
-		b |= ((unsigned long)fgetc(in_file)) << k;
-		k += 8;
-	}
+	NEEDBITS(b, k, 2);
 	t = (unsigned) b & 3;
 	b >>= 2;
 	k -= 2;
 
-	/* restore the global bit buffer */
-	bb = b;
-	bk = k;
+	/* restore the bit buffer */
+	gz->bb = b;
+	gz->bk = k;
 
 	/* inflate that block type */
 	switch (t) {
 	case 0:	/* Inflate stored */
 		{
 			unsigned long n;			/* number of bytes in block */
-			unsigned long w;			/* current window position */
-			unsigned long b_stored;			/* bit buffer */
+			uint64_t b_stored;			/* bit buffer */
 			unsigned long k_stored;		/* number of bits in bit buffer */
 
-			/* make local copies of globals */
-			b_stored = bb;				/* initialize bit buffer */
-			k_stored = bk;
-			w = outcnt;			/* initialize window position */
+			/* make local copies of the stream state */
+			b_stored = gz->bb;				/* initialize bit buffer */
+			k_stored = gz->bk;
 
 			/* go to byte boundary */
 			n = k_stored & 7;
@@ -566,43 +718,23 @@ static int inflate_block(int *e)
 			k_stored -= n;
 
 			/* get the length and its complement */
-			while (k_stored < 16) {
-				b_stored |= ((unsigned long)fgetc(in_file)) << k_stored;
-				k_stored += 8;
-			}
+			NEEDBITS(b_stored, k_stored, 16);
 			n = ((unsigned) b_stored & 0xffff);
 			b_stored >>= 16;
 			k_stored -= 16;
-			while (k_stored < 16) {
-				b_stored |= ((unsigned long)fgetc(in_file)) << k_stored;
-				k_stored += 8;
-			}
+			NEEDBITS(b_stored, k_stored, 16);
 			if (n != (unsigned) ((~b_stored) & 0xffff)) {
 				return 1;		/* error in compressed data */
 			}
 			b_stored >>= 16;
 			k_stored -= 16;
 
-			/* read and output the compressed data */
-			while (n--) {
-				while (k_stored < 8) {
-					b_stored |= ((unsigned long)fgetc(in_file)) << k_stored;
-					k_stored += 8;
-				}
-				window[w++] = (unsigned char) b_stored;
-				if (w == (unsigned long)WSIZE) {
-					outcnt=(w),
-					flush_window();
-					w = 0;
-				}
-				b_stored >>= 8;
-				k_stored -= 8;
-			}
+			/* restore the stream state from the locals */
+			gz->bb = b_stored;				/* restore bit buffer */
+			gz->bk = k_stored;
 
-			/* restore the globals from the locals */
-			outcnt = w;			/* restore global window pointer */
-			bb = b_stored;				/* restore global bit buffer */
-			bk = k_stored;
+			gz->stored_n = n;
+			gz->inflate_stage = STAGE_STORED;
 			return 0;
 		}
 	case 1:	/* Inflate fixed 
@@ -632,7 +764,7 @@ static int inflate_block(int *e)
 				l[i] = 8;
 			}
 			bl = 7;
-			if ((i = huft_build(l, 288, 257, cplens, cplext, &tl, &bl)) != 0) {
+			if ((i = huft_build(gz, l, 288, 257, cplens, cplext, &tl, &bl)) != 0) {
 				return i;
 			}
 
@@ -641,21 +773,18 @@ static int inflate_block(int *e)
 				l[i] = 5;
 			}
 			bd = 5;
-			if ((i = huft_build(l, 30, 0, cpdist, cpdext, &td, &bd)) > 1) {
+			if ((i = huft_build(gz, l, 30, 0, cpdist, cpdext, &td, &bd)) > 1) {
 				huft_free(tl);
 				return i;
 			}
 
 			/* decompress until an end-of-block code */
-			if (inflate_codes(tl, td, bl, bd)) {
-				huft_free(tl);
-				huft_free(td);
-				return 1;
-			}
-
-			/* free the decoding tables, return */
-			huft_free(tl);
-			huft_free(td);
+			gz->codes_tl = tl;
+			gz->codes_td = td;
+			gz->codes_bl = bl;
+			gz->codes_bd = bd;
+			gz->copy_n = 0;
+			gz->inflate_stage = STAGE_CODES;
 			return 0;
 		}
 	case 2:	/* Inflate dynamic */
@@ -664,8 +793,8 @@ static int inflate_block(int *e)
 			static unsigned border[] = {	/* Order of the bit length code lengths */
 				16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
 			};
-			int dbits = 6;					/* bits in base distance lookup table */
-			int lbits = 9;					/* bits in base literal/length lookup table */
+			int dbits = 8;					/* bits in base distance lookup table */
+			int lbits = 10;					/* bits in base literal/length lookup table */
 
 			int i;						/* temporary variables */
 			unsigned j;
@@ -681,32 +810,23 @@ static int inflate_block(int *e)
 			unsigned nd;				/* number of distance codes */
 
 			unsigned ll[286 + 30];		/* literal/length and distance code lengths */
-			unsigned long b_dynamic;	/* bit buffer */
+			uint64_t b_dynamic;	/* bit buffer */
 			unsigned k_dynamic;		/* number of bits in bit buffer */
 
 			/* make local bit buffer */
-			b_dynamic = bb;
-			k_dynamic = bk;
+			b_dynamic = gz->bb;
+			k_dynamic = gz->bk;
 
 			/* read in table lengths */
-			while (k_dynamic < 5) {
-				b_dynamic |= ((unsigned long)fgetc(in_file)) << k_dynamic;
-				k_dynamic += 8;
-			}
+			NEEDBITS(b_dynamic, k_dynamic, 5);
 			nl = 257 + ((unsigned) b_dynamic & 0x1f);	/* number of literal/length codes */
 			b_dynamic >>= 5;
 			k_dynamic -= 5;
-			while (k_dynamic < 5) {
-				b_dynamic |= ((unsigned long)fgetc(in_file)) << k_dynamic;
-				k_dynamic += 8;
-			}
+			NEEDBITS(b_dynamic, k_dynamic, 5);
 			nd = 1 + ((unsigned) b_dynamic & 0x1f);	/* number of distance codes */
 			b_dynamic >>= 5;
 			k_dynamic -= 5;
-			while (k_dynamic < 4) {
-				b_dynamic |= ((unsigned long)fgetc(in_file)) << k_dynamic;
-				k_dynamic += 8;
-			}
+			NEEDBITS(b_dynamic, k_dynamic, 4);
 			nb = 4 + ((unsigned) b_dynamic & 0xf);	/* number of bit length codes */
 			b_dynamic >>= 4;
 			k_dynamic -= 4;
@@ -716,10 +836,7 @@ static int inflate_block(int *e)
 
 			/* read in bit-length-code lengths */
 			for (j = 0; j < nb; j++) {
-				while (k_dynamic < 3) {
-					b_dynamic |= ((unsigned long)fgetc(in_file)) << k_dynamic;
-					k_dynamic += 8;
-				}
+				NEEDBITS(b_dynamic, k_dynamic, 3);
 				ll[border[j]] = (unsigned) b_dynamic & 7;
 				b_dynamic >>= 3;
 				k_dynamic -= 3;
@@ -730,7 +847,7 @@ static int inflate_block(int *e)
 
 			/* build decoding table for trees--single level, 7 bit lookup */
 			bl = 7;
-			if ((i = huft_build(ll, 19, 19, NULL, NULL, &tl, &bl)) != 0) {
+			if ((i = huft_build(gz, ll, 19, 19, NULL, NULL, &tl, &bl)) != 0) {
 				if (i == 1) {
 					huft_free(tl);
 				}
@@ -742,10 +859,7 @@ static int inflate_block(int *e)
 			m = mask_bits[bl];
 			i = l = 0;
 			while ((unsigned) i < n) {
-				while (k_dynamic < (unsigned) bl) {
-					b_dynamic |= ((unsigned long)fgetc(in_file)) << k_dynamic;
-					k_dynamic += 8;
-				}
+				NEEDBITS(b_dynamic, k_dynamic, bl);
 				j = (td = tl + ((unsigned) b_dynamic & m))->b;
 				b_dynamic >>= j;
 				k_dynamic -= j;
@@ -754,10 +868,7 @@ static int inflate_block(int *e)
 					ll[i++] = l = j;	/* save last length in l */
 				}
 				else if (j == 16) {		/* repeat last length 3 to 6 times */
-					while (k_dynamic < 2) {
-						b_dynamic |= ((unsigned long)fgetc(in_file)) << k_dynamic;
-						k_dynamic += 8;
-					}
+					NEEDBITS(b_dynamic, k_dynamic, 2);
 					j = 3 + ((unsigned) b_dynamic & 3);
 					b_dynamic >>= 2;
 					k_dynamic -= 2;
@@ -768,10 +879,7 @@ static int inflate_block(int *e)
 						ll[i++] = l;
 					}
 				} else if (j == 17) {	/* 3 to 10 zero length codes */
-					while (k_dynamic < 3) {
-						b_dynamic |= ((unsigned long)fgetc(in_file)) << k_dynamic;
-						k_dynamic += 8;
-					}
+					NEEDBITS(b_dynamic, k_dynamic, 3);
 					j = 3 + ((unsigned) b_dynamic & 7);
 					b_dynamic >>= 3;
 					k_dynamic -= 3;
@@ -783,10 +891,7 @@ static int inflate_block(int *e)
 					}
 					l = 0;
 				} else {		/* j == 18: 11 to 138 zero length codes */
-					while (k_dynamic < 7) {
-						b_dynamic |= ((unsigned long)fgetc(in_file)) << k_dynamic;
-						k_dynamic += 8;
-					}
+					NEEDBITS(b_dynamic, k_dynamic, 7);
 					j = 11 + ((unsigned) b_dynamic & 0x7f);
 					b_dynamic >>= 7;
 					k_dynamic -= 7;
@@ -803,13 +908,13 @@ static int inflate_block(int *e)
 			/* free decoding table for trees */
 			huft_free(tl);
 
-			/* restore the global bit buffer */
-			bb = b_dynamic;
-			bk = k_dynamic;
+			/* restore the bit buffer */
+			gz->bb = b_dynamic;
+			gz->bk = k_dynamic;
 
 			/* build the decoding tables for literal/length and distance codes */
 			bl = lbits;
-			if ((i = huft_build(ll, nl, 257, cplens, cplext, &tl, &bl)) != 0) {
+			if ((i = huft_build(gz, ll, nl, 257, cplens, cplext, &tl, &bl)) != 0) {
 				if (i == 1) {
 					error_msg("Incomplete literal tree");
 					huft_free(tl);
@@ -817,7 +922,7 @@ static int inflate_block(int *e)
 				return i;			/* incomplete code set */
 			}
 			bd = dbits;
-			if ((i = huft_build(ll + nl, nd, 0, cpdist, cpdext, &td, &bd)) != 0) {
+			if ((i = huft_build(gz, ll + nl, nd, 0, cpdist, cpdext, &td, &bd)) != 0) {
 				if (i == 1) {
 					error_msg("incomplete distance tree");
 					huft_free(td);
@@ -827,15 +932,12 @@ static int inflate_block(int *e)
 			}
 
 			/* decompress until an end-of-block code */
-			if (inflate_codes(tl, td, bl, bd)) {
-				huft_free(tl);
-				huft_free(td);
-				return 1;
-			}
-
-			/* free the decoding tables, return */
-			huft_free(tl);
-			huft_free(td);
+			gz->codes_tl = tl;
+			gz->codes_td = td;
+			gz->codes_bl = bl;
+			gz->codes_bd = bd;
+			gz->copy_n = 0;
+			gz->inflate_stage = STAGE_CODES;
 			return 0;
 		}
 	default:
@@ -844,94 +946,102 @@ static int inflate_block(int *e)
 	}
 }
 
-/*
- * decompress an inflated entry
- *
- * GLOBAL VARIABLES: outcnt, bk, bb, hufts, inptr
- */
-static int inflate()
+static void inflate_start(gunzip_t *gz)
 {
-	int e;				/* last block flag */
-	int r;				/* result code */
-	unsigned h = 0;		/* maximum struct huft's malloc'ed */
-
 	/* initialize window, bit buffer */
-	outcnt = 0;
-	bk = 0;
-	bb = 0;
+	gz->outcnt = 0;
+	gz->bk = 0;
+	gz->bb = 0;
+	gz->bytes_out = 0L;
+
+	gz->inflate_stage = STAGE_BLOCK;
+	gz->inflate_last = 0;
+	gz->codes_tl = gz->codes_td = NULL;
+}
 
-	/* decompress until the last block */
-	do {
-		hufts = 0;
-		if ((r = inflate_block(&e)) != 0) {
-			return r;
-		}
-		if (hufts > h) {
-			h = hufts;
+static void inflate_free_codes(gunzip_t *gz)
+{
+	if (gz->codes_tl)
+		huft_free(gz->codes_tl);
+	if (gz->codes_td)
+		huft_free(gz->codes_td);
+	gz->codes_tl = gz->codes_td = NULL;
+}
+
+/*
+ * decompress into the window until it is full or the deflated data is over.
+ * Returns how much of the window is used, 0 at the end, or a negative error
+ * code.
+ */
+static int inflate_get_next_window(gunzip_t *gz)
+{
+	int r = 0;			/* result code */
+
+	gz->outcnt = 0;
+	while (gz->inflate_stage != STAGE_DONE) {
+		switch (gz->inflate_stage) {
+		case STAGE_BLOCK:
+			if (gz->inflate_last) {
+				/* Discard the unused bits in the last meaningful byte.
+				 * Whole bytes of lookahead left in the bit buffer are the
+				 * start of the trailer, gunzip_trailer() picks them up. */
+				gz->bb >>= gz->bk & 7;
+				gz->bk -= gz->bk & 7;
+				gz->inflate_stage = STAGE_DONE;
+				continue;
+			}
+			gz->hufts = 0;
+			r = inflate_block_setup(gz, &gz->inflate_last);
+			break;
+		case STAGE_STORED:
+			r = inflate_stored(gz);
+			if (r == 0)
+				gz->inflate_stage = STAGE_BLOCK;
+			break;
+		case STAGE_CODES:
+			r = inflate_codes(gz);
+			if (r != WINDOW_FULL) {
+				inflate_free_codes(gz);
+				gz->inflate_stage = STAGE_BLOCK;
+			}
+			break;
 		}
-	} while (!e);
 
-	/* Undo too much lookahead.  The next read will be byte aligned so we
-	 * can discard unused bits in the last meaningful byte.  */
-	while (bk >= 8) {
-		bk -= 8;
-		ungetc((bb << bk), in_file);
+		if (r != WINDOW_FULL && r != 0)
+			break;
+		if (gz->in_eof)
+			r = INFLATE_EOF;
+		if (r != 0)
+			break;
+	}
+
+	if (r != WINDOW_FULL && r != 0) {
+		inflate_free_codes(gz);
+		gz->inflate_stage = STAGE_DONE;
+		return -r;
 	}
 
-	/* flush out window */
-	flush_window();
+	crc_update(gz, gz->window, gz->outcnt);
+	gz->bytes_out += (unsigned long) gz->outcnt;
 
-	/* return success */
-	return 0;
+	return gz->outcnt;
 }
 
-/* ===========================================================================
- * Unzip in to out.  This routine works on both gzip and pkzip files.
- *
- * IN assertions: the buffer inbuf contains already the beginning of
- *   the compressed data, from offsets inptr to insize-1 included.
- *   The magic header has already been checked. The output buffer is cleared.
- * in, out: input and output file descriptors
+/*
+ * Read and check the gzip header, and get ready to inflate what follows.
  */
-extern int unzip(FILE *l_in_file, FILE *l_out_file)
+static int gunzip_header(gunzip_t *gz)
 {
 	const int extra_field = 0x04;	/* bit 2 set: extra field present */
 	const int orig_name = 0x08;	/* bit 3 set: original file name present */
 	const int comment = 0x10;	/* bit 4 set: file comment present */
-	unsigned char buf[8];	/* extended local header */
 	unsigned char flags;	/* compression flags */
 	char magic[2];			/* magic header */
 	int method;
-	typedef void (*sig_type) (int);
-	int exit_code=0;	/* program exit code */
-	int i;
-
-	in_file = l_in_file;
-	out_file = l_out_file;
-
-	if (signal(SIGINT, SIG_IGN) != SIG_IGN) {
-		(void) signal(SIGINT, (sig_type) abort_gzip);
-	}
-#ifdef SIGTERM
-//	if (signal(SIGTERM, SIG_IGN) != SIG_IGN) {
-//		(void) signal(SIGTERM, (sig_type) abort_gzip);
-//	}
-#endif
-#ifdef SIGHUP
-	if (signal(SIGHUP, SIG_IGN) != SIG_IGN) {
-		(void) signal(SIGHUP, (sig_type) abort_gzip);
-	}
-#endif
+	int i, c;
 
-	signal(SIGPIPE, SIG_IGN);
-
-	/* Allocate all global buffers (for DYN_ALLOC option) */
-	window = xmalloc((size_t)(((2L*WSIZE)+1L)*sizeof(unsigned char)));
-	outcnt = 0;
-	bytes_out = 0L;
-
-	magic[0] = fgetc(in_file);
-	magic[1] = fgetc(in_file);
+	magic[0] = fgetc(gz->in_file);
+	magic[1] = fgetc(gz->in_file);
 
 	/* Magic header for gzip files, 1F 8B = \037\213 */
 	if (memcmp(magic, "\037\213", 2) != 0) {
@@ -939,84 +1049,175 @@ extern int unzip(FILE *l_in_file, FILE *l_out_file)
 		return EXIT_FAILURE;
 	}
 
-	method = (int) fgetc(in_file);
+	method = (int) fgetc(gz->in_file);
 	if (method != 8) {
 		error_msg("unknown method %d -- get newer version of gzip", method);
-		exit_code = 1;
 		return -1;
 	}
 
-	flags = (unsigned char) fgetc(in_file);
+	flags = (unsigned char) fgetc(gz->in_file);
 
 	/* Ignore time stamp(4), extra flags(1), OS type(1) */
 	for (i = 0; i < 6; i++)
-		fgetc(in_file);
+		fgetc(gz->in_file);
 
 	if ((flags & extra_field) != 0) {
 		size_t extra;
-		extra = fgetc(in_file);
-		extra += fgetc(in_file) << 8;
+		extra = fgetc(gz->in_file);
+		extra += fgetc(gz->in_file) << 8;
 
 		for (i = 0; i < extra; i++)
-			fgetc(in_file);
+			fgetc(gz->in_file);
 	}
 
 	/* Discard original name if any */
 	if ((flags & orig_name) != 0) {
-		while (fgetc(in_file) != 0);	/* null */
+		while ((c = fgetc(gz->in_file)) != 0 && c != EOF);	/* null */
 	}
 
 	/* Discard file comment if any */
 	if ((flags & comment) != 0) {
-		while (fgetc(in_file) != 0);	/* null */
-	}
-
-	if (method < 0) {
-		return(exit_code);
+		while ((c = fgetc(gz->in_file)) != 0 && c != EOF);	/* null */
 	}
 
-	make_crc_table();
-
-	/* Decompress */
-	if (method == 8) {
-
-		int res = inflate();
+	/* Allocate the window (for DYN_ALLOC option) */
+	gz->window = xmalloc((size_t)(((2L*WSIZE)+1L)*sizeof(unsigned char)));
+	make_crc_table(gz);
+	inflate_start(gz);
 
-		if (res == 3) {
-			perror_msg("inflate");
-			exit_code = 1;
-		} else if (res != 0) {
-			error_msg("invalid compressed data--format violated");
-			exit_code = 1;
-		}
+	return 0;
+}
 
-	} else {
-		error_msg("internal error, invalid method");
-		exit_code = 1;
-	}
+/*
+ * Check the crc and length trailer once everything was inflated.
+ */
+static int gunzip_trailer(gunzip_t *gz)
+{
+	unsigned char buf[8];	/* extended local header */
+	int i, c;
 
 	/* Get the crc and original length
 	 * crc32  (see algorithm.doc)
 	 * uncompressed input size modulo 2^32
 	 */
-	fread(buf, 1, 8, in_file);
+	for (i = 0; i < 8; i++) {
+		if (gz->bk >= 8) {
+			buf[i] = (unsigned char) gz->bb;
+			gz->bb >>= 8;
+			gz->bk -= 8;
+		} else if ((c = getc(gz->in_file)) != EOF) {
+			buf[i] = c;
+		} else {
+			error_msg("invalid compressed data--unexpected end of file");
+			return 1;
+		}
+	}
 
 	/* Validate decompression - crc */
-	if (!exit_code && (unsigned int)((buf[0] | (buf[1] << 8)) |((buf[2] | (buf[3] << 8)) << 16)) != (crc ^ 0xffffffffL)) {
+	if ((unsigned int)((buf[0] | (buf[1] << 8)) |((buf[2] | (buf[3] << 8)) << 16)) != (gz->crc ^ 0xffffffffL)) {
 		error_msg("invalid compressed data--crc error");
-		exit_code = 1;
+		return 1;
 	}
 	/* Validate decompression - size */
-	if (!exit_code && ((buf[4] | (buf[5] << 8)) |((buf[6] | (buf[7] << 8)) << 16)) != (unsigned long) bytes_out) {
+	if (((buf[4] | (buf[5] << 8)) |((buf[6] | (buf[7] << 8)) << 16)) != (unsigned long) gz->bytes_out) {
 		error_msg("invalid compressed data--length error");
-		exit_code = 1;
+		return 1;
+	}
+
+	return 0;
+}
+
+static int gunzip_error(int res)
+{
+	if (res == -3)
+		perror_msg("inflate");
+	else if (res == -INFLATE_EOF)
+		error_msg("invalid compressed data--unexpected end of file");
+	else
+		error_msg("invalid compressed data--format violated");
+
+	return 1;
+}
+
+void gunzip_free(gunzip_t *gz)
+{
+	inflate_free_codes(gz);
+	free(gz->window);
+	free(gz);
+}
+
+/* ===========================================================================
+ * Read the gzip header from in and get ready to inflate the data after it.
+ * Returns NULL if in does not hold gzip data.
+ */
+gunzip_t *gunzip_new(FILE *in)
+{
+	gunzip_t *gz;
+
+	gz = xcalloc(1, sizeof(*gz));
+	gz->in_file = in;
+
+	if (gunzip_header(gz)) {
+		gunzip_free(gz);
+		return NULL;
+	}
+
+	return gz;
+}
+
+/*
+ * Points *buf to the next piece of inflated data and returns its size. 0
+ * means the end of the stream, once the trailer has been checked, -1 an
+ * error.
+ */
+int gunzip_read_window(gunzip_t *gz, unsigned char **buf)
+{
+	int res;
+
+	res = inflate_get_next_window(gz);
+	if (res > 0) {
+		*buf = gz->window;
+		return res;
+	}
+
+	if (res < 0) {
+		gunzip_error(res);
+		return -1;
+	}
+
+	return gunzip_trailer(gz) ? -1 : 0;
+}
+
+/* ===========================================================================
+ * Unzip in to out.  This routine works on both gzip and pkzip files.
+ *
+ * in, out: input and output file descriptors
+ */
+extern int unzip(FILE *l_in_file, FILE *l_out_file)
+{
+	gunzip_t *gz;
+	int exit_code=0;	/* program exit code */
+	int res;
+
+	gz = gunzip_new(l_in_file);
+	if (gz == NULL)
+		return 1;
+	gz->out_file = l_out_file;
+
+	/* Decompress */
+	while ((res = inflate_get_next_window(gz)) > 0) {
+		if (flush_window(gz)) {
+			gunzip_free(gz);
+			return 1;
+		}
 	}
 
-	free(window);
-	free(crc_table);
+	if (res < 0)
+		exit_code = gunzip_error(res);
+	else
+		exit_code = gunzip_trailer(gz);
 
-	window = NULL;
-	crc_table = NULL;
+	gunzip_free(gz);
 
 	return exit_code;
 }
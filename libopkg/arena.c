@@ -0,0 +1,128 @@
+/* arena.c - the opkg package management system
+
+   Javier Palacios
+
+   Copyright (C) 2010 Javier Palacios
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "arena.h"
+#include "libbb/libbb.h"
+
+#define ARENA_CHUNK_SIZE	(256 * 1024)
+#define ARENA_ALIGN		(sizeof(void *) > sizeof(long long) ? \
+					sizeof(void *) : sizeof(long long))
+
+struct arena_chunk {
+     arena_chunk_t *next;
+     size_t size;
+     size_t used;
+     /* keep data suitably aligned for any object */
+     long long data[];
+};
+
+void
+arena_init(arena_t *arena)
+{
+     memset(arena, 0, sizeof(arena_t));
+}
+
+void
+arena_deinit(arena_t *arena)
+{
+     arena_chunk_t *c, *next;
+
+     for (c = arena->chunks; c; c = next) {
+	  next = c->next;
+	  free(c);
+     }
+
+     memset(arena, 0, sizeof(arena_t));
+}
+
+void
+arena_print_stats(arena_t *arena)
+{
+     int n_chunks = 0;
+     arena_chunk_t *c;
+
+     for (c = arena->chunks; c; c = c->next)
+	  n_chunks++;
+
+     printf("arena: %lu bytes in use, %lu bytes allocated in %d chunks\n",
+		     (unsigned long)arena->bytes_used,
+		     (unsigned long)arena->bytes_allocated, n_chunks);
+}
+
+void *
+arena_alloc(arena_t *arena, size_t size)
+{
+     arena_chunk_t *c = arena->chunks;
+     void *p;
+
+     size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+     if (c == NULL || c->size - c->used < size) {
+	  size_t chunk_size = ARENA_CHUNK_SIZE;
+
+	  /* oversized requests get a chunk of their own */
+	  if (size > chunk_size)
+	       chunk_size = size;
+
+	  c = xcalloc(1, sizeof(arena_chunk_t) + chunk_size);
+	  c->size = chunk_size;
+	  c->used = 0;
+
+	  if (arena->chunks && size == chunk_size) {
+	       /* keep filling the current chunk */
+	       c->next = arena->chunks->next;
+	       arena->chunks->next = c;
+	  } else {
+	       c->next = arena->chunks;
+	       arena->chunks = c;
+	  }
+	  arena->bytes_allocated += chunk_size;
+     }
+
+     p = (char *)c->data + c->used;
+     c->used += size;
+     arena->bytes_used += size;
+
+     return p;
+}
+
+char *
+arena_strndup(arena_t *arena, const char *str, size_t len)
+{
+     char *s;
+
+     if (str == NULL)
+	  return NULL;
+
+     s = arena_alloc(arena, len + 1);
+     memcpy(s, str, len);
+     s[len] = '\0';
+
+     return s;
+}
+
+char *
+arena_strdup(arena_t *arena, const char *str)
+{
+     if (str == NULL)
+	  return NULL;
+
+     return arena_strndup(arena, str, strlen(str));
+}
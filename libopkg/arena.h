@@ -0,0 +1,45 @@
+/* arena.h - the opkg package management system
+
+   Javier Palacios
+
+   Copyright (C) 2010 Javier Palacios
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/* Bump allocator for objects that live as long as the package
+ * database. Nothing is freed individually, the whole arena goes away
+ * in arena_deinit(). */
+
+typedef struct arena_chunk arena_chunk_t;
+typedef struct arena arena_t;
+
+struct arena {
+     arena_chunk_t *chunks;
+     size_t bytes_used;
+     size_t bytes_allocated;
+};
+
+void arena_init(arena_t *arena);
+void arena_deinit(arena_t *arena);
+void arena_print_stats(arena_t *arena);
+
+/* returned memory is zeroed */
+void *arena_alloc(arena_t *arena, size_t size);
+char *arena_strdup(arena_t *arena, const char *str);
+char *arena_strndup(arena_t *arena, const char *str, size_t len);
+
+#endif
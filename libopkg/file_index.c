@@ -0,0 +1,575 @@
+/* file_index.c - the opkg package management system
+
+   Javier Palacios
+
+   Copyright (C) 2010 Javier Palacios
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "pkg.h"
+#include "pkg_hash.h"
+#include "file_index.h"
+#include "ptr_map.h"
+#include "opkg_message.h"
+#include "sprintf_alloc.h"
+#include "libbb/libbb.h"
+
+/*
+ * Layout of an index file:
+ *
+ *   header | file_off[n_files] | file_pkg[n_files] | pkg_off[n_pkgs] | strings
+ *
+ * Paths are sorted with strcmp() so a lookup is a binary search over
+ * file_off. file_pkg holds the package number owning each path, and
+ * pkg_off the name of each package. Offsets point into the strings area,
+ * which starts and ends with a NUL. Everything is in host byte order.
+ */
+
+#define FILE_INDEX_MAGIC "OPKGFIX"
+
+struct file_index_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t n_files;
+	uint32_t n_pkgs;
+	uint32_t pad;
+	uint64_t status_size;
+	int64_t status_mtime;
+	int64_t status_mtime_nsec;
+	uint64_t data_len;
+};
+
+struct file_index {
+	pkg_dest_t *dest;
+	void *map;
+	size_t map_len;
+	uint32_t n_files;
+	uint32_t n_pkgs;
+	const uint32_t *file_off;
+	const uint32_t *file_pkg;
+	const uint32_t *pkg_off;
+	const char *strings;
+	uint64_t strings_len;
+	pkg_t **owners;		/* installed package of each name at load */
+	char *pkg_loaded;	/* files already merged into file_hash */
+	uint32_t *pkg_first;	/* files of package i are by_pkg[pkg_first[i]] */
+	uint32_t *by_pkg;	/* up to by_pkg[pkg_first[i + 1]] */
+};
+
+static struct file_index *indexes;
+static int n_indexes;
+
+/* Set once the owner of every installed file is known, either from the
+ * indexes or from reading all the .list files. */
+static int owners_known;
+
+static const char *
+index_str(struct file_index *idx, uint32_t off)
+{
+	if (off >= idx->strings_len)
+		return NULL;
+	return idx->strings + off;
+}
+
+static int
+file_index_load_dest(pkg_dest_t *dest, struct file_index *idx)
+{
+	struct file_index_header hdr;
+	struct stat st, status_st;
+	char *index_file;
+	const char *name;
+	uint64_t tables;
+	uint32_t i;
+	int fd;
+
+	if (stat(dest->status_file_name, &status_st) == -1)
+		return 1;
+
+	sprintf_alloc(&index_file, "%s/%s", dest->info_dir, FILE_INDEX_NAME);
+
+	fd = open(index_file, O_RDONLY);
+	if (fd == -1) {
+		free(index_file);
+		return 1;
+	}
+
+	if (fstat(fd, &st) == -1 || st.st_size < sizeof(hdr)
+			|| read(fd, &hdr, sizeof(hdr)) != sizeof(hdr)
+			|| memcmp(hdr.magic, FILE_INDEX_MAGIC,
+				sizeof(FILE_INDEX_MAGIC))
+			|| hdr.version != FILE_INDEX_VERSION
+			|| hdr.data_len != st.st_size - sizeof(hdr)
+			|| hdr.status_size != status_st.st_size
+			|| hdr.status_mtime != status_st.st_mtim.tv_sec
+			|| hdr.status_mtime_nsec != status_st.st_mtim.tv_nsec) {
+		opkg_msg(DEBUG, "Ignoring stale file index %s.\n", index_file);
+		close(fd);
+		free(index_file);
+		return 1;
+	}
+
+	tables = sizeof(uint32_t) * (2 * (uint64_t)hdr.n_files + hdr.n_pkgs);
+	if (tables >= hdr.data_len) {
+		opkg_msg(ERROR, "Corrupted file index %s.\n", index_file);
+		close(fd);
+		free(index_file);
+		return 1;
+	}
+
+	idx->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (idx->map == MAP_FAILED) {
+		opkg_perror(ERROR, "Failed to mmap %s", index_file);
+		idx->map = NULL;
+		free(index_file);
+		return 1;
+	}
+
+	idx->dest = dest;
+	idx->map_len = st.st_size;
+	idx->n_files = hdr.n_files;
+	idx->n_pkgs = hdr.n_pkgs;
+	idx->file_off = (const uint32_t *)((char *)idx->map + sizeof(hdr));
+	idx->file_pkg = idx->file_off + hdr.n_files;
+	idx->pkg_off = idx->file_pkg + hdr.n_files;
+	idx->strings = (const char *)(idx->pkg_off + hdr.n_pkgs);
+	idx->strings_len = hdr.data_len - tables;
+
+	if (idx->strings[idx->strings_len - 1] != '\0') {
+		opkg_msg(ERROR, "Corrupted file index %s.\n", index_file);
+		free(index_file);
+		return 1;
+	}
+
+	idx->owners = xcalloc(idx->n_pkgs ? idx->n_pkgs : 1, sizeof(pkg_t *));
+	idx->pkg_loaded = xcalloc(idx->n_pkgs ? idx->n_pkgs : 1, 1);
+	for (i = 0; i < idx->n_pkgs; i++) {
+		name = index_str(idx, idx->pkg_off[i]);
+		if (name)
+			idx->owners[i] =
+				pkg_hash_fetch_installed_by_name_dest(name, dest);
+	}
+
+	opkg_msg(DEBUG, "Loaded %u file owners from %s.\n",
+			idx->n_files, index_file);
+	free(index_file);
+
+	return 0;
+}
+
+static void
+file_index_unload(struct file_index *idx)
+{
+	if (idx->map)
+		munmap(idx->map, idx->map_len);
+	free(idx->owners);
+	free(idx->pkg_loaded);
+	free(idx->pkg_first);
+	free(idx->by_pkg);
+	memset(idx, 0, sizeof(*idx));
+}
+
+void
+file_index_deinit(void)
+{
+	int i;
+
+	for (i = 0; i < n_indexes; i++)
+		file_index_unload(&indexes[i]);
+	free(indexes);
+	indexes = NULL;
+	n_indexes = 0;
+}
+
+int
+file_index_load(void)
+{
+	pkg_dest_list_elt_t *iter;
+	int n = 0;
+
+	if (indexes)
+		return 0;
+
+	list_for_each_entry(iter, &conf->pkg_dest_list.head, node)
+		n++;
+	if (n == 0)
+		return 1;
+
+	indexes = xcalloc(n, sizeof(*indexes));
+	list_for_each_entry(iter, &conf->pkg_dest_list.head, node) {
+		if (file_index_load_dest((pkg_dest_t *)iter->data,
+					&indexes[n_indexes])) {
+			file_index_unload(&indexes[n_indexes]);
+			file_index_deinit();
+			return 1;
+		}
+		n_indexes++;
+	}
+
+	owners_known = 1;
+
+	return 0;
+}
+
+void
+file_index_scanned(void)
+{
+	owners_known = 1;
+}
+
+static int
+file_index_find(struct file_index *idx, const char *file_name, uint32_t *pos)
+{
+	uint32_t lo = 0, hi = idx->n_files, mid;
+	const char *s;
+	int cmp;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		s = index_str(idx, idx->file_off[mid]);
+		if (s == NULL)
+			return -1;
+		cmp = strcmp(file_name, s);
+		if (cmp == 0) {
+			*pos = mid;
+			return 0;
+		}
+		if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return -1;
+}
+
+pkg_t *
+file_index_get_owner(const char *file_name)
+{
+	struct file_index *idx;
+	uint32_t pos, id;
+	int i;
+
+	for (i = 0; i < n_indexes; i++) {
+		idx = &indexes[i];
+		if (file_index_find(idx, file_name, &pos))
+			continue;
+		id = idx->file_pkg[pos];
+		if (id < idx->n_pkgs && idx->owners[id])
+			return idx->owners[id];
+	}
+
+	return NULL;
+}
+
+/* Group the files by package, once, so that loading a package only
+ * touches its own entries. */
+static void
+file_index_group_by_pkg(struct file_index *idx)
+{
+	uint32_t pos, id;
+
+	idx->pkg_first = xcalloc(idx->n_pkgs + 1, sizeof(uint32_t));
+	idx->by_pkg = xcalloc(idx->n_files ? idx->n_files : 1,
+			sizeof(uint32_t));
+
+	for (pos = 0; pos < idx->n_files; pos++)
+		if (idx->file_pkg[pos] < idx->n_pkgs)
+			idx->pkg_first[idx->file_pkg[pos] + 1]++;
+	for (id = 0; id < idx->n_pkgs; id++)
+		idx->pkg_first[id + 1] += idx->pkg_first[id];
+	for (pos = 0; pos < idx->n_files; pos++) {
+		id = idx->file_pkg[pos];
+		if (id < idx->n_pkgs)
+			idx->by_pkg[idx->pkg_first[id]++] = pos;
+	}
+	/* pkg_first[id] now holds the end of id, shift it back */
+	for (id = idx->n_pkgs; id > 0; id--)
+		idx->pkg_first[id] = idx->pkg_first[id - 1];
+	idx->pkg_first[0] = 0;
+}
+
+void
+file_index_load_pkg(pkg_t *pkg)
+{
+	struct file_index *idx;
+	const char *s;
+	uint32_t id, j;
+	int i;
+
+	for (i = 0; i < n_indexes; i++) {
+		idx = &indexes[i];
+		if (idx->dest != pkg->dest)
+			continue;
+
+		for (id = 0; id < idx->n_pkgs; id++)
+			if (idx->owners[id] == pkg)
+				break;
+		if (id == idx->n_pkgs || idx->pkg_loaded[id])
+			return;
+		idx->pkg_loaded[id] = 1;
+
+		if (idx->pkg_first == NULL)
+			file_index_group_by_pkg(idx);
+
+		for (j = idx->pkg_first[id]; j < idx->pkg_first[id + 1]; j++) {
+			s = index_str(idx, idx->file_off[idx->by_pkg[j]]);
+			if (s == NULL
+				|| hash_table_get(&conf->file_hash, s))
+				continue;
+			pkg_add_owned_file(pkg, hash_table_insert_key(
+					&conf->file_hash, s, pkg));
+		}
+		return;
+	}
+}
+
+struct file_owner {
+	const char *path;
+	pkg_t *pkg;
+};
+
+struct file_owner_vec {
+	struct file_owner *owners;
+	unsigned int len;
+	unsigned int alloc;
+};
+
+static int
+pkg_is_installed(pkg_t *pkg)
+{
+	return pkg->state_status == SS_INSTALLED
+		|| pkg->state_status == SS_UNPACKED;
+}
+
+static void
+file_owner_vec_add(struct file_owner_vec *vec, const char *path, pkg_t *pkg)
+{
+	if (vec->len == vec->alloc) {
+		vec->alloc = vec->alloc ? 2 * vec->alloc : 1024;
+		vec->owners = xrealloc(vec->owners,
+				vec->alloc * sizeof(*vec->owners));
+	}
+	vec->owners[vec->len].path = path;
+	vec->owners[vec->len].pkg = pkg;
+	vec->len++;
+}
+
+static void
+file_index_collect_helper(const char *key, void *entry, void *data)
+{
+	file_owner_vec_add(data, key, entry);
+}
+
+static int
+file_owner_cmp(const void *a, const void *b)
+{
+	return strcmp(((const struct file_owner *)a)->path,
+			((const struct file_owner *)b)->path);
+}
+
+static void
+file_index_add_owner(struct file_owner_vec *vec, pkg_dest_t *dest,
+		const char *path, pkg_t *pkg)
+{
+	if (pkg && pkg->dest == dest && pkg_is_installed(pkg))
+		file_owner_vec_add(vec, path, pkg);
+}
+
+/*
+ * The index is sorted already and file_hash only holds what changed
+ * since it was loaded, so only the changes are sorted and then merged
+ * with it in one pass. A path in file_hash overrides the indexed one.
+ */
+static void
+file_index_merge(struct file_index *idx, pkg_dest_t *dest,
+		struct file_owner_vec *vec)
+{
+	struct file_owner_vec changes;
+	uint32_t i = 0, j = 0, n_files = idx ? idx->n_files : 0, id;
+	const char *s;
+	int cmp;
+
+	memset(&changes, 0, sizeof(changes));
+	hash_table_foreach(&conf->file_hash, file_index_collect_helper,
+			&changes);
+	qsort(changes.owners, changes.len, sizeof(*changes.owners),
+			file_owner_cmp);
+
+	while (i < n_files || j < changes.len) {
+		s = i < n_files ? index_str(idx, idx->file_off[i]) : NULL;
+		if (i < n_files && s == NULL) {
+			i++;
+			continue;
+		}
+		cmp = j == changes.len ? 1 : s == NULL ? -1
+			: strcmp(changes.owners[j].path, s);
+		if (cmp <= 0) {
+			file_index_add_owner(vec, dest, changes.owners[j].path,
+					changes.owners[j].pkg);
+			j++;
+			if (cmp == 0)
+				i++;
+		} else {
+			id = idx->file_pkg[i];
+			if (id < idx->n_pkgs)
+				file_index_add_owner(vec, dest, s,
+						idx->owners[id]);
+			i++;
+		}
+	}
+
+	free(changes.owners);
+}
+
+static int
+file_index_write_dest(pkg_dest_t *dest)
+{
+	struct file_index_header hdr;
+	struct file_owner_vec vec;
+	struct file_index *idx = NULL;
+	struct stat status_st;
+	ptr_map_t ids;
+	const char **names;
+	uint32_t *file_off, *file_pkg, *pkg_off;
+	uint64_t off;
+	uint32_t i, id;
+	char *index_file, *tmp_file;
+	FILE *fp;
+	int err = 0;
+
+	if (stat(dest->status_file_name, &status_st) == -1)
+		return 0;
+
+	for (i = 0; i < n_indexes; i++)
+		if (indexes[i].dest == dest)
+			idx = &indexes[i];
+
+	memset(&vec, 0, sizeof(vec));
+	file_index_merge(idx, dest, &vec);
+
+	file_off = xcalloc(vec.len + 1, sizeof(uint32_t));
+	file_pkg = xcalloc(vec.len + 1, sizeof(uint32_t));
+	pkg_off = xcalloc(vec.len + 1, sizeof(uint32_t));
+	names = xcalloc(vec.len + 1, sizeof(char *));
+
+	memset(&hdr, 0, sizeof(hdr));
+	ptr_map_init(&ids, 256);
+
+	off = 1;
+	for (i = 0; i < vec.len; i++) {
+		id = (uintptr_t)ptr_map_get(&ids, vec.owners[i].pkg);
+		if (id == 0) {
+			names[hdr.n_pkgs] = vec.owners[i].pkg->name;
+			id = ++hdr.n_pkgs;
+			ptr_map_insert(&ids, vec.owners[i].pkg,
+					(void *)(uintptr_t)id);
+		}
+		file_pkg[i] = id - 1;
+		file_off[i] = off;
+		off += strlen(vec.owners[i].path) + 1;
+	}
+	for (i = 0; i < hdr.n_pkgs; i++) {
+		pkg_off[i] = off;
+		off += strlen(names[i]) + 1;
+	}
+	ptr_map_deinit(&ids);
+
+	memcpy(hdr.magic, FILE_INDEX_MAGIC, sizeof(FILE_INDEX_MAGIC));
+	hdr.version = FILE_INDEX_VERSION;
+	hdr.n_files = vec.len;
+	hdr.status_size = status_st.st_size;
+	hdr.status_mtime = status_st.st_mtim.tv_sec;
+	hdr.status_mtime_nsec = status_st.st_mtim.tv_nsec;
+	hdr.data_len = sizeof(uint32_t) * (2 * (uint64_t)hdr.n_files
+			+ hdr.n_pkgs) + off;
+
+	sprintf_alloc(&index_file, "%s/%s", dest->info_dir, FILE_INDEX_NAME);
+	sprintf_alloc(&tmp_file, "%s.tmp", index_file);
+
+	if (off > UINT32_MAX) {
+		opkg_msg(NOTICE, "Too many files for %s.\n", index_file);
+		unlink(index_file);
+		goto cleanup;
+	}
+
+	fp = fopen(tmp_file, "w");
+	if (fp == NULL) {
+		if (errno != EROFS) {
+			opkg_perror(ERROR, "Failed to open %s", tmp_file);
+			err = -1;
+		}
+		goto cleanup;
+	}
+
+	err |= fwrite(&hdr, sizeof(hdr), 1, fp) != 1;
+	err |= fwrite(file_off, sizeof(uint32_t), vec.len, fp) != vec.len;
+	err |= fwrite(file_pkg, sizeof(uint32_t), vec.len, fp) != vec.len;
+	err |= fwrite(pkg_off, sizeof(uint32_t), hdr.n_pkgs, fp) != hdr.n_pkgs;
+	err |= fputc('\0', fp) == EOF;
+	for (i = 0; i < vec.len; i++)
+		err |= fputs(vec.owners[i].path, fp) == EOF
+			|| fputc('\0', fp) == EOF;
+	for (i = 0; i < hdr.n_pkgs; i++)
+		err |= fputs(names[i], fp) == EOF || fputc('\0', fp) == EOF;
+	err |= fclose(fp) != 0;
+
+	if (err) {
+		opkg_msg(ERROR, "Failed to write file index %s.\n", index_file);
+		unlink(tmp_file);
+		err = -1;
+	} else if (rename(tmp_file, index_file) == -1) {
+		opkg_perror(ERROR, "Failed to rename %s to %s",
+				tmp_file, index_file);
+		unlink(tmp_file);
+		err = -1;
+	} else
+		opkg_msg(DEBUG, "Wrote %u file owners to %s.\n",
+				hdr.n_files, index_file);
+
+cleanup:
+	free(tmp_file);
+	free(index_file);
+	free(names);
+	free(pkg_off);
+	free(file_pkg);
+	free(file_off);
+	free(vec.owners);
+
+	return err;
+}
+
+int
+file_index_write(void)
+{
+	pkg_dest_list_elt_t *iter;
+	int ret = 0;
+
+	if (!owners_known || conf->noaction)
+		return 0;
+
+	list_for_each_entry(iter, &conf->pkg_dest_list.head, node)
+		if (file_index_write_dest((pkg_dest_t *)iter->data))
+			ret = -1;
+
+	return ret;
+}
@@ -0,0 +1,48 @@
+/* file_index.h - the opkg package management system
+
+   Javier Palacios
+
+   Copyright (C) 2010 Javier Palacios
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#ifndef FILE_INDEX_H
+#define FILE_INDEX_H
+
+#include "pkg.h"
+
+/* Persistent file ownership index, stored as <info_dir>/.files.idx and
+ * tied to the size and mtime of the dest's status file. It spares reading
+ * every <pkg>.list file to find out who owns an installed file. */
+
+#define FILE_INDEX_NAME		".files.idx"
+#define FILE_INDEX_VERSION	1
+
+/* Returns 0 when every dest had a valid index, 1 when the .list files
+ * have to be scanned instead. */
+int file_index_load(void);
+
+/* Tell the index that file_hash was filled from a full scan. */
+void file_index_scanned(void);
+
+/* Owner of a file that is not in file_hash, as of when the index was
+ * loaded. */
+pkg_t *file_index_get_owner(const char *file_name);
+
+/* Bring the indexed files of pkg into file_hash, so that walking
+ * file_hash yields all of them. */
+void file_index_load_pkg(pkg_t *pkg);
+
+int file_index_write(void);
+void file_index_deinit(void);
+
+#endif
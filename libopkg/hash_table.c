@@ -33,10 +33,77 @@ djb2_hash(const unsigned char *str)
 	return hash;
 }
 
-static int
-hash_index(hash_table_t *hash, const char *key)
+/* Mix the high bits down, the table index only uses the low ones and
+ * linear probing suffers badly from clustered djb2 values. */
+static unsigned long
+hash_key(const char *key)
+{
+	unsigned long hash = djb2_hash((const unsigned char *)key);
+	hash ^= hash >> 16;
+	hash *= 0x45d9f3bUL;
+	hash ^= hash >> 16;
+	return hash;
+}
+
+static unsigned int
+round_up_pow2(unsigned int n)
+{
+	unsigned int size = 16;
+	while (size < n)
+		size <<= 1;
+	return size;
+}
+
+/*
+ * Returns the slot holding key, or the empty slot where it would go.
+ */
+static hash_entry_t *
+hash_lookup(hash_table_t *hash, const char *key, unsigned long h)
 {
-	return djb2_hash((const unsigned char *)key) % hash->n_buckets;
+	unsigned int mask = hash->n_buckets - 1;
+	unsigned int i = h & mask;
+	hash_entry_t *hash_entry;
+
+	while (1) {
+		hash_entry = hash->entries + i;
+		if (hash_entry->key == NULL)
+			return hash_entry;
+		if (hash_entry->hash == h && strcmp(hash_entry->key, key) == 0)
+			return hash_entry;
+		i = (i + 1) & mask;
+	}
+}
+
+static void
+hash_table_resize(hash_table_t *hash, unsigned int n_buckets)
+{
+	hash_entry_t *old = hash->entries;
+	unsigned int i, j, probe, old_n = hash->n_buckets;
+
+	hash->entries = xcalloc(n_buckets, sizeof(hash_entry_t));
+	hash->n_buckets = n_buckets;
+	hash->n_resizes++;
+	hash->n_collisions = 0;
+	hash->max_probe_len = 0;
+
+	for (i = 0; i < old_n; i++) {
+		if (old[i].key == NULL)
+			continue;
+		j = old[i].hash & (n_buckets - 1);
+		probe = 0;
+		while (hash->entries[j].key) {
+			j = (j + 1) & (n_buckets - 1);
+			probe++;
+		}
+		if (probe) {
+			hash->n_collisions++;
+			if (probe > hash->max_probe_len)
+				hash->max_probe_len = probe;
+		}
+		hash->entries[j] = old[i];
+	}
+
+	free(old);
 }
 
 /*
@@ -53,7 +120,7 @@ hash_table_init(const char *name, hash_table_t *hash, int len)
 	memset(hash, 0, sizeof(hash_table_t));
 
 	hash->name = name;
-	hash->n_buckets = len;
+	hash->n_buckets = round_up_pow2(len);
 	hash->entries = xcalloc(hash->n_buckets, sizeof(hash_entry_t));
 }
 
@@ -61,18 +128,18 @@ void
 hash_print_stats(hash_table_t *hash)
 {
 	printf("hash_table: %s, %d bytes\n"
-		"\tn_buckets=%d, n_elements=%d, n_collisions=%d\n"
-		"\tmax_bucket_len=%d, n_used_buckets=%d, ave_bucket_len=%.2f\n"
+		"\tn_buckets=%d, n_elements=%d, load=%.2f, n_resizes=%d\n"
+		"\tn_collisions=%d, max_probe_len=%d\n"
 		"\tn_hits=%d, n_misses=%d\n",
 		hash->name,
 		hash->n_buckets*(int)sizeof(hash_entry_t),
 		hash->n_buckets,
 		hash->n_elements,
+		(hash->n_buckets ?
+			((float)hash->n_elements)/hash->n_buckets : 0.0f),
+		hash->n_resizes,
 		hash->n_collisions,
-		hash->max_bucket_len,
-		hash->n_used_buckets,
-		(hash->n_used_buckets ?
-			((float)hash->n_elements)/hash->n_used_buckets : 0.0f),
+		hash->max_probe_len,
 		hash->n_hits,
 		hash->n_misses);
 }
@@ -84,119 +151,98 @@ void hash_table_deinit(hash_table_t *hash)
         return;
 
     /* free the reminaing entries */
-    for (i = 0; i < hash->n_buckets; i++) {
-	hash_entry_t *hash_entry = (hash->entries + i);
-	free (hash_entry->key);
-	/* skip the first entry as this is part of the array */
-	hash_entry = hash_entry->next;
-        while (hash_entry)
-	{
-	  hash_entry_t *old = hash_entry;
-	  hash_entry = hash_entry->next;
-	  free (old->key);
-	  free (old);
-	}
-    }
+    for (i = 0; i < hash->n_buckets; i++)
+	free (hash->entries[i].key);
 
     free (hash->entries);
 
     hash->entries = NULL;
     hash->n_buckets = 0;
+    hash->n_elements = 0;
 }
 
 void *hash_table_get(hash_table_t *hash, const char *key)
 {
-  int ndx= hash_index(hash, key);
-  hash_entry_t *hash_entry = hash->entries + ndx;
-  while (hash_entry) 
-  {
-    if (hash_entry->key) 
-    {
-      if (strcmp(key, hash_entry->key) == 0) {
-	 hash->n_hits++;
-	 return hash_entry->data;
-      }
-    }
-    hash_entry = hash_entry->next;
+  hash_entry_t *hash_entry = hash_lookup(hash, key, hash_key(key));
+  if (hash_entry->key) {
+     hash->n_hits++;
+     return hash_entry->data;
   }
   hash->n_misses++;
   return NULL;
 }
 
-int hash_table_insert(hash_table_t *hash, const char *key, void *value)
+const char *hash_table_insert_key(hash_table_t *hash, const char *key, void *value)
 {
-     int bucket_len = 0;
-     int ndx= hash_index(hash, key);
-     hash_entry_t *hash_entry = hash->entries + ndx;
+     unsigned long h = hash_key(key);
+     hash_entry_t *hash_entry = hash_lookup(hash, key, h);
+     unsigned int probe;
+
      if (hash_entry->key) {
-	  if (strcmp(hash_entry->key, key) == 0) {
-	       /* alread in table, update the value */
-	       hash_entry->data = value;
-	       return 0;
-	  } else {
-	       /* 
-		* if this is a collision, we have to go to the end of the ll,
-		* then add a new entry
-		* before we can hook up the value
-		*/
-	       while (hash_entry->next) {
-		    hash_entry = hash_entry->next;
-                    if (strcmp(hash_entry->key, key) == 0) {
-                        hash_entry->data = value;
-                        return 0;
-                    }
-		    bucket_len++;
-               }
-	       hash_entry->next = xcalloc(1, sizeof(hash_entry_t));
-	       hash_entry = hash_entry->next;
-	       hash_entry->next = NULL;
-
-	       hash->n_collisions++;
-	       if (++bucket_len > hash->max_bucket_len)
-		    hash->max_bucket_len = bucket_len;
-	  }
-     } else
-	  hash->n_used_buckets++;
+	  /* alread in table, update the value */
+	  hash_entry->data = value;
+	  return hash_entry->key;
+     }
+
+     /* keep the load factor below 3/4 */
+     if ((hash->n_elements + 1) * 4 > hash->n_buckets * 3) {
+	  hash_table_resize(hash, hash->n_buckets * 2);
+	  hash_entry = hash_lookup(hash, key, h);
+     }
+
+     probe = (hash_entry - hash->entries - (h & (hash->n_buckets - 1)))
+	     & (hash->n_buckets - 1);
+     if (probe) {
+	  hash->n_collisions++;
+	  if (probe > hash->max_probe_len)
+	       hash->max_probe_len = probe;
+     }
 
      hash->n_elements++;
      hash_entry->key = xstrdup(key);
      hash_entry->data = value;
+     hash_entry->hash = h;
 
+     return hash_entry->key;
+}
+
+int hash_table_insert(hash_table_t *hash, const char *key, void *value)
+{
+     hash_table_insert_key(hash, key, value);
      return 0;
 }
 
 int hash_table_remove(hash_table_t *hash, const char *key)
 {
-    int ndx= hash_index(hash, key);
-    hash_entry_t *hash_entry = hash->entries + ndx;
-    hash_entry_t *next_entry=NULL, *last_entry=NULL;
-    while (hash_entry) 
-    {
-        if (hash_entry->key) 
-        {
-            if (strcmp(key, hash_entry->key) == 0) {
-                free(hash_entry->key);
-                if (last_entry) {
-                    last_entry->next = hash_entry->next;
-                    free(hash_entry);
-                } else {
-                    next_entry = hash_entry->next;
-                    if (next_entry) {
-                        memmove(hash_entry, next_entry, sizeof(hash_entry_t));
-                        free(next_entry);
-                    } else {
-                        memset(hash_entry, 0 , sizeof(hash_entry_t));
-                    }
-                }
-                return 1;
-            }
-        }
-        last_entry = hash_entry;
-        hash_entry = hash_entry->next;
+    unsigned int mask = hash->n_buckets - 1;
+    unsigned int i, j, k;
+    hash_entry_t *hash_entry = hash_lookup(hash, key, hash_key(key));
+
+    if (hash_entry->key == NULL)
+	return 0;
+
+    free(hash_entry->key);
+    hash->n_elements--;
+
+    /* Shift later members of the probe sequence back, so that lookups
+     * never need tombstones. */
+    i = j = hash_entry - hash->entries;
+    while (1) {
+	j = (j + 1) & mask;
+	if (hash->entries[j].key == NULL)
+	    break;
+	k = hash->entries[j].hash & mask;
+	if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+	    continue;
+	hash->entries[i] = hash->entries[j];
+	i = j;
     }
-    return 0;
+    memset(hash->entries + i, 0, sizeof(hash_entry_t));
+
+    return 1;
 }
 
+/* f must not insert into or remove from the table being walked. */
 void hash_table_foreach(hash_table_t *hash, void (*f)(const char *key, void *entry, void *data), void *data)
 { 
     int i;
@@ -205,11 +251,7 @@ void hash_table_foreach(hash_table_t *hash, void (*f)(const char *key, void *ent
 
     for (i = 0; i < hash->n_buckets; i++) {
 	hash_entry_t *hash_entry = (hash->entries + i);
-	do {
-	    if(hash_entry->key) {
-		f(hash_entry->key, hash_entry->data, data);
-	    }
-	} while((hash_entry = hash_entry->next));
+	if(hash_entry->key)
+	    f(hash_entry->key, hash_entry->data, data);
     }
 }
-
@@ -21,10 +21,15 @@
 typedef struct hash_entry hash_entry_t;
 typedef struct hash_table hash_table_t;
 
+/*
+ * Open addressing with linear probing. Every slot caches the full hash
+ * of its key, so most mismatches are rejected without a strcmp, and the
+ * table doubles when it gets more than 3/4 full.
+ */
 struct hash_entry {
   char * key;
   void * data;
-  struct hash_entry * next;
+  unsigned long hash;
 };
 
 struct hash_table {
@@ -34,9 +39,9 @@ struct hash_table {
   unsigned int n_elements;
 
   /* useful stats */
-  unsigned int n_used_buckets;
+  unsigned int n_resizes;
   unsigned int n_collisions;
-  unsigned int max_bucket_len;
+  unsigned int max_probe_len;
   unsigned int n_hits, n_misses;
 };
 
@@ -45,6 +50,9 @@ void hash_table_deinit(hash_table_t *hash);
 void hash_print_stats(hash_table_t *hash);
 void *hash_table_get(hash_table_t *hash, const char *key);
 int hash_table_insert(hash_table_t *hash, const char *key, void *value);
+/* Like hash_table_insert(), but returns the copy of key kept in the
+ * table. It stays valid until the key is removed. */
+const char *hash_table_insert_key(hash_table_t *hash, const char *key, void *value);
 int hash_table_remove(hash_table_t *has, const char *key);
 void hash_table_foreach(hash_table_t *hash, void (*f)(const char *key, void *entry, void *data), void *data);
 
@@ -0,0 +1,75 @@
+/* id_set.c - the opkg package management system
+
+   Javier Palacios
+
+   Copyright (C) 2010 Javier Palacios
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+
+#include <limits.h>
+#include <string.h>
+
+#include "id_set.h"
+#include "libbb/libbb.h"
+
+#define WORD_BITS (sizeof(unsigned long) * CHAR_BIT)
+
+void
+id_set_init(id_set_t *set)
+{
+     set->bits = NULL;
+     set->n_words = 0;
+}
+
+void
+id_set_deinit(id_set_t *set)
+{
+     free(set->bits);
+     set->bits = NULL;
+     set->n_words = 0;
+}
+
+int
+id_set_contains(const id_set_t *set, unsigned int id)
+{
+     unsigned int w = id / WORD_BITS;
+
+     if (w >= set->n_words)
+	  return 0;
+
+     return (set->bits[w] >> (id % WORD_BITS)) & 1;
+}
+
+int
+id_set_insert(id_set_t *set, unsigned int id)
+{
+     unsigned int w = id / WORD_BITS;
+     unsigned long bit = 1UL << (id % WORD_BITS);
+
+     if (w >= set->n_words) {
+	  unsigned int n_words = set->n_words ? set->n_words : 16;
+
+	  while (n_words <= w)
+	       n_words <<= 1;
+	  set->bits = xrealloc(set->bits, n_words * sizeof(unsigned long));
+	  memset(set->bits + set->n_words, 0,
+			  (n_words - set->n_words) * sizeof(unsigned long));
+	  set->n_words = n_words;
+     }
+
+     if (set->bits[w] & bit)
+	  return 0;
+
+     set->bits[w] |= bit;
+     return 1;
+}
@@ -0,0 +1,38 @@
+/* id_set.h - the opkg package management system
+
+   Javier Palacios
+
+   Copyright (C) 2010 Javier Palacios
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#ifndef ID_SET_H
+#define ID_SET_H
+
+/* A set of the dense ids pkg_hash gives to every pkg_t and
+ * abstract_pkg_t, one bit each. It grows to the largest id inserted,
+ * so an empty set costs nothing. */
+
+typedef struct id_set id_set_t;
+
+struct id_set {
+     unsigned long *bits;
+     unsigned int n_words;
+};
+
+void id_set_init(id_set_t *set);
+void id_set_deinit(id_set_t *set);
+int id_set_contains(const id_set_t *set, unsigned int id);
+/* Returns 1 if id was not in the set before. */
+int id_set_insert(id_set_t *set, unsigned int id);
+
+#endif
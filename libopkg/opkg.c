@@ -148,6 +148,9 @@ int
 opkg_re_read_config_files(void)
 {
 	pkg_hash_deinit();
+	/* nothing refers to the old packages any longer */
+	arena_deinit(&conf->pkg_arena);
+	arena_init(&conf->pkg_arena);
 	pkg_hash_init();
 
 	if (pkg_hash_load_feeds())
@@ -588,22 +591,16 @@ opkg_update_package_lists(opkg_progress_callback_t progress_callback,
 
 		src = (pkg_src_t *) iter->data;
 
-		if (src->extra_data)	/* debian style? */
-			sprintf_alloc(&url, "%s/%s/%s", src->value,
-				      src->extra_data,
-				      src->gzip ? "Packages.gz" : "Packages");
-		else
-			sprintf_alloc(&url, "%s/%s", src->value,
-				      src->gzip ? "Packages.gz" : "Packages");
+		url = pkg_src_packages_url(src);
 
 		sprintf_alloc(&list_file_name, "%s/%s", lists_dir, src->name);
-		if (src->gzip) {
+		if (src->compression) {
 			FILE *in, *out;
 			struct _curl_cb_data cb_data;
 			char *tmp_file_name = NULL;
 
-			sprintf_alloc(&tmp_file_name, "%s/%s.gz", tmp,
-				      src->name);
+			sprintf_alloc(&tmp_file_name, "%s/%s.%s", tmp,
+				      src->name, src->compression);
 
 			opkg_msg(INFO, "Downloading %s to %s...\n", url,
 					tmp_file_name);
@@ -626,7 +623,8 @@ opkg_update_package_lists(opkg_progress_callback_t progress_callback,
 				in = fopen(tmp_file_name, "r");
 				out = fopen(list_file_name, "w");
 				if (in && out)
-					unzip(in, out);
+					err = decompress(in, out,
+							tmp_file_name);
 				else
 					err = 1;
 				if (in)
@@ -31,6 +31,7 @@
 #include "pkg.h"
 #include "pkg_dest.h"
 #include "pkg_parse.h"
+#include "pkg_index.h"
 #include "sprintf_alloc.h"
 #include "pkg.h"
 #include "file_util.h"
@@ -42,6 +43,8 @@
 #include "opkg_upgrade.h"
 #include "opkg_remove.h"
 #include "opkg_configure.h"
+#include "opkg_solver.h"
+#include "id_set.h"
 #include "xsystem.h"
 
 static void
@@ -78,6 +81,86 @@ sigint_handler(int sig)
      exit(128 + sig);
 }
 
+/* Per feed state of opkg_update_cmd(), filled in by the download
+ * callbacks. */
+struct update_dist {
+     dist_src_t *dist;
+     char *lists_dir;
+     char *tmp;
+     release_t *release;
+};
+
+struct update_src {
+     pkg_src_t *src;
+     char *list_file_name;
+     char *sig_file_name;
+     int list_err;
+     int sig_err;
+};
+
+static int
+update_release_done(const char *url, const char *list_file_name,
+		int err, void *data)
+{
+     struct update_dist *ud = data;
+
+     if (err)
+	  return err;
+
+     ud->release = release_new();
+     err = release_init_from_file(ud->release, list_file_name);
+     if (!err)
+	  err = release_get_packages(ud->release, ud->dist,
+			  ud->lists_dir, ud->tmp);
+
+     return err;
+}
+
+static int
+update_list_done(const char *url, const char *file_name, int err, void *data)
+{
+     struct update_src *us = data;
+     FILE *in, *out;
+
+     if (err == 0 && us->src->compression) {
+	  opkg_msg(NOTICE, "Inflating %s.\n", url);
+	  in = fopen (file_name, "r");
+	  out = fopen (us->list_file_name, "w");
+	  if (in && out)
+	       err = decompress (in, out, file_name);
+	  else
+	       err = 1;
+	  if (in)
+	       fclose (in);
+	  if (out)
+	       fclose (out);
+	  unlink (file_name);
+     }
+
+     if (err == 0) {
+	  opkg_msg(NOTICE, "Updated list of available packages in %s.\n",
+			  us->list_file_name);
+	  pkg_index_write(us->list_file_name);
+     }
+
+     us->list_err = err;
+     return err;
+}
+
+#if defined(HAVE_GPGME) || defined(HAVE_OPENSSL)
+static int
+update_sig_done(const char *url, const char *file_name, int err, void *data)
+{
+     struct update_src *us = data;
+
+     if (err)
+	  opkg_msg(NOTICE, "Signature check failed.\n");
+
+     us->sig_err = err;
+     return err;
+}
+#endif
+
 static int
 opkg_update_cmd(int argc, char **argv)
 {
@@ -87,6 +170,10 @@ opkg_update_cmd(int argc, char **argv)
      char *lists_dir;
      pkg_src_list_elt_t *iter;
      pkg_src_t *src;
+     dist_src_list_elt_t *distiter;
+     struct update_dist *dists;
+     struct update_src *srcs;
+     int i, n_dists, n_srcs;
 
  
     sprintf_alloc(&lists_dir, "%s", conf->restrict_to_default_dest ? conf->default_dest->lists_dir : conf->lists_dir);
@@ -113,85 +200,60 @@ opkg_update_cmd(int argc, char **argv)
 	 return -1;
      }
 
+     /* Queue everything first, so that the transfers overlap. The
+      * Packages files of a dist are queued once its Release is in. */
+     n_dists = 0;
+     for (distiter = void_list_first(&conf->dist_src_list); distiter; distiter = void_list_next(&conf->dist_src_list, distiter))
+	  n_dists++;
+     dists = xcalloc(n_dists + 1, sizeof(*dists));
 
-     dist_src_list_elt_t *distiter;
-     dist_src_t *dist;
-
+     i = 0;
      for (distiter = void_list_first(&conf->dist_src_list); distiter; distiter = void_list_next(&conf->dist_src_list, distiter)) {
 	  char *url, *list_file_name;
+	  dist_src_t *dist = (dist_src_t *)distiter->data;
+	  struct update_dist *ud = &dists[i++];
 
-	  dist = (dist_src_t *)distiter->data;
+	  ud->dist = dist;
+	  ud->lists_dir = lists_dir;
+	  ud->tmp = tmp;
 
 	  char *location = dist_src_location(dist);
 	  sprintf_alloc(&url, "%s/Release", location);
 	  free(location);
 
 	  sprintf_alloc(&list_file_name, "%s/%s-Release", lists_dir, dist->name);
-	  err = opkg_download(url, list_file_name, NULL, NULL);
-	  if (!err) {
-
-	       release_t *release = release_new(); 
-
-	       err = release_init_from_file(release, list_file_name);
-	       if (!err) {
-		    err = release_get_packages(release, dist, lists_dir, tmp);
-	       }
-
-	  }
-
-	  if (err) {
-	       failures++;
-	  } else {
-	       opkg_msg(NOTICE, "Downloaded package files for dist %s.\n",
-			    dist->name);
-	  }
+	  opkg_download_queue(url, list_file_name, update_release_done, ud);
 
 	  free(list_file_name);
 	  free(url);
      }
 
+     n_srcs = 0;
+     for (iter = void_list_first(&conf->pkg_src_list); iter; iter = void_list_next(&conf->pkg_src_list, iter))
+	  n_srcs++;
+     srcs = xcalloc(n_srcs + 1, sizeof(*srcs));
 
+     i = 0;
      for (iter = void_list_first(&conf->pkg_src_list); iter; iter = void_list_next(&conf->pkg_src_list, iter)) {
-	  char *url, *list_file_name;
+	  char *url;
+	  struct update_src *us = &srcs[i++];
 
 	  src = (pkg_src_t *)iter->data;
+	  us->src = src;
 
-	  if (src->extra_data)	/* debian style? */
-	      sprintf_alloc(&url, "%s/%s/%s", src->value, src->extra_data, 
-			    src->gzip ? "Packages.gz" : "Packages");
-	  else
-	      sprintf_alloc(&url, "%s/%s", src->value, src->gzip ? "Packages.gz" : "Packages");
+	  url = pkg_src_packages_url(src);
 
-	  sprintf_alloc(&list_file_name, "%s/%s", lists_dir, src->name);
-	  if (src->gzip) {
+	  sprintf_alloc(&us->list_file_name, "%s/%s", lists_dir, src->name);
+	  if (src->compression) {
 	      char *tmp_file_name;
-	      FILE *in, *out;
-	      
-	      sprintf_alloc (&tmp_file_name, "%s/%s.gz", tmp, src->name);
-	      err = opkg_download(url, tmp_file_name, NULL, NULL);
-	      if (err == 0) {
-		   opkg_msg(NOTICE, "Inflating %s.\n", url);
-		   in = fopen (tmp_file_name, "r");
-		   out = fopen (list_file_name, "w");
-		   if (in && out)
-			unzip (in, out);
-		   else
-			err = 1;
-		   if (in)
-			fclose (in);
-		   if (out)
-			fclose (out);
-		   unlink (tmp_file_name);
-	      }
+
+	      sprintf_alloc (&tmp_file_name, "%s/%s.%s", tmp, src->name,
+			      src->compression);
+	      opkg_download_queue(url, tmp_file_name, update_list_done, us);
 	      free(tmp_file_name);
 	  } else
-	      err = opkg_download(url, list_file_name, NULL, NULL);
-	  if (err) {
-	       failures++;
-	  } else {
-	       opkg_msg(NOTICE, "Updated list of available packages in %s.\n",
-			    list_file_name);
-	  }
+	      opkg_download_queue(url, us->list_file_name,
+			      update_list_done, us);
 	  free(url);
 #if defined(HAVE_GPGME) || defined(HAVE_OPENSSL)
           if (conf->check_signature) {
@@ -203,33 +265,47 @@ opkg_update_cmd(int argc, char **argv)
               else
                   sprintf_alloc(&url, "%s/%s", src->value, "Packages.sig");
 
-              /* create temporary file for it */
-              char *tmp_file_name;
-
               /* Put the signature in the right place */
-              sprintf_alloc (&tmp_file_name, "%s/%s.sig", lists_dir, src->name);
-
-              err = opkg_download(url, tmp_file_name, NULL, NULL);
-              if (err) {
-                  failures++;
-                  opkg_msg(NOTICE, "Signature check failed.\n");
-              } else {
-                  err = opkg_verify_file (list_file_name, tmp_file_name);
-                  if (err == 0)
-                      opkg_msg(NOTICE, "Signature check passed.\n");
-                  else
-                      opkg_msg(NOTICE, "Signature check failed.\n");
-              }
-              /* We shouldn't unlink the signature ! */
-              // unlink (tmp_file_name);
-              free (tmp_file_name);
+              sprintf_alloc (&us->sig_file_name, "%s/%s.sig", lists_dir, src->name);
+
+              opkg_download_queue(url, us->sig_file_name,
+			      update_sig_done, us);
               free (url);
           }
 #else
           // Do nothing
 #endif
-	  free(list_file_name);
      }
+
+     failures += opkg_download_wait();
+
+     for (i = 0; i < n_srcs; i++) {
+	  struct update_src *us = &srcs[i];
+
+#if defined(HAVE_GPGME) || defined(HAVE_OPENSSL)
+	  /* a list that failed to download is gone or stale */
+	  if (us->sig_file_name && !us->sig_err && !us->list_err) {
+	       err = opkg_verify_file (us->list_file_name, us->sig_file_name);
+	       if (err == 0)
+		    opkg_msg(NOTICE, "Signature check passed.\n");
+	       else
+		    opkg_msg(NOTICE, "Signature check failed.\n");
+	  }
+	  /* We shouldn't unlink the signature ! */
+#endif
+	  free(us->sig_file_name);
+	  free(us->list_file_name);
+     }
+     free(srcs);
+
+     for (i = 0; i < n_dists; i++) {
+	  if (dists[i].release) {
+	       release_deinit(dists[i].release);
+	       free(dists[i].release);
+	  }
+     }
+     free(dists);
+
      rmdir (tmp);
      free (tmp);
      free(lists_dir);
@@ -312,14 +388,13 @@ opkg_finalize_intercepts(opkg_intercept_t ctx)
 /* For package pkg do the following: If it is already visited, return. If not,
    add it in visited list and recurse to its deps. Finally, add it to ordered 
    list.
-   pkg_vec all contains all available packages in repos.
-   pkg_vec visited contains packages already visited by this function, and is 
-   used to end recursion and avoid an infinite loop on graph cycles.
+   id_set visited contains the abstract packages already visited by this
+   function, and is used to end recursion and avoid an infinite loop on
+   graph cycles.
    pkg_vec ordered will finally contain the ordered set of packages.
 */
 static int
-opkg_recurse_pkgs_in_order(pkg_t *pkg, pkg_vec_t *all,
-                               pkg_vec_t *visited, pkg_vec_t *ordered)
+opkg_recurse_pkgs_in_order(pkg_t *pkg, id_set_t *visited, pkg_vec_t *ordered)
 {
     int j,k,l,m;
     int count;
@@ -340,13 +415,10 @@ opkg_recurse_pkgs_in_order(pkg_t *pkg, pkg_vec_t *all,
         return 0;
 
     /* If the  package has already been visited (by this function), skip it */
-    for(j = 0; j < visited->len; j++) 
-        if ( ! strcmp(visited->pkgs[j]->name, pkg->name)) {
-            opkg_msg(DEBUG, "pkg %s already visited, skipping.\n", pkg->name);
-            return 0;
-        }
-    
-    pkg_vec_insert(visited, pkg);
+    if (!id_set_insert(visited, pkg->parent->id)) {
+        opkg_msg(DEBUG, "pkg %s already visited, skipping.\n", pkg->name);
+        return 0;
+    }
 
     count = pkg->pre_depends_count + pkg->depends_count + \
         pkg->recommends_count + pkg->suggests_count;
@@ -370,13 +442,11 @@ opkg_recurse_pkgs_in_order(pkg_t *pkg, pkg_vec_t *all,
                                  dependents [l]->name);
     
                     /* find whether dependent l is installed or unpacked,
-                     * and then find which package in the list satisfies it */
-                    for(m = 0; m < all->len; m++) {
-                        dep = all->pkgs[m];
-                        if ( dep->state_status != SS_NOT_INSTALLED)
-                            if ( ! strcmp(dep->name, dependents[l]->name)) {
-                                opkg_recurse_pkgs_in_order(dep, all, 
-                                                           visited, ordered);
+                     * and then find which of its packages satisfies it */
+                    for(m = 0; dependents[l]->pkgs && m < dependents[l]->pkgs->len; m++) {
+                        dep = dependents[l]->pkgs->pkgs[m];
+                        if ( dep->state_status != SS_NOT_INSTALLED) {
+                                opkg_recurse_pkgs_in_order(dep, visited, ordered);
                                 /* Stop the outer loop */
                                 l = abpkg->provided_by->len;
                                 /* break from the inner loop */
@@ -400,7 +470,8 @@ opkg_recurse_pkgs_in_order(pkg_t *pkg, pkg_vec_t *all,
 static int
 opkg_configure_packages(char *pkg_name)
 {
-     pkg_vec_t *all, *ordered, *visited;
+     pkg_vec_t *all, *ordered;
+     id_set_t visited;
      int i;
      pkg_t *pkg;
      opkg_intercept_t ic;
@@ -416,11 +487,12 @@ opkg_configure_packages(char *pkg_name)
         order */
      opkg_msg(INFO, "Reordering packages before configuring them...\n");
      ordered = pkg_vec_alloc();
-     visited = pkg_vec_alloc();
+     id_set_init(&visited);
      for(i = 0; i < all->len; i++) {
          pkg = all->pkgs[i];
-         opkg_recurse_pkgs_in_order(pkg, all, visited, ordered);
+         opkg_recurse_pkgs_in_order(pkg, &visited, ordered);
      }
+     id_set_deinit(&visited);
 
      ic = opkg_prep_intercepts();
      if (ic == NULL) {
@@ -456,7 +528,6 @@ opkg_configure_packages(char *pkg_name)
 error:
      pkg_vec_free(all);
      pkg_vec_free(ordered);
-     pkg_vec_free(visited);
 
      return err;
 }
@@ -466,6 +537,7 @@ opkg_install_cmd(int argc, char **argv)
 {
      int i, r;
      char *arg;
+     pkg_t *pkg;
      int err=0;
 
      signal(SIGINT, sigint_handler);
@@ -483,6 +555,16 @@ opkg_install_cmd(int argc, char **argv)
      }
      pkg_info_preinstall_check();
 
+     if (conf->solver && opkg_solver_plan(argc, argv, 0)
+		     && !conf->force_depends)
+	  return -1;
+
+     for (i=0; i < argc; i++) {
+	  pkg = pkg_hash_fetch_best_installation_candidate_by_name(argv[i]);
+	  if (pkg)
+	       opkg_install_prefetch(pkg);
+     }
+
      for (i=0; i < argc; i++) {
 	  arg = argv[i];
           err = opkg_install_by_name(arg);
@@ -491,11 +573,15 @@ opkg_install_cmd(int argc, char **argv)
 	  }
      }
 
+     /* drop what was fetched for nothing, e.g. after an error */
+     opkg_download_cancel();
+
      r = opkg_configure_packages(NULL);
      if (!err)
 	  err = r;
 
      write_status_files_if_changed();
+     opkg_solver_clear();
 
      return err;
 }
@@ -505,6 +591,7 @@ opkg_upgrade_cmd(int argc, char **argv)
 {
      int i, r;
      pkg_t *pkg;
+     pkg_vec_t *pkgs;
      int err;
 
      signal(SIGINT, sigint_handler);
@@ -519,6 +606,23 @@ opkg_upgrade_cmd(int argc, char **argv)
 	  }
 	  pkg_info_preinstall_check();
 
+	  if (conf->solver && opkg_solver_plan(argc, argv, 1)
+			  && !conf->force_depends)
+	       return -1;
+
+	  pkgs = pkg_vec_alloc();
+	  for (i=0; i < argc; i++) {
+	       if (conf->restrict_to_default_dest)
+		    pkg = pkg_hash_fetch_installed_by_name_dest(argv[i],
+							conf->default_dest);
+	       else
+		    pkg = pkg_hash_fetch_installed_by_name(argv[i]);
+	       if (pkg)
+		    pkg_vec_insert(pkgs, pkg);
+	  }
+	  opkg_upgrade_prefetch(pkgs);
+	  pkg_vec_free(pkgs);
+
 	  for (i=0; i < argc; i++) {
 	       char *arg = argv[i];
 	       if (conf->restrict_to_default_dest) {
@@ -543,7 +647,14 @@ opkg_upgrade_cmd(int argc, char **argv)
 
 	  pkg_info_preinstall_check();
 
+	  if (conf->solver && opkg_solver_plan(0, NULL, 1)
+			  && !conf->force_depends) {
+	       pkg_vec_free(installed);
+	       return -1;
+	  }
+
 	  pkg_hash_fetch_all_installed(installed);
+	  opkg_upgrade_prefetch(installed);
 	  for (i = 0; i < installed->len; i++) {
 	       pkg = installed->pkgs[i];
 	       opkg_upgrade_pkg(pkg);
@@ -551,11 +662,14 @@ opkg_upgrade_cmd(int argc, char **argv)
 	  pkg_vec_free(installed);
      }
 
+     opkg_download_cancel();
+
      r = opkg_configure_packages(NULL);
      if (!err)
 	  err = r;
 
      write_status_files_if_changed();
+     opkg_solver_clear();
 
      return 0;
 }
@@ -28,6 +28,7 @@
 #include "opkg_conf.h"
 #include "pkg_vec.h"
 #include "pkg.h"
+#include "file_index.h"
 #include "xregex.h"
 #include "sprintf_alloc.h"
 #include "opkg_message.h"
@@ -46,6 +47,8 @@ opkg_conf_t *conf = &_conf;
  */
 opkg_option_t options[] = {
 	  { "cache", OPKG_OPT_TYPE_STRING, &_conf.cache},
+	  { "cache_mode", OPKG_OPT_TYPE_STRING, &_conf.cache_mode},
+	  { "cache_size", OPKG_OPT_TYPE_INT, &_conf.cache_size},
 	  { "force_defaults", OPKG_OPT_TYPE_BOOL, &_conf.force_defaults },
           { "force_maintainer", OPKG_OPT_TYPE_BOOL, &_conf.force_maintainer }, 
 	  { "force_depends", OPKG_OPT_TYPE_BOOL, &_conf.force_depends },
@@ -60,11 +63,17 @@ opkg_option_t options[] = {
 	  { "test", OPKG_OPT_TYPE_BOOL, &_conf.noaction },
 	  { "noaction", OPKG_OPT_TYPE_BOOL, &_conf.noaction },
 	  { "download_only", OPKG_OPT_TYPE_BOOL, &_conf.download_only },
+	  { "download_jobs", OPKG_OPT_TYPE_INT, &_conf.download_jobs },
+	  { "download_jobs_per_host", OPKG_OPT_TYPE_INT, &_conf.download_jobs_per_host },
+	  { "mmap_lists", OPKG_OPT_TYPE_BOOL, &_conf.mmap_lists },
 	  { "nodeps", OPKG_OPT_TYPE_BOOL, &_conf.nodeps },
 	  { "offline_root", OPKG_OPT_TYPE_STRING, &_conf.offline_root },
 	  { "proxy_passwd", OPKG_OPT_TYPE_STRING, &_conf.proxy_passwd },
 	  { "proxy_user", OPKG_OPT_TYPE_STRING, &_conf.proxy_user },
 	  { "query-all", OPKG_OPT_TYPE_BOOL, &_conf.query_all },
+	  { "solver", OPKG_OPT_TYPE_STRING, &_conf.solver },
+	  { "solver_max_conflicts", OPKG_OPT_TYPE_INT, &_conf.solver_max_conflicts },
+	  { "solver_policy", OPKG_OPT_TYPE_STRING, &_conf.solver_policy },
 	  { "tmp_dir", OPKG_OPT_TYPE_STRING, &_conf.tmp_dir },
 	  { "verbosity", OPKG_OPT_TYPE_INT, &_conf.verbosity },
 #if defined(HAVE_OPENSSL)
@@ -181,6 +190,31 @@ opkg_conf_set_option(const char *name, const char *value)
      return -1;
 }
 
+/*
+ * The list suffix for a src/<suffix> line, or NULL if that is not a
+ * compression format this build can read.
+ */
+static const char *
+src_compression(const char *type)
+{
+     static const char *suffixes[] = { "gz", "xz", "zst", NULL };
+     char *list_name;
+     int i, supported;
+
+     for (i = 0; suffixes[i]; i++) {
+	  if (strcmp(type + 4, suffixes[i]) != 0)
+	       continue;
+
+	  sprintf_alloc(&list_name, "Packages.%s", suffixes[i]);
+	  supported = decompress_supported(list_name);
+	  free(list_name);
+
+	  return supported ? suffixes[i] : NULL;
+     }
+
+     return NULL;
+}
+
 static int
 opkg_conf_parse_file(const char *filename,
 				pkg_src_list_t *pkg_src_list, dist_src_list_t *dist_src_list,
@@ -309,14 +343,19 @@ opkg_conf_parse_file(const char *filename,
  	       }
 	  } else if (strcmp(type, "src") == 0) {
 	       if (!nv_pair_list_find((nv_pair_list_t*) pkg_src_list, name)) {
-		    pkg_src_list_append (pkg_src_list, name, value, extra, 0);
+		    pkg_src_list_append (pkg_src_list, name, value, extra, NULL);
 	       } else {
 		    opkg_msg(ERROR, "Duplicate src declaration (%s %s). "
 				    "Skipping.\n", name, value);
 	       }
-	  } else if (strcmp(type, "src/gz") == 0) {
-	       if (!nv_pair_list_find((nv_pair_list_t*) pkg_src_list, name)) {
-		    pkg_src_list_append (pkg_src_list, name, value, extra, 1);
+	  } else if (strncmp(type, "src/", 4) == 0) {
+	       const char *compression = src_compression(type);
+
+	       if (compression == NULL) {
+		    opkg_msg(ERROR, "%s:%d: Ignoring unsupported src type `%s'.\n",
+				    filename, line_num, type);
+	       } else if (!nv_pair_list_find((nv_pair_list_t*) pkg_src_list, name)) {
+		    pkg_src_list_append (pkg_src_list, name, value, extra, compression);
 	       } else {
 		    opkg_msg(ERROR, "Duplicate src declaration (%s %s). "
 				   "Skipping.\n", name, value);
@@ -524,6 +563,37 @@ opkg_conf_init(void)
 		goto err3;
 	}
 
+	if (!conf->download_jobs)
+		conf->download_jobs = OPKG_CONF_DEFAULT_DOWNLOAD_JOBS;
+	if (!conf->download_jobs_per_host)
+		conf->download_jobs_per_host =
+			OPKG_CONF_DEFAULT_DOWNLOAD_JOBS_PER_HOST;
+
+	if (conf->cache_mode && strcmp(conf->cache_mode, "copy")
+			&& strcmp(conf->cache_mode, "link")
+			&& strcmp(conf->cache_mode, "direct")) {
+		opkg_msg(ERROR, "Ignoring unknown cache_mode %s.\n",
+				conf->cache_mode);
+		free(conf->cache_mode);
+		conf->cache_mode = NULL;
+	}
+
+	if (conf->solver && strcmp(conf->solver, "sat")) {
+		if (strcmp(conf->solver, "internal"))
+			opkg_msg(ERROR, "Ignoring unknown solver %s.\n",
+					conf->solver);
+		free(conf->solver);
+		conf->solver = NULL;
+	}
+
+	if (conf->solver_policy && strcmp(conf->solver_policy, "changes")
+			&& strcmp(conf->solver_policy, "newest")) {
+		opkg_msg(ERROR, "Ignoring unknown solver_policy %s.\n",
+				conf->solver_policy);
+		free(conf->solver_policy);
+		conf->solver_policy = NULL;
+	}
+
 	if (conf->tmp_dir)
 		tmp_dir_base = conf->tmp_dir;
 	else
@@ -540,6 +610,7 @@ opkg_conf_init(void)
 		goto err4;
 	}
 
+	arena_init(&conf->pkg_arena);
 	pkg_hash_init();
 	hash_table_init("file-hash", &conf->file_hash, OPKG_CONF_DEFAULT_HASH_LEN);
 	hash_table_init("obs-file-hash", &conf->obs_file_hash, OPKG_CONF_DEFAULT_HASH_LEN/16);
@@ -579,8 +650,10 @@ err5:
 	free(conf->lists_dir);
 
 	pkg_hash_deinit();
+	file_index_deinit();
 	hash_table_deinit(&conf->file_hash);
 	hash_table_deinit(&conf->obs_file_hash);
+	arena_deinit(&conf->pkg_arena);
 
 	if (rmdir(conf->tmp_dir) == -1)
 		opkg_perror(ERROR, "Couldn't remove dir %s", conf->tmp_dir);
@@ -655,11 +728,14 @@ opkg_conf_deinit(void)
 		hash_print_stats(&conf->pkg_hash);
 		hash_print_stats(&conf->file_hash);
 		hash_print_stats(&conf->obs_file_hash);
+		arena_print_stats(&conf->pkg_arena);
 	}
 
 	pkg_hash_deinit();
+	file_index_deinit();
 	hash_table_deinit(&conf->file_hash);
 	hash_table_deinit(&conf->obs_file_hash);
+	arena_deinit(&conf->pkg_arena);
 
 	if (lockf(lock_fd, F_ULOCK, (off_t)0) == -1)
 		opkg_perror(ERROR, "Couldn't unlock %s", lock_file);
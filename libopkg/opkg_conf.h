@@ -26,6 +26,7 @@ extern opkg_conf_t *conf;
 #include <stdarg.h>
 
 #include "hash_table.h"
+#include "arena.h"
 #include "dist_src_list.h"
 #include "pkg_src_list.h"
 #include "pkg_dest_list.h"
@@ -43,6 +44,9 @@ extern opkg_conf_t *conf;
 
 #define OPKG_CONF_DEFAULT_HASH_LEN 1024
 
+#define OPKG_CONF_DEFAULT_DOWNLOAD_JOBS 4
+#define OPKG_CONF_DEFAULT_DOWNLOAD_JOBS_PER_HOST 2
+
 struct opkg_conf
 {
      pkg_src_list_t pkg_src_list;
@@ -83,6 +87,14 @@ struct opkg_conf
      int noaction;
      int download_only;
      char *cache;
+     char *cache_mode; /* copy, link or direct, see opkg_download_cache_use() */
+     int cache_size; /* in kB, 0 for no limit */
+     int mmap_lists; /* parse lists in place, without copying fields */
+     int download_jobs; /* concurrent transfers, see opkg_download_wait() */
+     int download_jobs_per_host;
+     char *solver; /* NULL for the built-in resolver or sat, see opkg_solver.c */
+     char *solver_policy; /* changes (default) or newest */
+     int solver_max_conflicts; /* 0 for the built-in bound */
 
 #ifdef HAVE_SSLCURL
      /* some options could be used by
@@ -116,6 +128,9 @@ struct opkg_conf
      hash_table_t pkg_hash;
      hash_table_t file_hash;
      hash_table_t obs_file_hash;
+
+     /* pkg_t, abstract_pkg_t and dependency storage */
+     arena_t pkg_arena;
 };
 
 enum opkg_option_type {
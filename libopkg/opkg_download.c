@@ -21,6 +21,13 @@
 
 #include <stdio.h>
 #include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <time.h>
+#include <utime.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <signal.h>
 
 #include "opkg_download.h"
 #include "opkg_message.h"
@@ -70,7 +77,13 @@ static X509_STORE *setup_verify(char *CAfile, char *CApath);
  * each time
  */
 static CURL *curl = NULL;
+/*
+ * Shared by curl and the download queue handles, so that DNS lookups, TLS
+ * sessions and open connections carry over from one transfer to the next.
+ */
+static CURLSH *curl_share = NULL;
 static CURL *opkg_curl_init(curl_progress_func cb, void *data);
+static CURL *opkg_curl_handle_new(void);
 #endif
 
 static int
@@ -79,6 +92,31 @@ str_starts_with(const char *str, const char *prefix)
     return (strncmp(str, prefix, strlen(prefix)) == 0);
 }
 
+static void
+opkg_download_setenv(const char *name, const char *value)
+{
+    const char *old;
+
+    if (value == NULL)
+	return;
+
+    /* only once per run, unless the configuration changed */
+    old = getenv(name);
+    if (old && strcmp(old, value) == 0)
+	return;
+
+    opkg_msg(DEBUG, "Setting environment variable: %s = %s.\n", name, value);
+    setenv(name, value, 1);
+}
+
+static void
+opkg_download_set_proxies(void)
+{
+    opkg_download_setenv("http_proxy", conf->http_proxy);
+    opkg_download_setenv("ftp_proxy", conf->ftp_proxy);
+    opkg_download_setenv("no_proxy", conf->no_proxy);
+}
+
 int
 opkg_download(const char *src, const char *dest_file_name,
 	curl_progress_func cb, void *data)
@@ -109,21 +147,7 @@ opkg_download(const char *src, const char *dest_file_name,
 	return -1;
     }
 
-    if (conf->http_proxy) {
-	opkg_msg(DEBUG, "Setting environment variable: http_proxy = %s.\n",
-		conf->http_proxy);
-	setenv("http_proxy", conf->http_proxy, 1);
-    }
-    if (conf->ftp_proxy) {
-	opkg_msg(DEBUG, "Setting environment variable: ftp_proxy = %s.\n",
-		conf->ftp_proxy);
-	setenv("ftp_proxy", conf->ftp_proxy, 1);
-    }
-    if (conf->no_proxy) {
-	opkg_msg(DEBUG,"Setting environment variable: no_proxy = %s.\n",
-		conf->no_proxy);
-	setenv("no_proxy", conf->no_proxy, 1);
-    }
+    opkg_download_set_proxies();
 
 #ifdef HAVE_CURL
     CURLcode res;
@@ -186,67 +210,735 @@ opkg_download(const char *src, const char *dest_file_name,
     return err;
 }
 
+/*
+ * Download queue. Jobs are started in the order they were queued, as
+ * long as the global and per host limits allow it, and their callbacks
+ * run one at a time from opkg_download_wait(), opkg_download_wait_for()
+ * or opkg_download_poll().
+ */
+struct download_job {
+    char *src;
+    char *dest_file_name;
+    char *tmp_file_location;
+    char *host;
+    opkg_download_done_fn done;
+    void *data;
+    int err;
+#ifdef HAVE_CURL
+    CURL *curl;
+    FILE *file;
+#else
+    pid_t pid;
+#endif
+    struct download_job *next;
+};
+
+static struct download_job *queue_head = NULL;
+static struct download_job **queue_tail = &queue_head;
+static unsigned int queue_serial = 0;
+
+#ifdef HAVE_CURL
+static CURLM *curl_multi = NULL;
+/* handles of finished jobs, kept for the next ones */
+static CURL **curl_idle = NULL;
+static int n_curl_idle = 0;
+
+static CURL *
+download_curl_get(void)
+{
+    if (n_curl_idle)
+	return curl_idle[--n_curl_idle];
+
+    return opkg_curl_handle_new();
+}
+
+static void
+download_curl_put(CURL *handle)
+{
+    int max_jobs = conf->download_jobs > 0 ? conf->download_jobs : 1;
+
+    curl_multi_remove_handle(curl_multi, handle);
+
+    if (curl_idle == NULL)
+	curl_idle = xcalloc(max_jobs, sizeof(*curl_idle));
+    if (n_curl_idle < max_jobs)
+	curl_idle[n_curl_idle++] = handle;
+    else
+	curl_easy_cleanup(handle);
+}
+#endif
+
+static char *
+download_host(const char *src)
+{
+    const char *host = strstr(src, "://");
+
+    if (host == NULL)
+	return xstrdup("");
+    host += 3;
+
+    return xstrndup(host, strcspn(host, "/"));
+}
+
+void
+opkg_download_queue(const char *src, const char *dest_file_name,
+	opkg_download_done_fn done, void *data)
+{
+    struct download_job *job = xcalloc(1, sizeof(*job));
+    char *src_basec = xstrdup(src);
+
+    job->src = xstrdup(src);
+    job->dest_file_name = xstrdup(dest_file_name);
+    /* several jobs may share a basename, Packages.gz for one */
+    sprintf_alloc(&job->tmp_file_location, "%s/%u-%s", conf->tmp_dir,
+	    ++queue_serial, basename(src_basec));
+    free(src_basec);
+    job->host = download_host(src);
+    job->done = done;
+    job->data = data;
+
+    *queue_tail = job;
+    queue_tail = &job->next;
+}
+
+/* Returns 0 when the transfer is running, 1 when the job is already over. */
 static int
-opkg_download_cache(const char *src, const char *dest_file_name,
-	curl_progress_func cb, void *data)
+download_job_start(struct download_job *job)
 {
-    char *cache_name = xstrdup(src);
-    char *cache_location, *p;
-    int err = 0;
+    opkg_msg(NOTICE, "Downloading %s.\n", job->src);
+
+    if (str_starts_with(job->src, "file:")) {
+	opkg_msg(INFO, "Copying %s to %s.\n", job->src + 5,
+		job->dest_file_name);
+	job->err = file_copy(job->src + 5, job->dest_file_name);
+	return 1;
+    }
+
+    if (unlink(job->tmp_file_location) == -1 && errno != ENOENT) {
+	opkg_perror(ERROR, "Failed to unlink %s", job->tmp_file_location);
+	job->err = -1;
+	return 1;
+    }
+
+    opkg_download_set_proxies();
+
+#ifdef HAVE_CURL
+    job->file = fopen(job->tmp_file_location, "w");
+    if (job->file == NULL) {
+	opkg_perror(ERROR, "Failed to open %s", job->tmp_file_location);
+	job->err = -1;
+	return 1;
+    }
+
+    if (curl_multi == NULL)
+	curl_multi = curl_multi_init();
+
+    job->curl = curl_multi ? download_curl_get() : NULL;
+    if (job->curl == NULL) {
+	opkg_msg(ERROR, "Failed to set up a transfer for %s.\n", job->src);
+	fclose(job->file);
+	job->file = NULL;
+	job->err = -1;
+	return 1;
+    }
+
+    curl_easy_setopt(job->curl, CURLOPT_URL, job->src);
+    curl_easy_setopt(job->curl, CURLOPT_WRITEDATA, job->file);
+    curl_easy_setopt(job->curl, CURLOPT_PRIVATE, job);
+    curl_easy_setopt(job->curl, CURLOPT_NOPROGRESS, 1);
+    curl_multi_add_handle(curl_multi, job->curl);
+#else
+    {
+      const char *argv[8];
+      int i = 0;
+
+      argv[i++] = "wget";
+      argv[i++] = "-q";
+      if (conf->http_proxy || conf->ftp_proxy) {
+	argv[i++] = "-Y";
+	argv[i++] = "on";
+      }
+      argv[i++] = "-O";
+      argv[i++] = job->tmp_file_location;
+      argv[i++] = job->src;
+      argv[i++] = NULL;
+
+      job->pid = xsystem_spawn(argv);
+      if (job->pid == -1) {
+	job->err = -1;
+	return 1;
+      }
+    }
+#endif
+
+    return 0;
+}
+
+static int
+download_job_finish(struct download_job *job)
+{
+    int err = job->err;
+
+    if (!str_starts_with(job->src, "file:")) {
+	if (err)
+	    (void)unlink(job->tmp_file_location);
+	else
+	    err = file_move(job->tmp_file_location, job->dest_file_name);
+    }
+
+    if (job->done)
+	err = job->done(job->src, job->dest_file_name, err, job->data);
+
+    free(job->src);
+    free(job->dest_file_name);
+    free(job->tmp_file_location);
+    free(job->host);
+    free(job);
+
+    return err;
+}
+
+static struct download_job **running = NULL;
+static int n_running = 0;
+
+/* Moves queued jobs to running as far as the limits allow. Returns the
+ * number of jobs that failed right away. */
+static int
+download_start_jobs(void)
+{
+    struct download_job **prev, *job;
+    int max_jobs = conf->download_jobs > 0 ? conf->download_jobs : 1;
+    int max_host_jobs = conf->download_jobs_per_host > 0 ?
+	conf->download_jobs_per_host : 1;
+    int failures = 0, host_jobs, i;
+
+    if (running == NULL)
+	running = xcalloc(max_jobs, sizeof(*running));
+
+    prev = &queue_head;
+    while ((job = *prev) && n_running < max_jobs) {
+	host_jobs = 0;
+	for (i = 0; i < n_running; i++)
+	    if (strcmp(running[i]->host, job->host) == 0)
+		host_jobs++;
+	if (host_jobs >= max_host_jobs) {
+	    prev = &job->next;
+	    continue;
+	}
+
+	*prev = job->next;
+	if (queue_tail == &job->next)
+	    queue_tail = prev;
+	job->next = NULL;
+
+	if (download_job_start(job) == 0)
+	    running[n_running++] = job;
+	else if (download_job_finish(job))
+	    failures++;
+    }
+
+    return failures;
+}
+
+/* Returns a running job that is over, waiting for one if block is set. */
+static struct download_job *
+download_job_reap(int block)
+{
+#ifdef HAVE_CURL
+    struct download_job *job;
+    CURLMsg *msg;
+    int still_running, left;
+
+    while (1) {
+	curl_multi_perform(curl_multi, &still_running);
+
+	while ((msg = curl_multi_info_read(curl_multi, &left))) {
+	    if (msg->msg != CURLMSG_DONE)
+		continue;
+
+	    curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE,
+		    (char **)&job);
+	    if (msg->data.result != CURLE_OK) {
+		opkg_msg(ERROR, "Failed to download %s: %s.\n",
+			job->src, curl_easy_strerror(msg->data.result));
+		job->err = -1;
+	    }
+
+	    download_curl_put(job->curl);
+	    job->curl = NULL;
+	    fclose(job->file);
+	    job->file = NULL;
+
+	    return job;
+	}
+
+	if (!block)
+	    return NULL;
+
+	curl_multi_wait(curl_multi, NULL, 0, 1000, NULL);
+    }
+#else
+    struct download_job *job = NULL;
+    siginfo_t info;
+    int status, res, i;
+    pid_t pid;
+
+    while (job == NULL) {
+	pid = 0;
+	if (block) {
+	    /* peek first, other children are not ours to reap */
+	    info.si_pid = 0;
+	    if (waitid(P_ALL, 0, &info, WEXITED | WNOWAIT) == -1) {
+		if (errno == EINTR)
+		    continue;
+		opkg_perror(ERROR, "wget: waitid");
+		running[0]->err = -1;
+		return running[0];
+	    }
+	    for (i = 0; i < n_running; i++)
+		if (running[i]->pid == info.si_pid)
+		    job = running[i];
+	    if (job == NULL)
+		job = running[0];
+	    pid = waitpid(job->pid, &status, 0);
+	} else {
+	    for (i = 0; i < n_running && pid == 0; i++) {
+		job = running[i];
+		pid = waitpid(job->pid, &status, WNOHANG);
+	    }
+	    if (pid == 0)
+		return NULL;
+	}
+
+	if (pid == -1) {
+	    if (errno == EINTR) {
+		job = NULL;
+		continue;
+	    }
+	    opkg_perror(ERROR, "wget: waitpid");
+	    job->err = -1;
+	    return job;
+	}
+    }
+
+    res = xsystem_status("wget", status);
+    if (res) {
+	opkg_msg(ERROR, "Failed to download %s, wget returned %d.\n",
+		job->src, res);
+	job->err = -1;
+    }
+    return job;
+#endif
+}
+
+/* Whether a job for data (any job if data is NULL) is queued or running. */
+static int
+download_pending(void *data)
+{
+    struct download_job *job;
+    int i;
+
+    for (job = queue_head; job; job = job->next)
+	if (data == NULL || job->data == data)
+	    return 1;
+    for (i = 0; i < n_running; i++)
+	if (data == NULL || running[i]->data == data)
+	    return 1;
+
+    return 0;
+}
+
+static int
+download_run(void *data, int block)
+{
+    struct download_job *job;
+    int failures = 0, i;
+
+    while (download_pending(data)) {
+	failures += download_start_jobs();
+	if (n_running == 0)
+	    continue;
+
+	job = download_job_reap(block);
+	if (job == NULL)
+	    break;
+
+	for (i = 0; i < n_running; i++)
+	    if (running[i] == job)
+		running[i] = running[--n_running];
+	if (download_job_finish(job))
+	    failures++;
+    }
+
+    if (n_running == 0 && queue_head == NULL) {
+	free(running);
+	running = NULL;
+    }
+
+    return failures;
+}
+
+int
+opkg_download_wait(void)
+{
+    return download_run(NULL, 1);
+}
+
+int
+opkg_download_wait_for(void *data)
+{
+    return download_run(data, 1);
+}
+
+int
+opkg_download_poll(void)
+{
+    return download_run(NULL, 0);
+}
+
+void
+opkg_download_progress(void)
+{
+#ifdef HAVE_CURL
+    int still_running;
+
+    /* finished transfers wait in curl_multi_info_read() for the next reap */
+    if (n_running)
+	curl_multi_perform(curl_multi, &still_running);
+#endif
+}
+
+void
+opkg_download_cancel(void)
+{
+    struct download_job *job;
+#ifndef HAVE_CURL
+    int status;
+#endif
+
+    while (n_running) {
+	job = running[--n_running];
+#ifdef HAVE_CURL
+	download_curl_put(job->curl);
+	job->curl = NULL;
+	fclose(job->file);
+	job->file = NULL;
+#else
+	kill(job->pid, SIGTERM);
+	while (waitpid(job->pid, &status, 0) == -1 && errno == EINTR)
+	    ;
+#endif
+	job->err = -1;
+	download_job_finish(job);
+    }
+
+    while ((job = queue_head)) {
+	queue_head = job->next;
+	job->err = -1;
+	download_job_finish(job);
+    }
+    queue_tail = &queue_head;
+
+    free(running);
+    running = NULL;
+}
+
+/* Tells whether a queued or running job is fetching to dest_file_name. */
+static int
+download_job_pending(const char *dest_file_name)
+{
+    struct download_job *job;
+    int i;
+
+    for (i = 0; i < n_running; i++)
+	if (strcmp(running[i]->dest_file_name, dest_file_name) == 0)
+	    return 1;
+    for (job = queue_head; job; job = job->next)
+	if (strcmp(job->dest_file_name, dest_file_name) == 0)
+	    return 1;
+
+    return 0;
+}
+
+/*
+ * With conf->cache_size set, the cache is kept under that many kB by
+ * removing the archives used least recently, the mtime telling when an
+ * archive was last used. The directory is scanned once per run, and
+ * archives used in this run are never removed as they may be installed
+ * from in place. Partial downloads are not cache entries: the scan
+ * leaves those of pending jobs alone and removes the ones left behind
+ * by an earlier run.
+ */
+struct cache_entry {
+    char *path;
+    off_t size;
+    time_t used;
+};
+
+static struct cache_entry *cache_entries;
+static int cache_entries_len, cache_entries_alloc;
+static int cache_entries_scanned;
+static int cache_oldest;	/* entries before it are gone */
+static off_t cache_total;
+static time_t cache_run_start;
+
+static void
+cache_entry_add(char *path, off_t size, time_t used)
+{
+    if (cache_entries_len == cache_entries_alloc) {
+	cache_entries_alloc = cache_entries_alloc ? 2 * cache_entries_alloc : 64;
+	cache_entries = xrealloc(cache_entries,
+		cache_entries_alloc * sizeof(*cache_entries));
+    }
+
+    cache_entries[cache_entries_len].path = path;
+    cache_entries[cache_entries_len].size = size;
+    cache_entries[cache_entries_len].used = used;
+    cache_entries_len++;
+    cache_total += size;
+}
+
+static int
+cache_entry_used_cmp(const void *p1, const void *p2)
+{
+    const struct cache_entry *e1 = p1, *e2 = p2;
+
+    return (e1->used > e2->used) - (e1->used < e2->used);
+}
+
+static void
+opkg_download_cache_scan(void)
+{
+    DIR *dir;
+    struct dirent *d;
+    struct stat st;
+    char *path;
+    size_t len;
+
+    cache_entries_scanned = 1;
+
+    dir = opendir(conf->cache);
+    if (dir == NULL) {
+	opkg_perror(ERROR, "Failed to open %s", conf->cache);
+	return;
+    }
+
+    while ((d = readdir(dir)) != NULL) {
+	if (d->d_name[0] == '.')
+	    continue;
+	sprintf_alloc(&path, "%s/%s", conf->cache, d->d_name);
+	if (stat(path, &st) == -1 || !S_ISREG(st.st_mode)) {
+	    free(path);
+	    continue;
+	}
+	len = strlen(d->d_name);
+	if (len > 5 && strcmp(d->d_name + len - 5, ".part") == 0) {
+	    if (!download_job_pending(path)) {
+		opkg_msg(INFO, "Removing stale %s.\n", path);
+		if (unlink(path) == -1 && errno != ENOENT)
+		    opkg_perror(ERROR, "Failed to remove %s", path);
+	    }
+	    free(path);
+	    continue;
+	}
+	cache_entry_add(path, st.st_size, st.st_mtime);
+    }
+    closedir(dir);
+
+    qsort(cache_entries, cache_entries_len, sizeof(*cache_entries),
+	    cache_entry_used_cmp);
+}
+
+/* Marks cache_location as used by this run and makes room for it. */
+static void
+opkg_download_cache_touch(const char *cache_location)
+{
+    off_t limit = (off_t) conf->cache_size * 1024;
+    struct stat st;
+    int i;
+
+    /* before the first mtime this run sets, so that it counts as used */
+    if (!cache_entries_scanned)
+	cache_run_start = time(NULL);
+
+    (void) utime(cache_location, NULL);
 
-    if (!conf->cache || str_starts_with(src, "file:")) {
-	err = opkg_download(src, dest_file_name, cb, data);
-	goto out1;
+    if (conf->cache_size <= 0)
+	return;
+
+    if (!cache_entries_scanned)
+	opkg_download_cache_scan();
+
+    for (i = cache_oldest; i < cache_entries_len; i++)
+	if (cache_entries[i].path
+		&& strcmp(cache_entries[i].path, cache_location) == 0)
+	    break;
+    if (i < cache_entries_len)
+	cache_entries[i].used = time(NULL);
+    else if (stat(cache_location, &st) == 0)
+	cache_entry_add(xstrdup(cache_location), st.st_size, time(NULL));
+
+    for (i = cache_oldest; i < cache_entries_len && cache_total > limit; i++) {
+	struct cache_entry *e = &cache_entries[i];
+
+	if (e->path == NULL || e->used >= cache_run_start)
+	    continue;
+
+	opkg_msg(INFO, "Removing %s from the cache.\n", e->path);
+	if (unlink(e->path) == -1 && errno != ENOENT) {
+	    opkg_perror(ERROR, "Failed to remove %s", e->path);
+	    continue;
+	}
+	cache_total -= e->size;
+	free(e->path);
+	e->path = NULL;
     }
 
-    if(!file_is_dir(conf->cache)){
-	    opkg_msg(ERROR, "%s is not a directory.\n",
-			    conf->cache);
-	    err = 1;
-	    goto out1;
+    /* entries in use or failing to go stay ahead of cache_oldest */
+    while (cache_oldest < cache_entries_len
+	    && cache_entries[cache_oldest].path == NULL)
+	cache_oldest++;
+}
+
+/*
+ * Hands the archive at cache_location to pkg as conf->cache_mode says:
+ * "copy" to pkg->local_filename (a reflink where the filesystem can do
+ * it), "link" as a hard link there, or "direct" to install from the
+ * cache in place, for archives only fetched to be installed. hit tells
+ * whether the archive was in the cache before this run asked for it.
+ */
+static int
+opkg_download_cache_use(pkg_t *pkg, const char *cache_location, int hit)
+{
+    const char *mode = conf->cache_mode ? conf->cache_mode : "copy";
+
+    opkg_download_cache_touch(cache_location);
+
+    if (strcmp(mode, "direct") == 0
+	    && str_starts_with(pkg->local_filename, conf->tmp_dir)) {
+	if (hit)
+	    opkg_msg(NOTICE, "Using %s.\n", cache_location);
+	free(pkg->local_filename);
+	pkg->local_filename = xstrdup(cache_location);
+	return 0;
+    }
+
+    if (strcmp(mode, "link") == 0) {
+	(void) unlink(pkg->local_filename);
+	if (link(cache_location, pkg->local_filename) == 0) {
+	    if (hit)
+	    opkg_msg(NOTICE, "Linking %s.\n", cache_location);
+	    return 0;
+	}
+	/* most likely on another filesystem */
+	opkg_msg(DEBUG, "Failed to link %s: %s.\n",
+		cache_location, strerror(errno));
     }
 
+    if (hit)
+	opkg_msg(NOTICE, "Copying %s.\n", cache_location);
+    return file_copy(cache_location, pkg->local_filename);
+}
+
+/*
+ * Where the archive of pkg, fetched from url, is kept in the cache, or
+ * NULL when it should not be cached. Archives are named by their
+ * checksum in the package index where there is one, so the feeds and
+ * mirrors carrying a package share its entry. Those are checked once,
+ * on the way in, and trusted after that.
+ */
+static char *
+opkg_download_pkg_cache_location(pkg_t *pkg, const char *url)
+{
+    char *cache_name, *cache_location, *p;
+    const char *hex = "0123456789abcdefABCDEF";
+
+    if (!conf->cache || str_starts_with(url, "file:"))
+	return NULL;
+
+#ifdef HAVE_SHA256
+    if (pkg->sha256sum && *pkg->sha256sum
+	    && strspn(pkg->sha256sum, hex) == strlen(pkg->sha256sum)) {
+	sprintf_alloc(&cache_location, "%s/sha256-%s",
+		conf->cache, pkg->sha256sum);
+	return cache_location;
+    }
+#endif
+    if (pkg->md5sum && *pkg->md5sum
+	    && strspn(pkg->md5sum, hex) == strlen(pkg->md5sum)) {
+	sprintf_alloc(&cache_location, "%s/md5-%s", conf->cache, pkg->md5sum);
+	return cache_location;
+    }
+
+    cache_name = xstrdup(url);
     for (p = cache_name; *p; p++)
 	if (*p == '/')
 	    *p = ',';	/* looks nicer than | or # */
 
     sprintf_alloc(&cache_location, "%s/%s", conf->cache, cache_name);
-    if (file_exists(cache_location))
-	opkg_msg(NOTICE, "Copying %s.\n", cache_location);
-    else {
-	err = opkg_download(src, cache_location, cb, data);
-	if (err) {
-	    (void) unlink(cache_location);
-	    goto out2;
-	}
-    }
+    free(cache_name);
+
+    return cache_location;
+}
+
+/*
+ * Moves the archive of pkg, fetched to part, to cache_location if it
+ * matches the index and hands it to pkg.
+ */
+static int
+opkg_download_cache_insert(pkg_t *pkg, const char *part,
+	const char *cache_location)
+{
+    int err;
 
-    err = file_copy(cache_location, dest_file_name);
+    err = pkg_verify_file(pkg, part);
+    if (err) {
+	pkg->local_file_verified = -1;
+    } else if (rename(part, cache_location) == -1) {
+	opkg_perror(ERROR, "Failed to rename %s to %s", part, cache_location);
+	err = -1;
+    }
+    if (err) {
+	(void) unlink(part);
+	return err;
+    }
 
+    err = opkg_download_cache_use(pkg, cache_location, 0);
+    if (!err)
+	pkg->local_file_verified = 1;
 
-out2:
-    free(cache_location);
-out1:
-    free(cache_name);
     return err;
 }
 
-int
-opkg_download_pkg(pkg_t *pkg, const char *dir)
+/* Takes pkg from the cache entry at cache_location, checked on insert. */
+static int
+opkg_download_cache_hit(pkg_t *pkg, const char *cache_location)
 {
     int err;
+
+    err = opkg_download_cache_use(pkg, cache_location, 1);
+    if (!err)
+	pkg->local_file_verified = 1;
+
+    return err;
+}
+
+/* Sets pkg->local_filename and returns the url to fetch it from. */
+static char *
+opkg_download_pkg_url(pkg_t *pkg, const char *dir)
+{
     char *url;
     char *stripped_filename;
 
     if (pkg->src == NULL) {
 	opkg_msg(ERROR, "Package %s is not available from any configured src.\n",
 		pkg->name);
-	return -1;
+	return NULL;
     }
     if (pkg->filename == NULL) {
 	opkg_msg(ERROR, "Package %s does not have a valid filename field.\n",
 		pkg->name);
-	return -1;
+	return NULL;
     }
 
     sprintf_alloc(&url, "%s/%s", pkg->src->value, pkg->filename);
@@ -261,13 +953,106 @@ opkg_download_pkg(pkg_t *pkg, const char *dir)
         stripped_filename = pkg->filename;
 
     sprintf_alloc(&pkg->local_filename, "%s/%s", dir, stripped_filename);
+    pkg->local_file_verified = 0;
 
-    err = opkg_download_cache(url, pkg->local_filename, NULL, NULL);
+    return url;
+}
+
+int
+opkg_download_pkg(pkg_t *pkg, const char *dir)
+{
+    int err;
+    char *url;
+
+    char *cache_location, *part;
+
+    url = opkg_download_pkg_url(pkg, dir);
+    if (url == NULL)
+	return -1;
+
+    cache_location = opkg_download_pkg_cache_location(pkg, url);
+    if (cache_location == NULL) {
+	err = opkg_download(url, pkg->local_filename, NULL, NULL);
+    } else if (!file_is_dir(conf->cache)) {
+	opkg_msg(ERROR, "%s is not a directory.\n", conf->cache);
+	err = 1;
+    } else if (file_exists(cache_location)) {
+	err = opkg_download_cache_hit(pkg, cache_location);
+    } else {
+	sprintf_alloc(&part, "%s.part", cache_location);
+	err = opkg_download(url, part, NULL, NULL);
+	if (err)
+	    (void) unlink(part);
+	else
+	    err = opkg_download_cache_insert(pkg, part, cache_location);
+	free(part);
+    }
+
+    free(cache_location);
     free(url);
 
     return err;
 }
 
+static int
+opkg_download_pkg_done(const char *src, const char *dest_file_name,
+	int err, void *data)
+{
+    pkg_t *pkg = data;
+    char *cache_location;
+
+    cache_location = opkg_download_pkg_cache_location(pkg, src);
+
+    if (err) {
+	/* leave it to opkg_install_pkg() to try again and complain */
+	if (cache_location)
+	    (void) unlink(dest_file_name);
+	free(pkg->local_filename);
+	pkg->local_filename = NULL;
+    } else if (cache_location) {
+	err = opkg_download_cache_insert(pkg, dest_file_name, cache_location);
+    } else {
+	/* opkg_install_pkg() gives up on it if this fails */
+	err = pkg_verify_archive(pkg);
+    }
+
+    free(cache_location);
+
+    return err;
+}
+
+void
+opkg_download_pkg_queue(pkg_t *pkg, const char *dir)
+{
+    char *url, *cache_location, *part;
+
+    url = opkg_download_pkg_url(pkg, dir);
+    if (url == NULL)
+	return;
+
+    cache_location = opkg_download_pkg_cache_location(pkg, url);
+    if (cache_location == NULL) {
+	opkg_download_queue(url, pkg->local_filename,
+		opkg_download_pkg_done, pkg);
+    } else if (!file_is_dir(conf->cache)) {
+	opkg_msg(ERROR, "%s is not a directory.\n", conf->cache);
+	free(pkg->local_filename);
+	pkg->local_filename = NULL;
+    } else if (file_exists(cache_location)) {
+	if (opkg_download_cache_hit(pkg, cache_location)) {
+	    free(pkg->local_filename);
+	    pkg->local_filename = NULL;
+	}
+    } else {
+	sprintf_alloc(&part, "%s.part", cache_location);
+	opkg_download_queue(url, part, opkg_download_pkg_done, pkg);
+	free(part);
+    }
+
+    free(cache_location);
+    free(url);
+}
+
 /*
  * Downloads file from url, installs in package database, return package name. 
  */
@@ -310,7 +1095,6 @@ opkg_prepare_url_for_install(const char *url, char **namep)
 
      } else {
        pkg_deinit(pkg);
-       free(pkg);
        return 0;
      }
 
@@ -545,41 +1329,49 @@ void opkg_curl_cleanup(void){
 	curl_easy_cleanup (curl);
 	curl = NULL;
     }
+    while (n_curl_idle)
+	curl_easy_cleanup(curl_idle[--n_curl_idle]);
+    free(curl_idle);
+    curl_idle = NULL;
+    if (curl_multi != NULL) {
+	curl_multi_cleanup(curl_multi);
+	curl_multi = NULL;
+    }
+    /* last, as the handles above may still use it */
+    if (curl_share != NULL) {
+	curl_share_cleanup(curl_share);
+	curl_share = NULL;
+    }
 }
 
-static CURL *
-opkg_curl_init(curl_progress_func cb, void *data)
+/* Options shared by every handle, whatever transfer it is used for. */
+static int
+opkg_curl_setopts(CURL *handle)
 {
-
-    if(curl == NULL){
-	curl = curl_easy_init();
-
 #ifdef HAVE_SSLCURL
 	openssl_init();
 
 	if (conf->ssl_engine) {
 
 	    /* use crypto engine */
-	    if (curl_easy_setopt(curl, CURLOPT_SSLENGINE, conf->ssl_engine) != CURLE_OK){
+	    if (curl_easy_setopt(handle, CURLOPT_SSLENGINE, conf->ssl_engine) != CURLE_OK){
 		opkg_msg(ERROR, "Can't set crypto engine '%s'.\n",
 			conf->ssl_engine);
 
-		opkg_curl_cleanup();
-		return NULL;
+		return -1;
 	    }
 	    /* set the crypto engine as default */
-	    if (curl_easy_setopt(curl, CURLOPT_SSLENGINE_DEFAULT, 1L) != CURLE_OK){
+	    if (curl_easy_setopt(handle, CURLOPT_SSLENGINE_DEFAULT, 1L) != CURLE_OK){
 		opkg_msg(ERROR, "Can't set crypto engine '%s' as default.\n",
 			conf->ssl_engine);
 
-		opkg_curl_cleanup();
-		return NULL;
+		return -1;
 	    }
 	}
 
 	/* cert & key can only be in PEM case in the same file */
 	if(conf->ssl_key_passwd){
-	    if (curl_easy_setopt(curl, CURLOPT_SSLKEYPASSWD, conf->ssl_key_passwd) != CURLE_OK)
+	    if (curl_easy_setopt(handle, CURLOPT_SSLKEYPASSWD, conf->ssl_key_passwd) != CURLE_OK)
 	    {
 	        opkg_msg(DEBUG, "Failed to set key password.\n");
 	    }
@@ -587,25 +1379,25 @@ opkg_curl_init(curl_progress_func cb, void *data)
 
 	/* sets the client certificate and its type */
 	if(conf->ssl_cert_type){
-	    if (curl_easy_setopt(curl, CURLOPT_SSLCERTTYPE, conf->ssl_cert_type) != CURLE_OK)
+	    if (curl_easy_setopt(handle, CURLOPT_SSLCERTTYPE, conf->ssl_cert_type) != CURLE_OK)
 	    {
 	        opkg_msg(DEBUG, "Failed to set certificate format.\n");
 	    }
 	}
 	/* SSL cert name isn't mandatory */
 	if(conf->ssl_cert){
-	        curl_easy_setopt(curl, CURLOPT_SSLCERT, conf->ssl_cert);
+	        curl_easy_setopt(handle, CURLOPT_SSLCERT, conf->ssl_cert);
 	}
 
 	/* sets the client key and its type */
 	if(conf->ssl_key_type){
-	    if (curl_easy_setopt(curl, CURLOPT_SSLKEYTYPE, conf->ssl_key_type) != CURLE_OK)
+	    if (curl_easy_setopt(handle, CURLOPT_SSLKEYTYPE, conf->ssl_key_type) != CURLE_OK)
 	    {
 	        opkg_msg(DEBUG, "Failed to set key format.\n");
 	    }
 	}
 	if(conf->ssl_key){
-	    if (curl_easy_setopt(curl, CURLOPT_SSLKEY, conf->ssl_key) != CURLE_OK)
+	    if (curl_easy_setopt(handle, CURLOPT_SSLKEY, conf->ssl_key) != CURLE_OK)
 	    {
 	        opkg_msg(DEBUG, "Failed to set key.\n");
 	    }
@@ -616,14 +1408,14 @@ opkg_curl_init(curl_progress_func cb, void *data)
 	    /*
 	     * CURLOPT_SSL_VERIFYPEER default is nonzero (curl => 7.10)
 	     */
-	    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0);
+	    curl_easy_setopt(handle, CURLOPT_SSL_VERIFYPEER, 0);
 	}else{
 #ifdef HAVE_PATHFINDER
 	    if(conf->check_x509_path){
-    	        if (curl_easy_setopt(curl, CURLOPT_SSL_CTX_FUNCTION, curl_ssl_ctx_function) != CURLE_OK){
+    	        if (curl_easy_setopt(handle, CURLOPT_SSL_CTX_FUNCTION, curl_ssl_ctx_function) != CURLE_OK){
 		    opkg_msg(DEBUG, "Failed to set ssl path verification callback.\n");
 		}else{
-		    curl_easy_setopt(curl, CURLOPT_SSL_CTX_DATA, NULL);
+		    curl_easy_setopt(handle, CURLOPT_SSL_CTX_DATA, NULL);
 		}
 	    }
 #endif
@@ -631,23 +1423,70 @@ opkg_curl_init(curl_progress_func cb, void *data)
 
 	/* certification authority file and/or path */
 	if(conf->ssl_ca_file){
-	    curl_easy_setopt(curl, CURLOPT_CAINFO, conf->ssl_ca_file);
+	    curl_easy_setopt(handle, CURLOPT_CAINFO, conf->ssl_ca_file);
 	}
 	if(conf->ssl_ca_path){
-	    curl_easy_setopt(curl, CURLOPT_CAPATH, conf->ssl_ca_path);
+	    curl_easy_setopt(handle, CURLOPT_CAPATH, conf->ssl_ca_path);
 	}
 #endif
 
-	curl_easy_setopt (curl, CURLOPT_FOLLOWLOCATION, 1);
-	curl_easy_setopt (curl, CURLOPT_FAILONERROR, 1);
+	curl_easy_setopt (handle, CURLOPT_FOLLOWLOCATION, 1);
+	curl_easy_setopt (handle, CURLOPT_FAILONERROR, 1);
+#if LIBCURL_VERSION_NUM >= 0x071900
+	/* connections are kept for later transfers, see curl_share */
+	curl_easy_setopt (handle, CURLOPT_TCP_KEEPALIVE, 1L);
+#endif
 	if (conf->http_proxy || conf->ftp_proxy)
 	{
 	    char *userpwd;
 	    sprintf_alloc (&userpwd, "%s:%s", conf->proxy_user,
 		    conf->proxy_passwd);
-	    curl_easy_setopt(curl, CURLOPT_PROXYUSERPWD, userpwd);
+	    curl_easy_setopt(handle, CURLOPT_PROXYUSERPWD, userpwd);
 	    free (userpwd);
 	}
+
+    return 0;
+}
+
+/* A configured handle, attached to curl_share. */
+static CURL *
+opkg_curl_handle_new(void)
+{
+    CURL *handle;
+
+    if (curl_share == NULL) {
+	curl_share = curl_share_init();
+	if (curl_share == NULL)
+	    return NULL;
+	curl_share_setopt(curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	curl_share_setopt(curl_share, CURLSHOPT_SHARE,
+		CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+	curl_share_setopt(curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+    }
+
+    handle = curl_easy_init();
+    if (handle == NULL)
+	return NULL;
+
+    if (opkg_curl_setopts(handle)) {
+	curl_easy_cleanup(handle);
+	return NULL;
+    }
+    curl_easy_setopt(handle, CURLOPT_SHARE, curl_share);
+
+    return handle;
+}
+
+static CURL *
+opkg_curl_init(curl_progress_func cb, void *data)
+{
+
+    if(curl == NULL){
+	curl = opkg_curl_handle_new();
+	if (curl == NULL)
+	    return NULL;
     }
 
     curl_easy_setopt (curl, CURLOPT_NOPROGRESS, (cb == NULL));
@@ -26,7 +26,51 @@ typedef int (*curl_progress_func)(void *data, double t, double d, double ultotal
 
 
 int opkg_download(const char *src, const char *dest_file_name, curl_progress_func cb, void *data);
+
+/*
+ * Called from opkg_download_wait() and friends when a queued download has finished,
+ * with err set if it failed. It may queue further downloads, and returns
+ * the final status of the job.
+ */
+typedef int (*opkg_download_done_fn)(const char *src,
+		const char *dest_file_name, int err, void *data);
+
+void opkg_download_queue(const char *src, const char *dest_file_name,
+		opkg_download_done_fn done, void *data);
+/*
+ * Runs the queued downloads, at most download_jobs at a time and no more
+ * than download_jobs_per_host to the same host. Returns the number of
+ * jobs that failed.
+ */
+int opkg_download_wait(void);
+/*
+ * Like opkg_download_wait(), but only until the jobs queued with data
+ * are over.
+ */
+int opkg_download_wait_for(void *data);
+/*
+ * Starts what can be started and finishes the jobs that are already over,
+ * without waiting. Returns the number of jobs that failed.
+ */
+int opkg_download_poll(void);
+/*
+ * Moves the running transfers along without finishing any job, for use
+ * in the middle of other work. Only needed with libcurl, wget runs on
+ * its own.
+ */
+void opkg_download_progress(void);
+/*
+ * Drops whatever is still queued or running. The callbacks are run with
+ * err set.
+ */
+void opkg_download_cancel(void);
 int opkg_download_pkg(pkg_t *pkg, const char *dir);
+/*
+ * Queues the download of pkg into dir, checking the archive once it is
+ * there. pkg->local_filename is left NULL if either fails, so that
+ * opkg_install_pkg() tries it again.
+ */
+void opkg_download_pkg_queue(pkg_t *pkg, const char *dir);
 /*
  * Downloads file from url, installs in package database, return package name. 
  */
@@ -227,7 +227,9 @@ unpack_pkg_control_files(pkg_t *pkg)
 	  return -1;
      }
 
-     err = pkg_extract_control_files_to_dir(pkg, pkg->tmp_unpack_dir);
+     /* The data file names are needed for the clash checks before the
+	data files go in, so list them in the same pass. */
+     err = pkg_read_data_file_names(pkg, pkg->tmp_unpack_dir);
      if (err) {
 	  return err;
      }
@@ -1125,6 +1127,53 @@ resolve_conffiles(pkg_t *pkg)
 }
 
 
+/* Queues the archive of pkg unless it is not going to be installed. */
+static void
+prefetch_pkg(pkg_t *pkg)
+{
+     static char cwd[4096];
+     const char *dir = conf->tmp_dir;
+     pkg_t *old;
+
+     if (pkg->local_filename || pkg->state_status == SS_INSTALLED)
+	  return;
+
+     old = pkg_hash_fetch_installed_by_name(pkg->name);
+     if (old && !conf->force_reinstall && !conf->force_downgrade
+		     && pkg_compare_versions(old, pkg) >= 0)
+	  return;
+
+     if (!conf->cache && conf->download_only) {
+	  if (getcwd(cwd, sizeof(cwd)) == NULL)
+	       return;
+	  dir = cwd;
+     }
+
+     opkg_download_pkg_queue(pkg, dir);
+}
+
+void
+opkg_install_prefetch(pkg_t *pkg)
+{
+     pkg_vec_t *missing;
+     int i;
+
+     prefetch_pkg(pkg);
+     if (conf->nodeps)
+	  return;
+
+     missing = pkg_vec_alloc();
+     pkg_hash_fetch_missing_dependencies(pkg, missing);
+     for (i = 0; i < missing->len; i++)
+	  prefetch_pkg(missing->pkgs[i]);
+     pkg_vec_free(missing);
+
+     /* get the transfers going, and keep them going while the packages
+      * before them are unpacked */
+     opkg_download_poll();
+     extract_progress = opkg_download_progress;
+}
+
 int
 opkg_install_by_name(const char *pkg_name)
 {
@@ -1201,15 +1250,14 @@ opkg_install_pkg(pkg_t *pkg, int from_upgrade)
      pkg_vec_t *replacees;
      abstract_pkg_t *ab_pkg = NULL;
      int old_state_flag;
-     char* file_md5;
-#ifdef HAVE_SHA256
-     char* file_sha256;
-#endif
      sigset_t newset, oldset;
 
      if ( from_upgrade ) 
         message = 1;            /* Coming from an upgrade, and should change the output message */
 
+     /* let finished prefetches make room for the next ones */
+     opkg_download_poll();
+
      opkg_msg(DEBUG2, "Calling pkg_arch_supported.\n");
 
      if (!pkg_arch_supported(pkg)) {
@@ -1257,6 +1305,9 @@ opkg_install_pkg(pkg_t *pkg, int from_upgrade)
      if (err)
 	     return -1;
 
+     /* it may have been prefetched, see opkg_install_prefetch() */
+     opkg_download_wait_for(pkg);
+
      if (pkg->local_filename == NULL) {
          if(!conf->cache && conf->download_only){
              char cwd[4096];
@@ -1309,41 +1360,10 @@ opkg_install_pkg(pkg_t *pkg, int from_upgrade)
      }
      #endif
 
-     /* Check for md5 values */
-     if (pkg->md5sum)
-     {
-         file_md5 = file_md5sum_alloc(pkg->local_filename);
-         if (file_md5 && strcmp(file_md5, pkg->md5sum))
-         {
-              opkg_msg(ERROR, "Package %s md5sum mismatch. "
-			"Either the opkg or the package index are corrupt. "
-			"Try 'opkg update'.\n",
-			pkg->name);
-              free(file_md5);
-              return -1;
-         }
-	 if (file_md5)
-              free(file_md5);
-     }
+     err = pkg_verify_archive(pkg);
+     if (err)
+	     return -1;
 
-#ifdef HAVE_SHA256
-     /* Check for sha256 value */
-     if(pkg->sha256sum)
-     {
-         file_sha256 = file_sha256sum_alloc(pkg->local_filename);
-         if (file_sha256 && strcmp(file_sha256, pkg->sha256sum))
-         {
-              opkg_msg(ERROR, "Package %s sha256sum mismatch. "
-			"Either the opkg or the package index are corrupt. "
-			"Try 'opkg update'.\n",
-			pkg->name);
-              free(file_sha256);
-              return -1;
-         }
-	 if (file_sha256)
-              free(file_sha256);
-     }
-#endif
      if(conf->download_only) {
          if (conf->nodeps == 0) {
              err = satisfy_dependencies_for(pkg);
@@ -1478,6 +1498,11 @@ opkg_install_pkg(pkg_t *pkg, int from_upgrade)
 	  resolve_conffiles(pkg);
 
 	  pkg->state_status = SS_UNPACKED;
+	  /* from now on the file list comes from info_dir */
+	  if (pkg->data_file_names) {
+	       str_list_purge(pkg->data_file_names);
+	       pkg->data_file_names = NULL;
+	  }
 	  old_state_flag = pkg->state_flag;
 	  pkg->state_flag &= ~SF_PREFER;
 	  opkg_msg(DEBUG, "pkg=%s old_state_flag=%x state_flag=%x\n",
@@ -23,5 +23,11 @@
 
 int opkg_install_by_name(const char *pkg_name);
 int opkg_install_pkg(pkg_t *pkg, int from_upgrading);
+/*
+ * Starts downloading pkg and whatever it depends on that is not installed
+ * yet, in the background. opkg_install_pkg() picks the archives up, or
+ * waits for them, when their turn comes.
+ */
+void opkg_install_prefetch(pkg_t *pkg);
 
 #endif
@@ -0,0 +1,896 @@
+/* opkg_solver.c - the opkg package management system
+
+   Javier Palacios
+
+   Copyright (C) 2010 Javier Palacios
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+/*
+ * The "sat" solver, an alternative to picking the best candidate one
+ * dependency at a time. Every package version the transaction may
+ * touch becomes a boolean variable, and the request, the installed
+ * system, Depends, Pre-Depends and Conflicts become clauses over them:
+ *
+ *   request	one of the versions of each package asked for
+ *   keep	one of the versions of each installed package, or a
+ *		package replacing it
+ *   depends	!pkg or one of the satisfiers of the dependency, only
+ *		wanted if the installed pkg has it broken already
+ *   conflicts	!pkg or !conflictee, one version per name
+ *
+ * A small CDCL solver finds an assignment. Its decisions follow the
+ * clauses that ask for a package (the "wants"), taking the preferred
+ * package first: with the default "changes" policy that is the version
+ * already installed, with "newest" it is the newest version, and the
+ * packages asked for always go for the newest. Whatever nothing asks
+ * for is left out. The packages set in the result are the plan, which
+ * pkg_hash_fetch_best_installation_candidate() then follows, and the
+ * depends resolution too when picking among alternatives.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "opkg_solver.h"
+#include "opkg_conf.h"
+#include "opkg_message.h"
+#include "pkg_hash.h"
+#include "pkg_depends.h"
+#include "ptr_map.h"
+#include "libbb/libbb.h"
+
+/* Past this many conflicts the request is given up on, unless the
+ * solver_max_conflicts option says otherwise. */
+#define SOLVER_MAX_CONFLICTS	100000
+
+#define LIT(var, neg)	(2 * (var) + (neg))
+#define LIT_VAR(lit)	((lit) >> 1)
+#define LIT_NOT(lit)	((lit) ^ 1)
+
+struct sat_clause {
+     int len;
+     int lits[];
+};
+
+struct sat_watch {
+     int *clauses;
+     int len, size;
+};
+
+/* A clause asking for one of lits, in order of preference. It only
+ * counts once guard, if not -1, is true. */
+struct sat_want {
+     int guard;
+     int len;
+     int *lits;
+};
+
+struct sat {
+     int nvars;
+     signed char *value;	/* 1 true, -1 false, 0 unassigned */
+     int *level;
+     int *reason;		/* clause that implied it, or -1 */
+     int *trail, trail_len, qhead;
+     int *trail_lim, n_levels;
+     struct sat_clause **clauses;
+     int n_clauses, clauses_size;
+     struct sat_watch *watches;	/* clauses watching each literal */
+     unsigned char *seen;
+     int *learnt;
+     int conflicts, max_conflicts;
+     int unsat;
+     struct sat_want *wants;
+     int n_wants, wants_size;
+     int want_cursor, var_cursor;
+};
+
+struct solver {
+     struct sat sat;
+     ptr_map_t vars;		/* pkg_t -> variable + 1, or -1 if left out */
+     pkg_vec_t *pkgs;		/* by variable */
+     ptr_map_t targets;		/* abstract_pkg_t asked for */
+     abstract_pkg_vec_t *target_vec;
+     pkg_vec_t *scratch;
+     int *lits, *want_lits;
+     unsigned char *mark;
+     int newest;
+};
+
+static ptr_map_t plan;
+static int plan_active;
+
+static void
+sat_init(struct sat *s, int nvars)
+{
+     memset(s, 0, sizeof(*s));
+     s->nvars = nvars;
+     s->value = xcalloc(nvars, sizeof(*s->value));
+     s->level = xcalloc(nvars, sizeof(int));
+     s->reason = xcalloc(nvars, sizeof(int));
+     s->trail = xcalloc(nvars, sizeof(int));
+     s->trail_lim = xcalloc(nvars + 1, sizeof(int));
+     s->watches = xcalloc(2 * nvars, sizeof(struct sat_watch));
+     s->seen = xcalloc(nvars, 1);
+     s->learnt = xcalloc(nvars + 1, sizeof(int));
+}
+
+static void
+sat_deinit(struct sat *s)
+{
+     int i;
+
+     for (i = 0; i < s->n_clauses; i++)
+	  free(s->clauses[i]);
+     for (i = 0; i < 2 * s->nvars; i++)
+	  free(s->watches[i].clauses);
+     for (i = 0; i < s->n_wants; i++)
+	  free(s->wants[i].lits);
+     free(s->clauses);
+     free(s->watches);
+     free(s->wants);
+     free(s->value);
+     free(s->level);
+     free(s->reason);
+     free(s->trail);
+     free(s->trail_lim);
+     free(s->seen);
+     free(s->learnt);
+}
+
+static int
+lit_value(struct sat *s, int lit)
+{
+     int v = s->value[LIT_VAR(lit)];
+
+     return (lit & 1) ? -v : v;
+}
+
+static void
+sat_enqueue(struct sat *s, int lit, int reason)
+{
+     int var = LIT_VAR(lit);
+
+     s->value[var] = (lit & 1) ? -1 : 1;
+     s->level[var] = s->n_levels;
+     s->reason[var] = reason;
+     s->trail[s->trail_len++] = lit;
+}
+
+static void
+sat_watch(struct sat *s, int lit, int ci)
+{
+     struct sat_watch *w = &s->watches[lit];
+
+     if (w->len == w->size) {
+	  w->size = w->size ? 2 * w->size : 4;
+	  w->clauses = xrealloc(w->clauses, w->size * sizeof(int));
+     }
+     w->clauses[w->len++] = ci;
+}
+
+/* Stores a clause of two or more literals, watching the first two. */
+static int
+sat_store(struct sat *s, const int *lits, int len)
+{
+     struct sat_clause *c;
+
+     if (s->n_clauses == s->clauses_size) {
+	  s->clauses_size = s->clauses_size ? 2 * s->clauses_size : 256;
+	  s->clauses = xrealloc(s->clauses,
+			  s->clauses_size * sizeof(*s->clauses));
+     }
+
+     c = xmalloc(sizeof(*c) + len * sizeof(int));
+     c->len = len;
+     memcpy(c->lits, lits, len * sizeof(int));
+     s->clauses[s->n_clauses] = c;
+     sat_watch(s, lits[0], s->n_clauses);
+     sat_watch(s, lits[1], s->n_clauses);
+
+     return s->n_clauses++;
+}
+
+/* For the clauses of the problem, before the search. */
+static void
+sat_add_clause(struct sat *s, const int *lits, int len)
+{
+     int v;
+
+     if (len > 1) {
+	  sat_store(s, lits, len);
+	  return;
+     }
+
+     v = len ? lit_value(s, lits[0]) : -1;
+     if (v < 0)
+	  s->unsat = 1;
+     else if (v == 0)
+	  sat_enqueue(s, lits[0], -1);
+}
+
+static void
+sat_add_want(struct sat *s, int guard, const int *lits, int len)
+{
+     struct sat_want *w;
+
+     if (s->n_wants == s->wants_size) {
+	  s->wants_size = s->wants_size ? 2 * s->wants_size : 256;
+	  s->wants = xrealloc(s->wants, s->wants_size * sizeof(*s->wants));
+     }
+
+     w = &s->wants[s->n_wants++];
+     w->guard = guard;
+     w->len = len;
+     w->lits = xmalloc(len * sizeof(int));
+     memcpy(w->lits, lits, len * sizeof(int));
+}
+
+/* Returns a clause left with every literal false, or -1. */
+static int
+sat_propagate(struct sat *s)
+{
+     while (s->qhead < s->trail_len) {
+	  int false_lit = LIT_NOT(s->trail[s->qhead++]);
+	  struct sat_watch *w = &s->watches[false_lit];
+	  int i, j, k;
+
+	  for (i = j = 0; i < w->len; i++) {
+	       int ci = w->clauses[i];
+	       struct sat_clause *c = s->clauses[ci];
+
+	       /* the false one goes second, lits[0] is what is implied */
+	       if (c->lits[0] == false_lit) {
+		    c->lits[0] = c->lits[1];
+		    c->lits[1] = false_lit;
+	       }
+	       if (lit_value(s, c->lits[0]) > 0) {
+		    w->clauses[j++] = ci;
+		    continue;
+	       }
+
+	       for (k = 2; k < c->len; k++)
+		    if (lit_value(s, c->lits[k]) >= 0)
+			 break;
+	       if (k < c->len) {
+		    c->lits[1] = c->lits[k];
+		    c->lits[k] = false_lit;
+		    sat_watch(s, c->lits[1], ci);
+		    continue;
+	       }
+
+	       w->clauses[j++] = ci;
+	       if (lit_value(s, c->lits[0]) < 0) {
+		    while (++i < w->len)
+			 w->clauses[j++] = w->clauses[i];
+		    w->len = j;
+		    return ci;
+	       }
+	       sat_enqueue(s, c->lits[0], ci);
+	  }
+	  w->len = j;
+     }
+
+     return -1;
+}
+
+static void
+sat_cancel_until(struct sat *s, int level)
+{
+     int i;
+
+     if (s->n_levels <= level)
+	  return;
+
+     for (i = s->trail_len - 1; i >= s->trail_lim[level]; i--)
+	  s->value[LIT_VAR(s->trail[i])] = 0;
+     s->trail_len = s->qhead = s->trail_lim[level];
+     s->n_levels = level;
+     s->want_cursor = 0;
+     s->var_cursor = 0;
+}
+
+/* Learns the first UIP clause of the conflict in ci, then jumps back to
+ * the level where that clause asserts its literal. */
+static void
+sat_learn(struct sat *s, int ci)
+{
+     int *learnt = s->learnt;
+     int n = 1, path = 0, p = -1, idx = s->trail_len - 1;
+     int i, var, tmp, bt = 0;
+
+     do {
+	  struct sat_clause *c = s->clauses[ci];
+
+	  for (i = (p == -1) ? 0 : 1; i < c->len; i++) {
+	       var = LIT_VAR(c->lits[i]);
+	       if (s->seen[var] || s->level[var] == 0)
+		    continue;
+	       s->seen[var] = 1;
+	       if (s->level[var] == s->n_levels)
+		    path++;
+	       else
+		    learnt[n++] = c->lits[i];
+	  }
+
+	  while (!s->seen[LIT_VAR(s->trail[idx])])
+	       idx--;
+	  p = s->trail[idx--];
+	  ci = s->reason[LIT_VAR(p)];
+	  s->seen[LIT_VAR(p)] = 0;
+     } while (--path > 0);
+     learnt[0] = LIT_NOT(p);
+
+     /* the deepest of the rest goes second, to be watched */
+     for (i = 1; i < n; i++) {
+	  var = LIT_VAR(learnt[i]);
+	  s->seen[var] = 0;
+	  if (s->level[var] > bt) {
+	       bt = s->level[var];
+	       tmp = learnt[1];
+	       learnt[1] = learnt[i];
+	       learnt[i] = tmp;
+	  }
+     }
+
+     sat_cancel_until(s, bt);
+     sat_enqueue(s, learnt[0], n > 1 ? sat_store(s, learnt, n) : -1);
+}
+
+/*
+ * The preferred literal of the first want nothing satisfies yet, or
+ * else leaving out a package nothing asked for. -1 when all is set.
+ */
+static int
+sat_decide(struct sat *s)
+{
+     struct sat_want *w;
+     int i, j, v, lit, done;
+
+     for (i = s->want_cursor; i < s->n_wants; i++) {
+	  w = &s->wants[i];
+	  done = 0;
+	  lit = -1;
+
+	  v = w->guard >= 0 ? lit_value(s, w->guard) : 1;
+	  if (v < 0) {
+	       done = 1;
+	  } else if (v > 0) {
+	       for (j = 0; j < w->len; j++) {
+		    v = lit_value(s, w->lits[j]);
+		    if (v > 0)
+			 break;
+		    if (v == 0 && lit < 0)
+			 lit = w->lits[j];
+	       }
+	       if (j < w->len)
+		    done = 1;
+	       else if (lit >= 0)
+		    return lit;
+	  }
+
+	  /* nothing before the cursor needs looking at again until
+	   * something is undone */
+	  if (done && i == s->want_cursor)
+	       s->want_cursor++;
+     }
+
+     for (; s->var_cursor < s->nvars; s->var_cursor++)
+	  if (s->value[s->var_cursor] == 0)
+	       return LIT(s->var_cursor, 1);
+
+     return -1;
+}
+
+/* 0 with a model, -1 if there is none, -2 if it gave up. */
+static int
+sat_solve(struct sat *s)
+{
+     int ci, lit;
+
+     if (s->unsat)
+	  return -1;
+
+     while (1) {
+	  ci = sat_propagate(s);
+	  if (ci >= 0) {
+	       if (s->n_levels == 0)
+		    return -1;
+	       if (++s->conflicts > s->max_conflicts)
+		    return -2;
+	       sat_learn(s, ci);
+	       continue;
+	  }
+
+	  lit = sat_decide(s);
+	  if (lit < 0)
+	       return 0;
+	  s->trail_lim[s->n_levels++] = s->trail_len;
+	  sat_enqueue(s, lit, -1);
+     }
+}
+
+static int
+pkg_is_installed(pkg_t *pkg)
+{
+     return pkg->state_status == SS_INSTALLED
+	     || pkg->state_status == SS_UNPACKED;
+}
+
+static int
+pkg_provides_abstract(pkg_t *pkg, abstract_pkg_t *ab_pkg)
+{
+     int i;
+
+     for (i = 0; i < pkg->provides_count; i++)
+	  if (pkg->provides[i] == ab_pkg)
+	       return 1;
+
+     return 0;
+}
+
+/* Held packages stay as they are and nothing is downgraded unless
+ * forced, like opkg_install_check_downgrade() has it. */
+static int
+solver_installable(pkg_t *pkg)
+{
+     pkg_t *old;
+
+     if (pkg_is_installed(pkg))
+	  return 1;
+     if (pkg->arch_priority <= 0)
+	  return 0;
+
+     old = pkg_hash_fetch_installed_by_name(pkg->name);
+     if (old == NULL)
+	  return 1;
+     if (old->state_flag & SF_HOLD)
+	  return 0;
+
+     return conf->force_downgrade || pkg_compare_versions(pkg, old) >= 0;
+}
+
+/* The variable of pkg, added to the problem if add is set. -1 if it is
+ * not part of it. */
+static int
+solver_var(struct solver *sv, pkg_t *pkg, int add)
+{
+     intptr_t var = (intptr_t)ptr_map_get(&sv->vars, pkg);
+
+     if (var)
+	  return var - 1 < 0 ? -1 : var - 1;
+     if (!add)
+	  return -1;
+
+     if (!solver_installable(pkg)) {
+	  ptr_map_insert(&sv->vars, pkg, (void *)(intptr_t)-1);
+	  return -1;
+     }
+
+     var = sv->pkgs->len;
+     pkg_vec_insert(sv->pkgs, pkg);
+     ptr_map_insert(&sv->vars, pkg, (void *)(var + 1));
+
+     return var;
+}
+
+/* Appends to out the packages of the problem that satisfy depend. */
+static void
+solver_satisfiers(struct solver *sv, depend_t *depend, int add,
+		pkg_vec_t *out)
+{
+     abstract_pkg_vec_t *providers = depend->pkg->provided_by;
+     pkg_vec_t *vec;
+     pkg_t *pkg;
+     int i, j;
+
+     if (providers == NULL)
+	  return;
+
+     for (i = 0; i < providers->len; i++) {
+	  vec = providers->pkgs[i]->pkgs;
+	  if (vec == NULL)
+	       continue;
+	  for (j = 0; j < vec->len; j++) {
+	       pkg = vec->pkgs[j];
+	       if (pkg->parent != depend->pkg
+			       && !pkg_provides_abstract(pkg, depend->pkg))
+		    continue;
+	       if (!version_constraints_satisfied(depend, pkg))
+		    continue;
+	       if (solver_var(sv, pkg, add) >= 0)
+		    pkg_vec_insert(out, pkg);
+	  }
+     }
+}
+
+/* Whether the preferred choice for pkg is to leave it as it is. */
+static int
+solver_keeps(struct solver *sv, pkg_t *pkg)
+{
+     return !sv->newest && pkg_is_installed(pkg)
+	     && !ptr_map_contains(&sv->targets, pkg->parent);
+}
+
+static struct solver *sort_solver;
+
+static int
+solver_preference_compare(const void *a, const void *b)
+{
+     pkg_t *p = *(pkg_t **)a, *q = *(pkg_t **)b;
+     int r;
+
+     if (p->provided_by_hand != q->provided_by_hand)
+	  return q->provided_by_hand - p->provided_by_hand;
+
+     r = solver_keeps(sort_solver, q) - solver_keeps(sort_solver, p);
+     if (r)
+	  return r;
+
+     r = pkg_compare_versions(q, p);
+     if (r)
+	  return r;
+
+     return q->arch_priority - p->arch_priority;
+}
+
+static void
+solver_sort(struct solver *sv, pkg_vec_t *vec, int start)
+{
+     sort_solver = sv;
+     qsort(vec->pkgs + start, vec->len - start, sizeof(pkg_t *),
+		     solver_preference_compare);
+}
+
+/*
+ * Turns the packages in vec into the positive literals of a want, the
+ * kept ones first, without duplicates. Returns how many, or -1 if
+ * self, a package that satisfies the want by itself, is among them.
+ */
+static int
+solver_want_lits(struct solver *sv, pkg_vec_t *vec, pkg_t *self)
+{
+     int i, pass, var, n = 0;
+
+     for (pass = 0; pass < 2; pass++) {
+	  for (i = 0; i < vec->len; i++) {
+	       if (vec->pkgs[i] == self)
+		    return -1;
+	       if (solver_keeps(sv, vec->pkgs[i]) != !pass)
+		    continue;
+	       var = solver_var(sv, vec->pkgs[i], 0);
+	       if (sv->mark[var])
+		    continue;
+	       sv->mark[var] = 1;
+	       sv->want_lits[n++] = LIT(var, 0);
+	  }
+     }
+
+     for (i = 0; i < n; i++)
+	  sv->mark[LIT_VAR(sv->want_lits[i])] = 0;
+
+     return n;
+}
+
+/* The versions of ab_pkg in the problem, and whatever replaces it. */
+static void
+solver_versions(struct solver *sv, abstract_pkg_t *ab_pkg, pkg_t *replacee,
+		pkg_vec_t *out)
+{
+     abstract_pkg_vec_t *replacers = ab_pkg->replaced_by;
+     pkg_vec_t *vec;
+     int i, j;
+
+     if (ab_pkg->pkgs)
+	  for (i = 0; i < ab_pkg->pkgs->len; i++)
+	       if (solver_var(sv, ab_pkg->pkgs->pkgs[i], 0) >= 0)
+		    pkg_vec_insert(out, ab_pkg->pkgs->pkgs[i]);
+     solver_sort(sv, out, 0);
+
+     if (replacee == NULL || replacers == NULL)
+	  return;
+
+     for (i = 0; i < replacers->len; i++) {
+	  vec = replacers->pkgs[i]->pkgs;
+	  for (j = 0; vec && j < vec->len; j++)
+	       if (solver_var(sv, vec->pkgs[j], 0) >= 0
+			       && pkg_replaces(vec->pkgs[j], replacee))
+		    pkg_vec_insert(out, vec->pkgs[j]);
+     }
+}
+
+static void
+solver_add_target(struct solver *sv, abstract_pkg_t *ab_pkg)
+{
+     if (ptr_map_contains(&sv->targets, ab_pkg))
+	  return;
+     ptr_map_insert(&sv->targets, ab_pkg, NULL);
+     abstract_pkg_vec_insert(sv->target_vec, ab_pkg);
+}
+
+static int
+depend_count(pkg_t *pkg)
+{
+     return pkg->pre_depends_count + pkg->depends_count
+	     + pkg->recommends_count + pkg->suggests_count;
+}
+
+/* Everything the targets and the installed packages may pull in. */
+static void
+solver_collect(struct solver *sv)
+{
+     compound_depend_t *cd;
+     pkg_t *pkg;
+     int i, j, k;
+
+     for (i = 0; i < sv->pkgs->len; i++) {
+	  pkg = sv->pkgs->pkgs[i];
+	  for (j = 0; j < depend_count(pkg); j++) {
+	       cd = &pkg->depends[j];
+	       if (cd->type != DEPEND && cd->type != PREDEPEND)
+		    continue;
+	       for (k = 0; k < cd->possibility_count; k++) {
+		    sv->scratch->len = 0;
+		    solver_satisfiers(sv, cd->possibilities[k], 1,
+				    sv->scratch);
+	       }
+	  }
+     }
+}
+
+static void
+solver_encode_request(struct solver *sv, pkg_vec_t *installed)
+{
+     struct sat *s = &sv->sat;
+     abstract_pkg_t *ab_pkg;
+     depend_t depend;
+     pkg_t *pkg;
+     int i, n;
+
+     memset(&depend, 0, sizeof(depend));
+     depend.constraint = NONE;
+
+     for (i = 0; i < sv->target_vec->len; i++) {
+	  ab_pkg = sv->target_vec->pkgs[i];
+	  sv->scratch->len = 0;
+	  depend.pkg = ab_pkg;
+	  solver_satisfiers(sv, &depend, 0, sv->scratch);
+	  solver_sort(sv, sv->scratch, 0);
+	  n = solver_want_lits(sv, sv->scratch, NULL);
+	  if (n <= 0)
+	       continue;	/* left for the install to complain about */
+	  sat_add_clause(s, sv->want_lits, n);
+	  sat_add_want(s, -1, sv->want_lits, n);
+     }
+
+     for (i = 0; i < installed->len; i++) {
+	  pkg = installed->pkgs[i];
+	  if (ptr_map_contains(&sv->targets, pkg->parent))
+	       continue;
+	  if (pkg->state_flag & SF_HOLD) {
+	       n = LIT(solver_var(sv, pkg, 0), 0);
+	       sat_add_clause(s, &n, 1);
+	       continue;
+	  }
+	  sv->scratch->len = 0;
+	  solver_versions(sv, pkg->parent, pkg, sv->scratch);
+	  n = solver_want_lits(sv, sv->scratch, NULL);
+	  sat_add_clause(s, sv->want_lits, n);
+	  sat_add_want(s, -1, sv->want_lits, n);
+     }
+}
+
+/* Whether one of the alternatives of cd is installed now. */
+static int
+solver_depend_installed(compound_depend_t *cd)
+{
+     int i;
+
+     for (i = 0; i < cd->possibility_count; i++)
+	  if (pkg_dependence_satisfied(cd->possibilities[i]))
+	       return 1;
+
+     return 0;
+}
+
+static void
+solver_encode_pkg(struct solver *sv, int var)
+{
+     struct sat *s = &sv->sat;
+     pkg_t *pkg = sv->pkgs->pkgs[var];
+     compound_depend_t *cd;
+     pkg_vec_t *vec;
+     pkg_t *other;
+     int i, j, k, n, start, other_var;
+
+     for (i = 0; i < depend_count(pkg); i++) {
+	  cd = &pkg->depends[i];
+	  if (cd->type != DEPEND && cd->type != PREDEPEND)
+	       continue;
+
+	  sv->scratch->len = 0;
+	  for (j = 0; j < cd->possibility_count; j++) {
+	       start = sv->scratch->len;
+	       solver_satisfiers(sv, cd->possibilities[j], 0, sv->scratch);
+	       solver_sort(sv, sv->scratch, start);
+	  }
+	  n = solver_want_lits(sv, sv->scratch, pkg);
+	  if (n < 0)
+	       continue;
+
+	  /* A dependency the installed system already has broken, say
+	   * after --force-depends, is mended if it can be, but must not
+	   * rule out keeping the package and so every plan. */
+	  if (pkg_is_installed(pkg) && !solver_depend_installed(cd)) {
+	       if (n)
+		    sat_add_want(s, LIT(var, 0), sv->want_lits, n);
+	       continue;
+	  }
+
+	  sv->lits[0] = LIT(var, 1);
+	  memcpy(sv->lits + 1, sv->want_lits, n * sizeof(int));
+	  sat_add_clause(s, sv->lits, n + 1);
+	  if (n)
+	       sat_add_want(s, LIT(var, 0), sv->want_lits, n);
+     }
+
+     for (i = 0; i < pkg->conflicts_count; i++) {
+	  cd = &pkg->conflicts[i];
+	  for (j = 0; j < cd->possibility_count; j++) {
+	       sv->scratch->len = 0;
+	       solver_satisfiers(sv, cd->possibilities[j], 0, sv->scratch);
+	       for (k = 0; k < sv->scratch->len; k++) {
+		    other = sv->scratch->pkgs[k];
+		    if (other == pkg || pkg_replaces(pkg, other))
+			 continue;
+		    sv->lits[0] = LIT(var, 1);
+		    sv->lits[1] = LIT(solver_var(sv, other, 0), 1);
+		    sat_add_clause(s, sv->lits, 2);
+	       }
+	  }
+     }
+
+     /* one version of each package */
+     vec = pkg->parent->pkgs;
+     for (i = 0; vec && i < vec->len; i++) {
+	  other_var = solver_var(sv, vec->pkgs[i], 0);
+	  if (other_var <= var)
+	       continue;
+	  sv->lits[0] = LIT(var, 1);
+	  sv->lits[1] = LIT(other_var, 1);
+	  sat_add_clause(s, sv->lits, 2);
+     }
+}
+
+int
+opkg_solver_plan(int argc, char **names, int upgrade)
+{
+     struct solver sv;
+     pkg_vec_t *installed;
+     abstract_pkg_t *ab_pkg;
+     pkg_t *pkg;
+     int i, j, err;
+
+     opkg_solver_clear();
+     if (conf->nodeps)
+	  return 0;
+
+     memset(&sv, 0, sizeof(sv));
+     sv.newest = conf->solver_policy
+	     && strcmp(conf->solver_policy, "newest") == 0;
+     sv.pkgs = pkg_vec_alloc();
+     sv.scratch = pkg_vec_alloc();
+     sv.target_vec = abstract_pkg_vec_alloc();
+     ptr_map_init(&sv.vars, 1024);
+     ptr_map_init(&sv.targets, 64);
+
+     installed = pkg_vec_alloc();
+     pkg_hash_fetch_all_installed(installed);
+
+     for (i = 0; i < argc; i++) {
+	  ab_pkg = abstract_pkg_fetch_by_name(names[i]);
+	  if (ab_pkg)
+	       solver_add_target(&sv, ab_pkg);
+     }
+     if (upgrade && argc == 0)
+	  for (i = 0; i < installed->len; i++)
+	       solver_add_target(&sv, installed->pkgs[i]->parent);
+
+     for (i = 0; i < installed->len; i++) {
+	  pkg = installed->pkgs[i];
+	  solver_var(&sv, pkg, 1);
+	  for (j = 0; pkg->parent->pkgs && j < pkg->parent->pkgs->len; j++)
+	       solver_var(&sv, pkg->parent->pkgs->pkgs[j], 1);
+     }
+     for (i = 0; i < sv.target_vec->len; i++) {
+	  depend_t depend;
+
+	  memset(&depend, 0, sizeof(depend));
+	  depend.constraint = NONE;
+	  depend.pkg = sv.target_vec->pkgs[i];
+	  sv.scratch->len = 0;
+	  solver_satisfiers(&sv, &depend, 1, sv.scratch);
+     }
+
+     solver_collect(&sv);
+
+     err = 0;
+     if (sv.pkgs->len) {
+	  sv.lits = xcalloc(sv.pkgs->len + 1, sizeof(int));
+	  sv.want_lits = xcalloc(sv.pkgs->len + 1, sizeof(int));
+	  sv.mark = xcalloc(sv.pkgs->len, 1);
+	  sat_init(&sv.sat, sv.pkgs->len);
+	  sv.sat.max_conflicts = conf->solver_max_conflicts > 0 ?
+		  conf->solver_max_conflicts : SOLVER_MAX_CONFLICTS;
+
+	  solver_encode_request(&sv, installed);
+	  for (i = 0; i < sv.pkgs->len; i++)
+	       solver_encode_pkg(&sv, i);
+
+	  err = sat_solve(&sv.sat);
+	  opkg_msg(DEBUG, "%d packages, %d clauses, %d conflicts.\n",
+			  sv.pkgs->len, sv.sat.n_clauses,
+			  sv.sat.conflicts);
+     }
+
+     if (err == -2) {
+	  opkg_msg(ERROR, "Gave up looking for an installation plan "
+			  "after %d conflicts.\n", sv.sat.conflicts);
+     } else if (err) {
+	  opkg_msg(ERROR, "No installation plan satisfies the "
+			  "dependencies of the request.\n");
+     } else {
+	  ptr_map_init(&plan, 2 * sv.pkgs->len);
+	  plan_active = 1;
+	  for (i = 0; i < sv.pkgs->len; i++) {
+	       if (sv.sat.value[i] <= 0)
+		    continue;
+	       pkg = sv.pkgs->pkgs[i];
+	       ptr_map_insert(&plan, pkg, NULL);
+	       if (!pkg_is_installed(pkg))
+		    opkg_msg(INFO, "Plan: install %s (%s).\n",
+				    pkg->name, pkg->version);
+	  }
+     }
+
+     if (sv.pkgs->len) {
+	  sat_deinit(&sv.sat);
+	  free(sv.lits);
+	  free(sv.want_lits);
+	  free(sv.mark);
+     }
+     ptr_map_deinit(&sv.vars);
+     ptr_map_deinit(&sv.targets);
+     abstract_pkg_vec_free(sv.target_vec);
+     pkg_vec_free(sv.scratch);
+     pkg_vec_free(sv.pkgs);
+     pkg_vec_free(installed);
+
+     return err;
+}
+
+int
+opkg_solver_chosen(pkg_t *pkg)
+{
+     return plan_active && ptr_map_contains(&plan, pkg);
+}
+
+void
+opkg_solver_clear(void)
+{
+     if (!plan_active)
+	  return;
+     ptr_map_deinit(&plan);
+     plan_active = 0;
+}
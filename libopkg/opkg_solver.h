@@ -0,0 +1,34 @@
+/* opkg_solver.h - the opkg package management system
+
+   Javier Palacios
+
+   Copyright (C) 2010 Javier Palacios
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#ifndef OPKG_SOLVER_H
+#define OPKG_SOLVER_H
+
+#include "pkg.h"
+
+/* Plans the install (or upgrade if upgrade is set) of the packages
+ * named in names, or of everything installed for an upgrade without
+ * names. Returns 0 if a plan was found, -1 if there is none and -2 if
+ * the search was given up after solver_max_conflicts conflicts. */
+int opkg_solver_plan(int argc, char **names, int upgrade);
+
+/* Whether the plan has pkg installed. */
+int opkg_solver_chosen(pkg_t *pkg);
+
+void opkg_solver_clear(void);
+
+#endif
@@ -77,6 +77,30 @@ opkg_upgrade_pkg(pkg_t *old)
     return opkg_install_pkg(new,1);
 }
 
+/*
+ * Starts fetching the new versions of pkgs that opkg_upgrade_pkg() is
+ * about to install, along with their new dependencies, so that the
+ * transfers overlap with unpacking.
+ */
+void
+opkg_upgrade_prefetch(pkg_vec_t *pkgs)
+{
+     pkg_t *old, *new;
+     int i;
+
+     for (i = 0; i < pkgs->len; i++) {
+          old = pkgs->pkgs[i];
+          if (old->state_flag & SF_HOLD)
+               continue;
+
+          new = pkg_hash_fetch_best_installation_candidate_by_name(old->name);
+          if (new == NULL || pkg_compare_versions(old, new) >= 0)
+               continue;
+
+          opkg_install_prefetch(new);
+     }
+}
+
 
 static void
 pkg_hash_check_installed_pkg_helper(const char *pkg_name, void *entry,
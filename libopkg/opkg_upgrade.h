@@ -17,6 +17,7 @@
 
 #include "active_list.h"
 int opkg_upgrade_pkg(pkg_t *old);
+void opkg_upgrade_prefetch(pkg_vec_t *pkgs);
 struct active_list * prepare_upgrade_list (void);
 
 #endif
@@ -26,6 +26,7 @@
 
 #include "pkg_parse.h"
 #include "pkg_extract.h"
+#include "file_index.h"
 #include "opkg_message.h"
 #include "opkg_utils.h"
 
@@ -71,13 +72,16 @@ static const enum_map_t pkg_state_status_map[] = {
      { SS_REMOVAL_FAILED, "removal-failed" }
 };
 
-static void
+void
 pkg_init(pkg_t *pkg)
 {
+     memset(pkg, 0, sizeof(pkg_t));
      pkg->name = NULL;
+     pkg->id = 0;
      pkg->epoch = 0;
      pkg->version = NULL;
      pkg->revision = NULL;
+     pkg->version_key = NULL;
      pkg->dest = NULL;
      pkg->src = NULL;
      pkg->architecture = NULL;
@@ -110,6 +114,7 @@ pkg_init(pkg_t *pkg)
      pkg->provides = NULL;
      pkg->filename = NULL;
      pkg->local_filename = NULL;
+     pkg->local_file_verified = 0;
      pkg->tmp_unpack_dir = NULL;
      pkg->md5sum = NULL;
 #if defined HAVE_SHA256
@@ -122,8 +127,10 @@ pkg_init(pkg_t *pkg)
      conffile_list_init(&pkg->conffiles);
      pkg->installed_files = NULL;
      pkg->installed_files_ref_cnt = 0;
+     pkg->data_file_names = NULL;
      pkg->essential = 0;
      pkg->provided_by_hand = 0;
+     pkg->strings_mapped = 0;
 }
 
 pkg_t *
@@ -131,62 +138,52 @@ pkg_new(void)
 {
      pkg_t *pkg;
 
-     pkg = xcalloc(1, sizeof(pkg_t));
+     pkg = arena_alloc(&conf->pkg_arena, sizeof(pkg_t));
      pkg_init(pkg);
 
      return pkg;
 }
 
 static void
-compound_depend_deinit(compound_depend_t *depends)
+pkg_free_str(pkg_t *pkg, char *str)
 {
-    int i;
-    for (i = 0; i < depends->possibility_count; i++)
-    {
-        depend_t *d;
-        d = depends->possibilities[i];
-        free (d->version);
-        free (d);
-    }
-    free (depends->possibilities);
+	if (str == NULL)
+		return;
+	if (pkg->strings_mapped && pkg_parse_buffer_contains(str))
+		return;
+	free(str);
 }
 
 void
 pkg_deinit(pkg_t *pkg)
 {
-	int i;
-
-	if (pkg->name)
-		free(pkg->name);
+	pkg_free_str(pkg, pkg->name);
 	pkg->name = NULL;
 
 	pkg->epoch = 0;
 
-	if (pkg->version)
-		free(pkg->version);
+	pkg_free_str(pkg, pkg->version);
 	pkg->version = NULL;
 	/* revision shares storage with version, so don't free */
 	pkg->revision = NULL;
+	/* in conf->pkg_arena */
+	pkg->version_key = NULL;
 
 	/* owned by opkg_conf_t */
 	pkg->dest = NULL;
 	/* owned by opkg_conf_t */
 	pkg->src = NULL;
 
-	if (pkg->architecture)
-		free(pkg->architecture);
+	/* interned, see str_atom() */
 	pkg->architecture = NULL;
 
-	if (pkg->maintainer)
-		free(pkg->maintainer);
+	/* interned, see str_atom() */
 	pkg->maintainer = NULL;
 
-	if (pkg->section)
-		free(pkg->section);
+	/* interned, see str_atom() */
 	pkg->section = NULL;
 
-	if (pkg->description)
-		free(pkg->description);
+	pkg_free_str(pkg, pkg->description);
 	pkg->description = NULL;
 	
 	pkg->state_want = SW_UNKNOWN;
@@ -195,35 +192,16 @@ pkg_deinit(pkg_t *pkg)
 
 	active_list_clear(&pkg->list);
 
-	if (pkg->replaces)
-		free (pkg->replaces);
+	/* dependency arrays live in conf->pkg_arena */
 	pkg->replaces = NULL;
-
-	if (pkg->depends) {
-		int count = pkg->pre_depends_count
-				+ pkg->depends_count
-				+ pkg->recommends_count
-				+ pkg->suggests_count;
-
-		for (i=0; i<count; i++)
-			compound_depend_deinit (&pkg->depends[i]);
-		free (pkg->depends);
-	}
-
-	if (pkg->conflicts) {
-		for (i=0; i<pkg->conflicts_count; i++)
-			compound_depend_deinit (&pkg->conflicts[i]);
-		free (pkg->conflicts);
-	}
-
-	if (pkg->provides)
-		free (pkg->provides);
+	pkg->depends = NULL;
+	pkg->conflicts = NULL;
+	pkg->provides = NULL;
 
 	pkg->pre_depends_count = 0;
 	pkg->provides_count = 0;
 	
-	if (pkg->filename)
-		free(pkg->filename);
+	pkg_free_str(pkg, pkg->filename);
 	pkg->filename = NULL;
 	
 	if (pkg->local_filename)
@@ -237,22 +215,18 @@ pkg_deinit(pkg_t *pkg)
 		free(pkg->tmp_unpack_dir);
 	pkg->tmp_unpack_dir = NULL;
 
-	if (pkg->md5sum)
-		free(pkg->md5sum);
+	pkg_free_str(pkg, pkg->md5sum);
 	pkg->md5sum = NULL;
 
 #if defined HAVE_SHA256
-	if (pkg->sha256sum)
-		free(pkg->sha256sum);
+	pkg_free_str(pkg, pkg->sha256sum);
 	pkg->sha256sum = NULL;
 #endif
 
-	if (pkg->priority)
-		free(pkg->priority);
+	/* interned, see str_atom() */
 	pkg->priority = NULL;
 
-	if (pkg->source)
-		free(pkg->source);
+	/* interned, see str_atom() */
 	pkg->source = NULL;
 
 	conffile_list_deinit(&pkg->conffiles);
@@ -262,10 +236,19 @@ pkg_deinit(pkg_t *pkg)
 	assertion here instead? */
 	pkg->installed_files_ref_cnt = 1;
 	pkg_free_installed_files(pkg);
+
+	if (pkg->data_file_names)
+		str_list_purge(pkg->data_file_names);
+	pkg->data_file_names = NULL;
+
+	if (pkg->owned_files) {
+		ptr_map_deinit(pkg->owned_files);
+		free(pkg->owned_files);
+		pkg->owned_files = NULL;
+	}
 	pkg->essential = 0;
 
-	if (pkg->tags)
-		free (pkg->tags);
+	pkg_free_str(pkg, pkg->tags);
 	pkg->tags = NULL;
 }
 
@@ -343,13 +326,13 @@ pkg_merge(pkg_t *oldpkg, pkg_t *newpkg)
      if (!oldpkg->dest)
 	  oldpkg->dest = newpkg->dest;
      if (!oldpkg->architecture)
-	  oldpkg->architecture = xstrdup(newpkg->architecture);
+	  oldpkg->architecture = newpkg->architecture;
      if (!oldpkg->arch_priority)
 	  oldpkg->arch_priority = newpkg->arch_priority;
      if (!oldpkg->section)
-	  oldpkg->section = xstrdup(newpkg->section);
+	  oldpkg->section = newpkg->section;
      if(!oldpkg->maintainer)
-	  oldpkg->maintainer = xstrdup(newpkg->maintainer);
+	  oldpkg->maintainer = newpkg->maintainer;
      if(!oldpkg->description)
 	  oldpkg->description = xstrdup(newpkg->description);
 
@@ -413,9 +396,9 @@ pkg_merge(pkg_t *oldpkg, pkg_t *newpkg)
      if (!oldpkg->installed_size)
 	  oldpkg->installed_size = newpkg->installed_size;
      if (!oldpkg->priority)
-	  oldpkg->priority = xstrdup(newpkg->priority);
+	  oldpkg->priority = newpkg->priority;
      if (!oldpkg->source)
-	  oldpkg->source = xstrdup(newpkg->source);
+	  oldpkg->source = newpkg->source;
 
      if (nv_pair_list_empty(&oldpkg->conffiles)){
 	  list_splice_init(&newpkg->conffiles.head, &oldpkg->conffiles.head);
@@ -427,6 +410,11 @@ pkg_merge(pkg_t *oldpkg, pkg_t *newpkg)
 	  newpkg->installed_files = NULL;
      }
 
+     if (!oldpkg->data_file_names){
+	  oldpkg->data_file_names = newpkg->data_file_names;
+	  newpkg->data_file_names = NULL;
+     }
+
      if (!oldpkg->essential)
 	  oldpkg->essential = newpkg->essential;
 
@@ -436,9 +424,13 @@ pkg_merge(pkg_t *oldpkg, pkg_t *newpkg)
 static void
 abstract_pkg_init(abstract_pkg_t *ab_pkg)
 {
+     ab_pkg->id = 0;
      ab_pkg->provided_by = abstract_pkg_vec_alloc();
      ab_pkg->dependencies_checked = 0;
      ab_pkg->state_status = SS_NOT_INSTALLED;
+     ab_pkg->candidates = NULL;
+     ab_pkg->candidates_serial = 0;
+     ab_pkg->candidates_wrong_arch = 0;
 }
 
 abstract_pkg_t *
@@ -446,7 +438,7 @@ abstract_pkg_new(void)
 {
      abstract_pkg_t * ab_pkg;
 
-     ab_pkg = xcalloc(1, sizeof(abstract_pkg_t));
+     ab_pkg = arena_alloc(&conf->pkg_arena, sizeof(abstract_pkg_t));
      abstract_pkg_init(ab_pkg);
 
      return ab_pkg;
@@ -893,71 +885,27 @@ pkg_print_status(pkg_t * pkg, FILE * file)
      fputs("\n", file);
 }
 
-/*
- * libdpkg - Debian packaging suite library routines
- * vercmp.c - comparison of version numbers
- *
- * Copyright (C) 1995 Ian Jackson <iwj10@cus.cam.ac.uk>
- */
+/* The key is cached in the package, which is why a const pkg_t will do. */
+const version_key_t *
+pkg_version_key(const pkg_t *pkg)
+{
+     pkg_t *p = (pkg_t *)pkg;
 
-/* assume ascii; warning: evaluates x multiple times! */
-#define order(x) ((x) == '~' ? -1 \
-		: isdigit((x)) ? 0 \
-		: !(x) ? 0 \
-		: isalpha((x)) ? (x) \
-		: (x) + 256)
-
-static int
-verrevcmp(const char *val, const char *ref) {
-  if (!val) val= "";
-  if (!ref) ref= "";
-
-  while (*val || *ref) {
-    int first_diff= 0;
-
-    while ( (*val && !isdigit(*val)) || (*ref && !isdigit(*ref)) ) {
-      int vc= order(*val), rc= order(*ref);
-      if (vc != rc) return vc - rc;
-      val++; ref++;
-    }
-
-    while ( *val == '0' ) val++;
-    while ( *ref == '0' ) ref++;
-    while (isdigit(*val) && isdigit(*ref)) {
-      if (!first_diff) first_diff= *val - *ref;
-      val++; ref++;
-    }
-    if (isdigit(*val)) return 1;
-    if (isdigit(*ref)) return -1;
-    if (first_diff) return first_diff;
-  }
-  return 0;
+     if (p->version_key == NULL)
+	  p->version_key = version_key_new(&conf->pkg_arena,
+			  p->epoch, p->version, p->revision);
+
+     return p->version_key;
 }
 
 int
 pkg_compare_versions(const pkg_t *pkg, const pkg_t *ref_pkg)
 {
-     int r;
-
-     if (pkg->epoch > ref_pkg->epoch) {
-	  return 1;
-     }
-
-     if (pkg->epoch < ref_pkg->epoch) {
-	  return -1;
-     }
-
-     r = verrevcmp(pkg->version, ref_pkg->version);
-     if (r) {
-	  return r;
-     }
-
-     r = verrevcmp(pkg->revision, ref_pkg->revision);
-     if (r) {
-	  return r;
-     }
+     if (pkg == ref_pkg)
+	  return 0;
 
-     return r;
+     return version_key_compare(pkg_version_key(pkg),
+		     pkg_version_key(ref_pkg));
 }
 
 
@@ -1061,14 +1009,43 @@ pkg_version_str_alloc(pkg_t *pkg)
 }
 
 /*
- * XXX: this should be broken into two functions
+ * Read the names of the files in the data member of pkg->local_filename
+ * into pkg->data_file_names. With control_dir, the control files are
+ * unpacked there in the same pass through the package.
  */
+int
+pkg_read_data_file_names(pkg_t *pkg, const char *control_dir)
+{
+     str_list_t *names;
+     int err;
+
+     names = str_list_alloc();
+
+     if (control_dir)
+	  err = pkg_extract_control_files_and_data_file_names(pkg,
+			  control_dir, names);
+     else
+	  err = pkg_extract_data_file_names(pkg, names);
+     if (err) {
+	  opkg_msg(ERROR, "Error extracting file list from %s.\n",
+			  pkg->local_filename);
+	  str_list_purge(names);
+	  return -1;
+     }
+
+     if (pkg->data_file_names)
+	  str_list_purge(pkg->data_file_names);
+     pkg->data_file_names = names;
+
+     return 0;
+}
+
 str_list_t *
 pkg_get_installed_files(pkg_t *pkg)
 {
-     int err, fd;
-     char *list_file_name = NULL;
+     str_list_elt_t *iter;
      FILE *list_file = NULL;
+     char *list_file_name;
      char *line;
      char *installed_file_name;
      unsigned int rootdirlen = 0;
@@ -1088,52 +1065,42 @@ pkg_get_installed_files(pkg_t *pkg)
 	  if (pkg->local_filename == NULL) {
 	       return pkg->installed_files;
 	  }
-	  /* XXX: CLEANUP: Maybe rewrite this to avoid using a temporary
-	     file. In other words, change deb_extract so that it can
-	     simply return the file list as a char *[] rather than
-	     insisting on writing in to a FILE * as it does now. */
-	  sprintf_alloc(&list_file_name, "%s/%s.list.XXXXXX",
-					  conf->tmp_dir, pkg->name);
-	  fd = mkstemp(list_file_name);
-	  if (fd == -1) {
-	       opkg_perror(ERROR, "Failed to make temp file %s.",
-			       list_file_name);
-	       free(list_file_name);
-	       return pkg->installed_files;
-	  }
-	  list_file = fdopen(fd, "r+");
-	  if (list_file == NULL) {
-	       opkg_perror(ERROR, "Failed to fdopen temp file %s.",
-			       list_file_name);
-	       close(fd);
-	       unlink(list_file_name);
-	       free(list_file_name);
-	       return pkg->installed_files;
-	  }
-	  err = pkg_extract_data_file_names_to_stream(pkg, list_file);
-	  if (err) {
-	       opkg_msg(ERROR, "Error extracting file list from %s.\n",
-			       pkg->local_filename);
-	       fclose(list_file);
-	       unlink(list_file_name);
-	       free(list_file_name);
-	       str_list_deinit(pkg->installed_files);
+	  if (pkg->data_file_names == NULL
+		  && pkg_read_data_file_names(pkg, NULL)) {
+	       str_list_purge(pkg->installed_files);
 	       pkg->installed_files = NULL;
 	       return NULL;
 	  }
-	  rewind(list_file);
-     } else {
-	  sprintf_alloc(&list_file_name, "%s/%s.list",
-			pkg->dest->info_dir, pkg->name);
-	  list_file = fopen(list_file_name, "r");
-	  if (list_file == NULL) {
-	       opkg_perror(ERROR, "Failed to open %s",
-		       list_file_name);
-	       free(list_file_name);
-	       return pkg->installed_files;
+
+	  for (iter = str_list_first(pkg->data_file_names); iter;
+		  iter = str_list_next(pkg->data_file_names, iter)) {
+	       char *file_name = (char *) iter->data;
+
+	       if (*file_name == '.') {
+		    file_name++;
+	       }
+	       if (*file_name == '/') {
+		    file_name++;
+	       }
+	       sprintf_alloc(&installed_file_name, "%s%s",
+			       pkg->dest->root_dir, file_name);
+	       str_list_append(pkg->installed_files, installed_file_name);
+	       free(installed_file_name);
 	  }
+
+	  return pkg->installed_files;
+     }
+
+     sprintf_alloc(&list_file_name, "%s/%s.list",
+		     pkg->dest->info_dir, pkg->name);
+     list_file = fopen(list_file_name, "r");
+     if (list_file == NULL) {
+	  opkg_perror(ERROR, "Failed to open %s",
+		  list_file_name);
 	  free(list_file_name);
+	  return pkg->installed_files;
      }
+     free(list_file_name);
 
      if (conf->offline_root)
           rootdirlen = strlen(conf->offline_root);
@@ -1147,24 +1114,13 @@ pkg_get_installed_files(pkg_t *pkg)
 	  }
 	  file_name = line;
 
-	  if (pkg->state_status == SS_NOT_INSTALLED || pkg->dest == NULL) {
-	       if (*file_name == '.') {
-		    file_name++;
-	       }
-	       if (*file_name == '/') {
-		    file_name++;
-	       }
+	  if (conf->offline_root &&
+		  strncmp(conf->offline_root, file_name, rootdirlen)) {
 	       sprintf_alloc(&installed_file_name, "%s%s",
-			       pkg->dest->root_dir, file_name);
+			       conf->offline_root, file_name);
 	  } else {
-	       if (conf->offline_root &&
-	               strncmp(conf->offline_root, file_name, rootdirlen)) {
-	            sprintf_alloc(&installed_file_name, "%s%s",
-				    conf->offline_root, file_name);
-	       } else {
-	            // already contains root_dir as header -> ABSOLUTE
-	            sprintf_alloc(&installed_file_name, "%s", file_name);
-	       }
+	       // already contains root_dir as header -> ABSOLUTE
+	       sprintf_alloc(&installed_file_name, "%s", file_name);
 	  }
 	  str_list_append(pkg->installed_files, installed_file_name);
           free(installed_file_name);
@@ -1173,11 +1129,6 @@ pkg_get_installed_files(pkg_t *pkg)
 
      fclose(list_file);
 
-     if (pkg->state_status == SS_NOT_INSTALLED || pkg->dest == NULL) {
-	  unlink(list_file_name);
-	  free(list_file_name);
-     }
-
      return pkg->installed_files;
 }
 
@@ -1215,6 +1166,24 @@ pkg_remove_installed_files_list(pkg_t *pkg)
 	free(list_file_name);
 }
 
+void
+pkg_add_owned_file(pkg_t *pkg, const char *file_name)
+{
+	if (pkg->owned_files == NULL) {
+		pkg->owned_files = xcalloc(1, sizeof(ptr_map_t));
+		ptr_map_init(pkg->owned_files, 16);
+	}
+
+	ptr_map_insert(pkg->owned_files, file_name, NULL);
+}
+
+void
+pkg_remove_owned_file(pkg_t *pkg, const char *file_name)
+{
+	if (pkg->owned_files)
+		ptr_map_remove(pkg->owned_files, file_name);
+}
+
 conffile_t *
 pkg_get_conffile(pkg_t *pkg, const char *file_name)
 {
@@ -1320,11 +1289,75 @@ pkg_arch_supported(pkg_t *pkg)
      return 0;
 }
 
+/* Checks file_name against the md5sum and sha256sum of pkg in the index. */
+int
+pkg_verify_file(pkg_t *pkg, const char *file_name)
+{
+     char *file_md5;
+#ifdef HAVE_SHA256
+     char *file_sha256;
+#endif
+
+     /* Check for md5 values */
+     if (pkg->md5sum)
+     {
+         file_md5 = file_md5sum_alloc(file_name);
+         if (file_md5 && strcmp(file_md5, pkg->md5sum))
+         {
+              opkg_msg(ERROR, "Package %s md5sum mismatch. "
+			"Either the opkg or the package index are corrupt. "
+			"Try 'opkg update'.\n",
+			pkg->name);
+              free(file_md5);
+              return -1;
+         }
+	 if (file_md5)
+              free(file_md5);
+     }
+
+#ifdef HAVE_SHA256
+     /* Check for sha256 value */
+     if(pkg->sha256sum)
+     {
+         file_sha256 = file_sha256sum_alloc(file_name);
+         if (file_sha256 && strcmp(file_sha256, pkg->sha256sum))
+         {
+              opkg_msg(ERROR, "Package %s sha256sum mismatch. "
+			"Either the opkg or the package index are corrupt. "
+			"Try 'opkg update'.\n",
+			pkg->name);
+              free(file_sha256);
+              return -1;
+         }
+	 if (file_sha256)
+              free(file_sha256);
+     }
+#endif
+
+     return 0;
+}
+
+/* Checks local_filename against the md5sum and sha256sum of the index. */
+int
+pkg_verify_archive(pkg_t *pkg)
+{
+     if (!pkg->local_file_verified)
+	  pkg->local_file_verified =
+		  pkg_verify_file(pkg, pkg->local_filename) ? -1 : 1;
+
+     return pkg->local_file_verified > 0 ? 0 : -1;
+}
+
 void
 pkg_info_preinstall_check(void)
 {
      int i;
-     pkg_vec_t *installed_pkgs = pkg_vec_alloc();
+     pkg_vec_t *installed_pkgs;
+
+     if (file_index_load() == 0)
+	  return;
+
+     installed_pkgs = pkg_vec_alloc();
 
      /* update the file owner data structure */
      opkg_msg(INFO, "Updating file owner list.\n");
@@ -1346,28 +1379,27 @@ pkg_info_preinstall_check(void)
 	  }
 	  pkg_free_installed_files(pkg);
      }
+
+     if (i == installed_pkgs->len) {
+	  file_index_scanned();
+	  file_index_write();
+     }
+
      pkg_vec_free(installed_pkgs);
 }
 
-struct pkg_write_filelist_data {
-     pkg_t *pkg;
-     FILE *stream;
-};
-
 static void
-pkg_write_filelist_helper(const char *key, void *entry_, void *data_)
+pkg_write_filelist_helper(const void *key, void *entry, void *data)
 {
-     struct pkg_write_filelist_data *data = data_;
-     pkg_t *entry = entry_;
-     if (entry == data->pkg) {
-	  fprintf(data->stream, "%s\n", key);
-     }
+     FILE *stream = data;
+
+     fprintf(stream, "%s\n", (const char *)key);
 }
 
 int
 pkg_write_filelist(pkg_t *pkg)
 {
-	struct pkg_write_filelist_data data;
+	FILE *stream;
 	char *list_file_name;
 
 	sprintf_alloc(&list_file_name, "%s/%s.list",
@@ -1376,17 +1408,18 @@ pkg_write_filelist(pkg_t *pkg)
 	opkg_msg(INFO, "Creating %s file for pkg %s.\n",
 			list_file_name, pkg->name);
 
-	data.stream = fopen(list_file_name, "w");
-	if (!data.stream) {
+	stream = fopen(list_file_name, "w");
+	if (!stream) {
 		opkg_perror(ERROR, "Failed to open %s",
 			list_file_name);
 		free(list_file_name);
 		return -1;
 	}
 
-	data.pkg = pkg;
-	hash_table_foreach(&conf->file_hash, pkg_write_filelist_helper, &data);
-	fclose(data.stream);
+	file_index_load_pkg(pkg);
+
+	ptr_map_foreach(pkg->owned_files, pkg_write_filelist_helper, stream);
+	fclose(stream);
 	free(list_file_name);
 
 	pkg->state_flag &= ~SF_FILELIST_CHANGED;
@@ -1417,5 +1450,8 @@ pkg_write_changed_filelists(void)
 
 	pkg_vec_free (installed_pkgs);
 
+	if (file_index_write())
+		ret = -1;
+
 	return ret;
 }
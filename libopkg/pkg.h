@@ -29,6 +29,8 @@
 #include "pkg_dest.h"
 #include "opkg_conf.h"
 #include "conffile_list.h"
+#include "version_key.h"
+#include "ptr_map.h"
 
 struct opkg_conf;
 
@@ -81,6 +83,8 @@ typedef enum pkg_state_status pkg_state_status_t;
 
 struct abstract_pkg{
     char * name;
+    /* dense from 1, given by the package hash, see id_set_t */
+    unsigned int id;
     int dependencies_checked;
     pkg_vec_t * pkgs;
     pkg_state_status_t state_status;
@@ -91,6 +95,12 @@ struct abstract_pkg{
 
     abstract_pkg_vec_t * provided_by;
     abstract_pkg_vec_t * replaced_by;
+
+    /* Installation candidates in preference order, valid while
+     * candidates_serial matches the package hash. */
+    pkg_vec_t * candidates;
+    unsigned int candidates_serial;
+    int candidates_wrong_arch;
 };
 
 #include "pkg_depends.h"
@@ -118,9 +128,13 @@ struct abstract_pkg{
 struct pkg
 {
      char *name;
+     /* dense from 1 once in the package hash, 0 before */
+     unsigned int id;
      unsigned long epoch;
      char *version;
      char *revision;
+     /* built on first comparison, see pkg_version_key() */
+     version_key_t *version_key;
      pkg_src_t *src;
      pkg_dest_t *dest;
      char *architecture;
@@ -158,6 +172,9 @@ struct pkg
 
      char *filename;
      char *local_filename;
+     /* 1 when local_filename passed pkg_verify_archive() or came from
+	the cache, -1 when it failed it */
+     int local_file_verified;
      char *tmp_unpack_dir;
      char *md5sum;
 #if defined HAVE_SHA256
@@ -176,6 +193,12 @@ struct pkg
 	installed_files list was being freed from an inner loop while
 	still being used within an outer loop. */
      int installed_files_ref_cnt;
+     /* names in the data member of local_filename, read only once for
+	a package being installed, see pkg_read_data_file_names() */
+     str_list_t *data_file_names;
+     /* paths mapped to this package in file_hash, as the keys file_hash
+	keeps, see file_hash_set_file_owner() */
+     ptr_map_t *owned_files;
      int essential;
      int arch_priority;
 /* Adding this flag, to "force" opkg to choose a "provided_by_hand" package, if there are multiple choice */
@@ -184,9 +207,17 @@ struct pkg
      /* this flag specifies whether the package was installed to satisfy another
       * package's dependancies */
      int auto_installed;
+
+     /* string fields point into a buffer from pkg_parse_buffer_open()
+      * and must not be freed */
+     int strings_mapped;
 };
 
 pkg_t *pkg_new(void);
+/* Sets up pkg the way pkg_new() does, for a pkg_t on the stack or one
+ * that is reused. One that was in use has to go through pkg_deinit()
+ * first. */
+void pkg_init(pkg_t *pkg);
 void pkg_deinit(pkg_t *pkg);
 int pkg_init_from_file(pkg_t *pkg, const char *filename);
 abstract_pkg_t *abstract_pkg_new(void);
@@ -199,6 +230,7 @@ int pkg_merge(pkg_t *oldpkg, pkg_t *newpkg);
 
 char *pkg_version_str_alloc(pkg_t *pkg);
 
+const version_key_t *pkg_version_key(const pkg_t *pkg);
 int pkg_compare_versions(const pkg_t *pkg, const pkg_t *ref_pkg);
 int pkg_name_version_and_architecture_compare(const void *a, const void *b);
 int abstract_pkg_name_compare(const void *a, const void *b);
@@ -209,9 +241,13 @@ void pkg_formatted_field(FILE *fp, pkg_t *pkg, const char *field);
 void set_flags_from_control(pkg_t *pkg);
 
 void pkg_print_status(pkg_t * pkg, FILE * file);
+int pkg_read_data_file_names(pkg_t *pkg, const char *control_dir);
 str_list_t *pkg_get_installed_files(pkg_t *pkg);
 void pkg_free_installed_files(pkg_t *pkg);
 void pkg_remove_installed_files_list(pkg_t *pkg);
+/* file_name has to be the key conf->file_hash keeps for the file. */
+void pkg_add_owned_file(pkg_t *pkg, const char *file_name);
+void pkg_remove_owned_file(pkg_t *pkg, const char *file_name);
 conffile_t *pkg_get_conffile(pkg_t *pkg, const char *file_name);
 int pkg_run_script(pkg_t *pkg, const char *script, const char *args);
 
@@ -223,6 +259,8 @@ pkg_state_status_t pkg_state_status_from_str(const char *str);
 int pkg_version_satisfied(pkg_t *it, pkg_t *ref, const char *op);
 
 int pkg_arch_supported(pkg_t *pkg);
+int pkg_verify_file(pkg_t *pkg, const char *file_name);
+int pkg_verify_archive(pkg_t *pkg);
 void pkg_info_preinstall_check(void);
 
 int pkg_write_filelist(pkg_t *pkg);
@@ -24,13 +24,16 @@
 #include "opkg_message.h"
 #include "pkg_parse.h"
 #include "hash_table.h"
+#include "ptr_map.h"
+#include "id_set.h"
+#include "str_atom.h"
+#include "opkg_solver.h"
 #include "libbb/libbb.h"
 
 static int parseDepends(compound_depend_t *compound_depend, char * depend_str);
 static depend_t * depend_init(void);
 static char ** add_unresolved_dep(pkg_t * pkg, char ** the_lost, int ref_ndx);
 static char ** merge_unresolved(char ** oldstuff, char ** newstuff);
-static int is_pkg_in_pkg_vec(pkg_vec_t * vec, pkg_t * pkg);
 
 static int pkg_installed_and_constraint_satisfied(pkg_t *pkg, void *cdata)
 {
@@ -50,10 +53,120 @@ static int pkg_constraint_satisfied(pkg_t *pkg, void *cdata)
 	  return 0;
 }
 
-/* returns ndependencies or negative error value */ 
-int
-pkg_hash_fetch_unsatisfied_dependencies(pkg_t * pkg, pkg_vec_t *unsatisfied,
-		char *** unresolved)
+/*
+ * The state of one dependency resolution. Each abstract package
+ * reached keeps the candidates picked for its depends, so a library
+ * needed by hundreds of packages is looked up once per constraint, and
+ * members tells in constant time whether a package is already in the
+ * result.
+ */
+struct resolve_pick {
+     version_constraint_t constraint;
+     const char *version;
+     int installed;
+     pkg_t *pkg;
+     struct resolve_pick *next;
+};
+
+struct resolve_ctx {
+     ptr_map_t *picks;		/* abstract_pkg_t -> struct resolve_pick */
+     ptr_map_t members;		/* pkg_t in order */
+     pkg_vec_t *order;		/* the result, depends before dependents */
+};
+
+static void
+resolve_init(struct resolve_ctx *ctx, ptr_map_t *picks, pkg_vec_t *order)
+{
+     int i;
+
+     ctx->picks = picks;
+     ctx->order = order;
+     ptr_map_init(&ctx->members, 2 * order->len);
+     for (i = 0; i < order->len; i++)
+	  ptr_map_insert(&ctx->members, order->pkgs[i], NULL);
+}
+
+static void
+resolve_picks_free_helper(const void *key, void *entry, void *data)
+{
+     struct resolve_pick *pick, *next;
+
+     for (pick = entry; pick; pick = next) {
+	  next = pick->next;
+	  free(pick);
+     }
+}
+
+static void
+resolve_picks_free(ptr_map_t *picks)
+{
+     ptr_map_foreach(picks, resolve_picks_free_helper, NULL);
+     ptr_map_deinit(picks);
+}
+
+/* The best candidate for depend, among the installed packages only if
+ * installed is set. */
+static pkg_t *
+resolve_candidate(struct resolve_ctx *ctx, depend_t *depend, int installed)
+{
+     int (*constraint_fcn)(pkg_t *pkg, void *cdata);
+     struct resolve_pick *head, *pick;
+     pkg_t *pkg;
+
+     head = ptr_map_get(ctx->picks, depend->pkg);
+     for (pick = head; pick; pick = pick->next) {
+	  if (pick->installed == installed
+	      && pick->constraint == depend->constraint
+	      && (pick->version == depend->version
+		  || (pick->version && depend->version
+		      && strcmp(pick->version, depend->version) == 0)))
+	       return pick->pkg;
+     }
+
+     constraint_fcn = installed ? pkg_installed_and_constraint_satisfied
+			       : pkg_constraint_satisfied;
+     pkg = pkg_hash_fetch_best_installation_candidate(depend->pkg,
+		     constraint_fcn, depend, 1);
+     /* Being that I can't test constraing in pkg_hash, I will test it here */
+     if (pkg && !constraint_fcn(pkg, depend))
+	  pkg = NULL;
+
+     pick = xcalloc(1, sizeof(*pick));
+     pick->constraint = depend->constraint;
+     pick->version = depend->version;
+     pick->installed = installed;
+     pick->pkg = pkg;
+     pick->next = head;
+     ptr_map_insert(ctx->picks, depend->pkg, pick);
+
+     return pkg;
+}
+
+/* The satisfier of compound_depend the solver plan installs, if a plan
+ * is active and has one. It wins over the first alternative that merely
+ * has a candidate, which may be one the plan ruled out. */
+static pkg_t *
+resolve_planned(struct resolve_ctx *ctx, compound_depend_t *compound_depend)
+{
+     pkg_t *satisfier;
+     int j;
+
+     if (compound_depend->type != DEPEND
+		     && compound_depend->type != PREDEPEND)
+	  return NULL;
+
+     for (j = 0; j < compound_depend->possibility_count; j++) {
+	  satisfier = resolve_candidate(ctx,
+			  compound_depend->possibilities[j], 0);
+	  if (satisfier && opkg_solver_chosen(satisfier))
+	       return satisfier;
+     }
+
+     return NULL;
+}
+
+static char **
+resolve_depends(struct resolve_ctx *ctx, pkg_t *pkg)
 {
      pkg_t * satisfier_entry_pkg;
      int i, j, k;
@@ -67,12 +180,10 @@ pkg_hash_fetch_unsatisfied_dependencies(pkg_t * pkg, pkg_vec_t *unsatisfied,
       */
      if (!(ab_pkg = pkg->parent)) {
 	  opkg_msg(ERROR, "Internal error, with pkg %s.\n", pkg->name);
-	  *unresolved = NULL;
-	  return 0;
+	  return NULL;
      }
      if (ab_pkg->dependencies_checked) {    /* avoid duplicate or cyclic checks */
-	  *unresolved = NULL;
-	  return 0;
+	  return NULL;
      } else { 
 	  ab_pkg->dependencies_checked = 1;  /* mark it for subsequent visits */
      }
@@ -80,8 +191,7 @@ pkg_hash_fetch_unsatisfied_dependencies(pkg_t * pkg, pkg_vec_t *unsatisfied,
 
      count = pkg->pre_depends_count + pkg->depends_count + pkg->recommends_count + pkg->suggests_count;
      if (!count){
-	  *unresolved = NULL;
-	  return 0;
+	  return NULL;
      }
 
      the_lost = NULL;
@@ -115,18 +225,18 @@ pkg_hash_fetch_unsatisfied_dependencies(pkg_t * pkg, pkg_vec_t *unsatisfied,
 			      /* not installed, and not already known about? */
 			      if ((pkg_scout->state_want != SW_INSTALL)
 				  && !pkg_scout->parent->dependencies_checked
-				  && !is_pkg_in_pkg_vec(unsatisfied, pkg_scout)) {
+				  && !ptr_map_contains(&ctx->members, pkg_scout)) {
 				   char ** newstuff = NULL;
-				   int rc;
+				   struct resolve_ctx trial;
 				   pkg_vec_t *tmp_vec = pkg_vec_alloc ();
 				   /* check for not-already-installed dependencies */
-				   rc = pkg_hash_fetch_unsatisfied_dependencies(pkg_scout,
-										tmp_vec,
-										&newstuff);
+				   resolve_init(&trial, ctx->picks, tmp_vec);
+				   newstuff = resolve_depends(&trial, pkg_scout);
+				   ptr_map_deinit(&trial.members);
 				   if (newstuff == NULL) {
 					int m;
 					int ok = 1;
-					for (m = 0; m < rc; m++) {
+					for (m = 0; m < tmp_vec->len; m++) {
 					    pkg_t *p = tmp_vec->pkgs[m];
 					    if (p->state_want == SW_INSTALL)
 						continue;
@@ -145,13 +255,16 @@ pkg_hash_fetch_unsatisfied_dependencies(pkg_t * pkg, pkg_vec_t *unsatisfied,
 						"Adding satisfier for greedy"
 						" dependence %s.\n",
 						pkg_scout->name);
-					    pkg_vec_insert(unsatisfied, pkg_scout);
+					    ptr_map_insert(&ctx->members,
+						pkg_scout, NULL);
+					    pkg_vec_insert(ctx->order, pkg_scout);
 					}
 				   } else  {
 					opkg_msg(DEBUG,
 						"Not installing %s due to "
 						"broken depends.\n",
 						pkg_scout->name);
+					pkg_vec_free (tmp_vec);
 					free (newstuff);
 				   }
 			      }
@@ -164,19 +277,8 @@ pkg_hash_fetch_unsatisfied_dependencies(pkg_t * pkg, pkg_vec_t *unsatisfied,
 
 	  /* foreach possible satisfier, look for installed package  */
 	  for (j = 0; j < compound_depend->possibility_count; j++) {
-	       /* foreach provided_by, which includes the abstract_pkg itself */
-	       depend_t *dependence_to_satisfy = possible_satisfiers[j];
-	       abstract_pkg_t *satisfying_apkg = possible_satisfiers[j]->pkg;
-	       pkg_t *satisfying_pkg = 
-		    pkg_hash_fetch_best_installation_candidate(satisfying_apkg, 
-							       pkg_installed_and_constraint_satisfied, 
-							       dependence_to_satisfy, 1);
-               /* Being that I can't test constraing in pkg_hash, I will test it here */
-	       if (satisfying_pkg != NULL) {
-                  if (!pkg_installed_and_constraint_satisfied ( satisfying_pkg,dependence_to_satisfy)) {
-	              satisfying_pkg = NULL;
-                  }
-               }
+	       pkg_t *satisfying_pkg =
+		    resolve_candidate(ctx, possible_satisfiers[j], 1);
 	       opkg_msg(DEBUG, "satisfying_pkg=%p\n", satisfying_pkg);
 	       if (satisfying_pkg != NULL) {
 		    found = 1;
@@ -184,23 +286,15 @@ pkg_hash_fetch_unsatisfied_dependencies(pkg_t * pkg, pkg_vec_t *unsatisfied,
 	       }
 
 	  }
+	  /* the alternative the plan goes for, if any */
+	  if (!found)
+	       satisfier_entry_pkg = resolve_planned(ctx, compound_depend);
 	  /* if nothing installed matches, then look for uninstalled satisfier */
-	  if (!found) {
+	  if (!found && !satisfier_entry_pkg) {
 	       /* foreach possible satisfier, look for installed package  */
 	       for (j = 0; j < compound_depend->possibility_count; j++) {
-		    /* foreach provided_by, which includes the abstract_pkg itself */
-		    depend_t *dependence_to_satisfy = possible_satisfiers[j];
-		    abstract_pkg_t *satisfying_apkg = possible_satisfiers[j]->pkg;
-		    pkg_t *satisfying_pkg = 
-			 pkg_hash_fetch_best_installation_candidate(satisfying_apkg, 
-								    pkg_constraint_satisfied, 
-								    dependence_to_satisfy, 1);
-                    /* Being that I can't test constraing in pkg_hash, I will test it here too */
-	            if (satisfying_pkg != NULL) {
-                         if (!pkg_constraint_satisfied ( satisfying_pkg,dependence_to_satisfy)) {
-                            satisfying_pkg = NULL;
-                         }
-                    }
+		    pkg_t *satisfying_pkg =
+			 resolve_candidate(ctx, possible_satisfiers[j], 0);
 
 		    /* user request overrides package recommendation */
 		    if (satisfying_pkg != NULL
@@ -241,11 +335,12 @@ pkg_hash_fetch_unsatisfied_dependencies(pkg_t * pkg, pkg_vec_t *unsatisfied,
 			 char ** newstuff = NULL;
 			 
 			 if (satisfier_entry_pkg != pkg &&
-			     !is_pkg_in_pkg_vec(unsatisfied, satisfier_entry_pkg)) {
-			      pkg_vec_insert(unsatisfied, satisfier_entry_pkg);
-			      pkg_hash_fetch_unsatisfied_dependencies(satisfier_entry_pkg,
-								      unsatisfied,
-								      &newstuff);
+			     !ptr_map_contains(&ctx->members, satisfier_entry_pkg)) {
+			      ptr_map_insert(&ctx->members,
+					     satisfier_entry_pkg, NULL);
+			      newstuff = resolve_depends(ctx, satisfier_entry_pkg);
+			      /* after what it depends on */
+			      pkg_vec_insert(ctx->order, satisfier_entry_pkg);
 			      the_lost = merge_unresolved(the_lost, newstuff);
 			      if (newstuff)
 				   free(newstuff);
@@ -254,11 +349,103 @@ pkg_hash_fetch_unsatisfied_dependencies(pkg_t * pkg, pkg_vec_t *unsatisfied,
 	       }
 	  }
      }
-     *unresolved = the_lost;
+
+     return the_lost;
+}
+
+/*
+ * Appends to unsatisfied the packages that have to be installed along
+ * with pkg, each after the ones it depends on as far as cycles allow.
+ * The whole closure is resolved in one pass, picking a candidate once
+ * per abstract package and constraint. Returns ndependencies or
+ * negative error value.
+ */
+int
+pkg_hash_fetch_unsatisfied_dependencies(pkg_t * pkg, pkg_vec_t *unsatisfied,
+		char *** unresolved)
+{
+     struct resolve_ctx ctx;
+     ptr_map_t picks;
+
+     ptr_map_init(&picks, 64);
+     resolve_init(&ctx, &picks, unsatisfied);
+
+     *unresolved = resolve_depends(&ctx, pkg);
+
+     ptr_map_deinit(&ctx.members);
+     resolve_picks_free(&picks);
 
      return unsatisfied->len;
 }
 
+static void
+resolve_missing(struct resolve_ctx *ctx, pkg_t *pkg)
+{
+     int i, j, count;
+     compound_depend_t *compound_depend;
+     depend_t *depend;
+     pkg_t *satisfier;
+
+     count = pkg->pre_depends_count + pkg->depends_count + pkg->recommends_count + pkg->suggests_count;
+
+     for (i = 0; i < count; i++) {
+	  compound_depend = &pkg->depends[i];
+	  if (compound_depend->type == GREEDY_DEPEND
+			  || compound_depend->type == SUGGEST)
+	       continue;
+
+	  for (j = 0; j < compound_depend->possibility_count; j++) {
+	       depend = compound_depend->possibilities[j];
+	       if (resolve_candidate(ctx, depend, 1))
+		    break;
+	  }
+	  if (j < compound_depend->possibility_count)
+	       continue;
+
+	  satisfier = resolve_planned(ctx, compound_depend);
+	  if (satisfier == NULL) {
+	       for (j = 0; j < compound_depend->possibility_count; j++) {
+		    depend = compound_depend->possibilities[j];
+		    satisfier = resolve_candidate(ctx, depend, 0);
+		    if (satisfier && compound_depend->type == RECOMMEND
+				    && (satisfier->state_want == SW_DEINSTALL
+					    || satisfier->state_want == SW_PURGE))
+			 continue;
+		    if (satisfier)
+			 break;
+	       }
+	  }
+
+	  if (satisfier && satisfier != pkg
+			  && !ptr_map_contains(&ctx->members, satisfier)) {
+	       ptr_map_insert(&ctx->members, satisfier, NULL);
+	       resolve_missing(ctx, satisfier);
+	       pkg_vec_insert(ctx->order, satisfier);
+	  }
+     }
+}
+
+/*
+ * Collects into missing the packages that installing pkg is likely to
+ * pull in, the way pkg_hash_fetch_unsatisfied_dependencies() would pick
+ * them, but without marking anything as checked or complaining. Greedy
+ * depends and suggestions are left out.
+ */
+void
+pkg_hash_fetch_missing_dependencies(pkg_t *pkg, pkg_vec_t *missing)
+{
+     struct resolve_ctx ctx;
+     ptr_map_t picks;
+
+     ptr_map_init(&picks, 64);
+     resolve_init(&ctx, &picks, missing);
+
+     resolve_missing(&ctx, pkg);
+
+     ptr_map_deinit(&ctx.members);
+     resolve_picks_free(&picks);
+}
+
 /*checking for conflicts !in replaces 
   If a packages conflicts with another but is also replacing it, I should not consider it a 
   really conflicts 
@@ -299,6 +486,7 @@ pkg_vec_t * pkg_hash_fetch_conflicts(pkg_t * pkg)
     abstract_pkg_t * ab_pkg;
     pkg_t **pkg_scouts; 
     pkg_t *pkg_scout; 
+    id_set_t seen;
 
     /* 
      * this is a setup to check for redundant/cyclic dependency checks, 
@@ -314,6 +502,7 @@ pkg_vec_t * pkg_hash_fetch_conflicts(pkg_t * pkg)
 	return (pkg_vec_t *)NULL;
     }
     installed_conflicts = pkg_vec_alloc();
+    id_set_init(&seen);
 
     count = pkg->conflicts_count;
 
@@ -344,7 +533,7 @@ pkg_vec_t * pkg_hash_fetch_conflicts(pkg_t * pkg)
                     }
 		    if ((pkg_scout->state_status == SS_INSTALLED || pkg_scout->state_want == SW_INSTALL) &&
 		       version_constraints_satisfied(possible_satisfier, pkg_scout) && !is_pkg_a_replaces(pkg_scout,pkg)){
- 	 	        if (!is_pkg_in_pkg_vec(installed_conflicts, pkg_scout)){
+ 	 	        if (id_set_insert(&seen, pkg_scout->id)){
 			    pkg_vec_insert(installed_conflicts, pkg_scout);
 			}
 		    }
@@ -353,6 +542,7 @@ pkg_vec_t * pkg_hash_fetch_conflicts(pkg_t * pkg)
 	}
 	conflicts++;
     }
+    id_set_deinit(&seen);
 
     if (installed_conflicts->len)
 	    return installed_conflicts;
@@ -362,20 +552,17 @@ pkg_vec_t * pkg_hash_fetch_conflicts(pkg_t * pkg)
 
 int version_constraints_satisfied(depend_t * depends, pkg_t * pkg)
 {
-    pkg_t * temp;
     int comparison;
 
     if(depends->constraint == NONE)
 	return 1;
 
-    temp = pkg_new();
+    if (depends->version_key == NULL)
+	depends->version_key = version_key_parse(&conf->pkg_arena,
+			depends->version);
 
-    parse_version(temp, depends->version);
-
-    comparison = pkg_compare_versions(pkg, temp);
-
-    free (temp->version);
-    free(temp);
+    comparison = version_key_compare(pkg_version_key(pkg),
+		    depends->version_key);
 
     if((depends->constraint == EARLIER) && 
        (comparison < 0))
@@ -449,19 +636,6 @@ int pkg_dependence_satisfied(depend_t *depend)
      return 0;
 }
 
-static int is_pkg_in_pkg_vec(pkg_vec_t * vec, pkg_t * pkg)
-{
-    int i;
-    pkg_t ** pkgs = vec->pkgs;
-
-    for(i = 0; i < vec->len; i++)
-	if((strcmp(pkg->name, (*(pkgs + i))->name) == 0)
-	   && (pkg_compare_versions(pkg, *(pkgs + i)) == 0)
-	   && (strcmp(pkg->architecture, (*(pkgs + i))->architecture) == 0))
-	    return 1;
-    return 0;
-}
-
 /**
  * pkg_replaces returns 1 if pkg->replaces contains one of replacee's provides and 0
  * otherwise.
@@ -583,7 +757,8 @@ void buildProvides(abstract_pkg_t * ab_pkg, pkg_t * pkg)
     /* every pkg provides itself */
     pkg->provides_count++;
     abstract_pkg_vec_insert(ab_pkg->provided_by, ab_pkg);
-    pkg->provides = xcalloc(pkg->provides_count, sizeof(abstract_pkg_t *));
+    pkg->provides = arena_alloc(&conf->pkg_arena,
+	    pkg->provides_count * sizeof(abstract_pkg_t *));
     pkg->provides[0] = ab_pkg;
 
     for (i=1; i<pkg->provides_count; i++) {
@@ -607,7 +782,8 @@ void buildConflicts(pkg_t * pkg)
     if (!pkg->conflicts_count)
 	return;
 
-    conflicts = pkg->conflicts = xcalloc(pkg->conflicts_count, sizeof(compound_depend_t));
+    conflicts = pkg->conflicts = arena_alloc(&conf->pkg_arena,
+	    pkg->conflicts_count * sizeof(compound_depend_t));
     for (i = 0; i < pkg->conflicts_count; i++) {
 	 conflicts->type = CONFLICTS;
 	 parseDepends(conflicts, pkg->conflicts_str[i]);
@@ -625,7 +801,8 @@ void buildReplaces(abstract_pkg_t * ab_pkg, pkg_t * pkg)
      if (!pkg->replaces_count)
 	  return;
 
-     pkg->replaces = xcalloc(pkg->replaces_count, sizeof(abstract_pkg_t *));
+     pkg->replaces = arena_alloc(&conf->pkg_arena,
+	       pkg->replaces_count * sizeof(abstract_pkg_t *));
 
      for(i = 0; i < pkg->replaces_count; i++){
 	  abstract_pkg_t *old_abpkg = ensure_abstract_pkg_by_name(pkg->replaces_str[i]);
@@ -655,7 +832,8 @@ void buildDepends(pkg_t * pkg)
      if(!(count = pkg->pre_depends_count + pkg->depends_count + pkg->recommends_count + pkg->suggests_count))
 	  return;
 
-     depends = pkg->depends = xcalloc(count, sizeof(compound_depend_t));
+     depends = pkg->depends = arena_alloc(&conf->pkg_arena,
+	       count * sizeof(compound_depend_t));
 
      for(i = 0; i < pkg->pre_depends_count; i++){
 	  parseDepends(depends, pkg->pre_depends_str[i]);
@@ -810,9 +988,10 @@ void buildDependedUponBy(pkg_t * pkg, abstract_pkg_t * ab_pkg)
 
 static depend_t * depend_init(void)
 {
-    depend_t * d = xcalloc(1, sizeof(depend_t));    
+    depend_t * d = arena_alloc(&conf->pkg_arena, sizeof(depend_t));
     d->constraint = NONE;
     d->version = NULL;
+    d->version_key = NULL;
     d->pkg = NULL;
     
     return d;
@@ -836,7 +1015,8 @@ static int parseDepends(compound_depend_t *compound_depend,
      compound_depend->type = DEPEND;
 
      compound_depend->possibility_count = num_of_ors + 1;
-     possibilities = xcalloc((num_of_ors + 1), sizeof(depend_t *) );
+     possibilities = arena_alloc(&conf->pkg_arena,
+	       (num_of_ors + 1) * sizeof(depend_t *));
      compound_depend->possibilities = possibilities;
 
      src = depend_str;
@@ -899,9 +1079,11 @@ static int parseDepends(compound_depend_t *compound_depend,
 	       dest = buffer;
 	       while(*src && *src != ')')
 		    *dest++ = *src++;
+	       while(dest > buffer && isspace(dest[-1]))
+		    dest--;
 	       *dest = '\0';
 
-	       possibilities[i]->version = trim_xstrdup(buffer);
+	       possibilities[i]->version = str_atom(buffer);
 	  }
 	  /* hook up the dependency to its abstract pkg */
 	  possibilities[i]->pkg = ensure_abstract_pkg_by_name(pkg_name);
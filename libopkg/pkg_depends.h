@@ -44,6 +44,8 @@ typedef enum version_constraint version_constraint_t;
 struct depend{
     version_constraint_t constraint;
     char * version;
+    /* built on first check, see version_constraints_satisfied() */
+    version_key_t * version_key;
     abstract_pkg_t * pkg;
 };
 typedef struct depend depend_t;
@@ -82,6 +84,7 @@ char *pkg_depend_str(pkg_t *pkg, int index);
 void buildDependedUponBy(pkg_t * pkg, abstract_pkg_t * ab_pkg);
 int version_constraints_satisfied(depend_t * depends, pkg_t * pkg);
 int pkg_hash_fetch_unsatisfied_dependencies(pkg_t * pkg, pkg_vec_t *depends, char *** unresolved);
+void pkg_hash_fetch_missing_dependencies(pkg_t *pkg, pkg_vec_t *missing);
 pkg_vec_t * pkg_hash_fetch_conflicts(pkg_t * pkg);
 int pkg_dependence_satisfiable(depend_t *depend);
 int pkg_dependence_satisfied(depend_t *depend);
@@ -16,6 +16,7 @@
 */
 
 #include <stdio.h>
+#include <string.h>
 
 #include "pkg_extract.h"
 #include "libbb/libbb.h"
@@ -68,16 +69,22 @@ pkg_extract_data_files_to_dir(pkg_t *pkg, const char *dir)
 	deb_extract(pkg->local_filename, stderr,
 		extract_data_tar_gz
 		| extract_all_to_fs| extract_preserve_date
-		| extract_unconditional,
+		| extract_unconditional | extract_atomic,
 		dir, NULL, &err);
 
 	return err;
 }
 
+static void
+data_file_name_append(const char *name, void *data)
+{
+	str_list_append((str_list_t *) data, (char *) name);
+}
+
 int
-pkg_extract_data_file_names_to_stream(pkg_t *pkg, FILE *stream)
+pkg_extract_data_file_names(pkg_t *pkg, str_list_t *names)
 {
-	int err;
+	struct deb_member member;
 
     /* XXX: DPKG_INCOMPATIBILITY: deb_extract will extract all of the
        data file names with a '.' as the first character. I've taught
@@ -86,15 +93,49 @@ pkg_extract_data_file_names_to_stream(pkg_t *pkg, FILE *stream)
 
        For all I know, this could actually be a bug in opkg-build. So,
        I'll have to try installing some .debs and comparing the *.list
-       files.
+       files. */
 
-       If we wanted to, we could workaround the deb_extract behavior
-       right here, by writing to a tmpfile, then munging things as we
-       wrote to the actual stream. */
+	memset(&member, 0, sizeof(member));
+	member.ared_file = "data.tar";
+	member.out_stream = stderr;
+	member.extract_function = extract_quiet | extract_data_tar_gz;
+	member.list_entry = data_file_name_append;
+	member.list_data = names;
 
-	deb_extract(pkg->local_filename, stream,
-		extract_quiet | extract_data_tar_gz | extract_list,
-		NULL, NULL, &err);
+	return deb_extract_members(pkg->local_filename, &member, 1);
+}
+
+/*
+ * The control files to dir and the data file names to names, reading
+ * the package only once.
+ */
+int
+pkg_extract_control_files_and_data_file_names(pkg_t *pkg, const char *dir,
+		str_list_t *names)
+{
+	struct deb_member members[2];
+	char *dir_with_slash;
+	int err;
+
+	sprintf_alloc(&dir_with_slash, "%s/", dir);
+
+	memset(members, 0, sizeof(members));
+
+	members[0].ared_file = "control.tar";
+	members[0].out_stream = stderr;
+	members[0].extract_function = extract_control_tar_gz
+			| extract_all_to_fs| extract_preserve_date
+			| extract_unconditional;
+	members[0].prefix = dir_with_slash;
+
+	members[1].ared_file = "data.tar";
+	members[1].out_stream = stderr;
+	members[1].extract_function = extract_quiet | extract_data_tar_gz;
+	members[1].list_entry = data_file_name_append;
+	members[1].list_data = names;
+
+	err = deb_extract_members(pkg->local_filename, members, 2);
 
+	free(dir_with_slash);
 	return err;
 }
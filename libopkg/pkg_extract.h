@@ -26,6 +26,8 @@ int pkg_extract_control_files_to_dir_with_prefix(pkg_t *pkg,
 						 const char *dir,
 						 const char *prefix);
 int pkg_extract_data_files_to_dir(pkg_t *pkg, const char *dir);
-int pkg_extract_data_file_names_to_stream(pkg_t *pkg, FILE *file);
+int pkg_extract_data_file_names(pkg_t *pkg, str_list_t *names);
+int pkg_extract_control_files_and_data_file_names(pkg_t *pkg, const char *dir,
+						   str_list_t *names);
 
 #endif
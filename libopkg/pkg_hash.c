@@ -24,11 +24,24 @@
 #include "pkg_vec.h"
 #include "pkg_hash.h"
 #include "pkg_parse.h"
+#include "pkg_index.h"
+#include "file_index.h"
+#include "opkg_solver.h"
+#include "id_set.h"
+#include "str_atom.h"
 #include "opkg_utils.h"
 #include "sprintf_alloc.h"
 #include "file_util.h"
 #include "libbb/libbb.h"
 
+/* Bumped whenever packages are added to the hash, which is what changes
+ * the providers, replacers and versions behind a candidate list. */
+static unsigned int pkg_hash_serial = 1;
+
+/* the last ids given out, see id_set_t */
+static unsigned int pkg_hash_pkg_ids;
+static unsigned int pkg_hash_apkg_ids;
+
 void
 pkg_hash_init(void)
 {
@@ -51,16 +64,15 @@ free_pkgs(const char *key, void *entry, void *data)
 	if (ab_pkg->pkgs) {
 		for (i = 0; i < ab_pkg->pkgs->len; i++) {
 			pkg_deinit (ab_pkg->pkgs->pkgs[i]);
-			free (ab_pkg->pkgs->pkgs[i]);
 		}
 	}
 
 	abstract_pkg_vec_free (ab_pkg->provided_by);
 	abstract_pkg_vec_free (ab_pkg->replaced_by);
 	pkg_vec_free (ab_pkg->pkgs);
+	pkg_vec_free (ab_pkg->candidates);
 	free (ab_pkg->depended_upon_by);
-	free (ab_pkg->name);
-	free (ab_pkg);
+	/* ab_pkg itself and its name are in conf->pkg_arena */
 }
 
 void
@@ -68,6 +80,53 @@ pkg_hash_deinit(void)
 {
 	hash_table_foreach(&conf->pkg_hash, free_pkgs, NULL);
 	hash_table_deinit(&conf->pkg_hash);
+	pkg_hash_pkg_ids = 0;
+	pkg_hash_apkg_ids = 0;
+	pkg_parse_buffers_release();
+	str_atom_deinit();
+}
+
+static int
+pkg_hash_add_from_buffer(char *buf, size_t len,
+			pkg_src_t *src, pkg_dest_t *dest, int is_status_file)
+{
+	pkg_t *pkg;
+	char *pos = buf, *end = buf + len;
+	int ret = 0;
+
+	pkg = NULL;
+	while (pos < end) {
+		/* an entry that is dropped leaves its pkg_t to the next one */
+		if (pkg == NULL)
+			pkg = pkg_new();
+		else
+			pkg_init(pkg);
+		pkg->src = src;
+		pkg->dest = dest;
+
+		ret = pkg_parse_from_buffer(pkg, &pos, end, 0);
+		if (ret) {
+			pkg_deinit (pkg);
+			/* Probably a blank line, continue parsing. */
+			ret = 0;
+			continue;
+		}
+
+		if (!pkg->architecture || !pkg->arch_priority) {
+			char *version_str = pkg_version_str_alloc(pkg);
+			opkg_msg(ERROR, "Package %s version %s has no "
+					"valid architecture, ignoring.\n",
+					pkg->name, version_str);
+			free(version_str);
+			pkg_deinit(pkg);
+			continue;
+		}
+
+		hash_insert_pkg(pkg, is_status_file);
+		pkg = NULL;
+	}
+
+	return ret;
 }
 
 int
@@ -80,6 +139,16 @@ pkg_hash_add_from_file(const char *file_name,
 	const size_t len = 4096;
 	int ret = 0;
 
+	if (conf->mmap_lists) {
+		size_t buflen;
+
+		buf = pkg_parse_buffer_open(file_name, &buflen, is_status_file);
+		if (buf)
+			return pkg_hash_add_from_buffer(buf, buflen,
+					src, dest, is_status_file);
+		/* otherwise fall back to reading it line by line */
+	}
+
 	fp = fopen(file_name, "r");
 	if (fp == NULL) {
 		opkg_perror(ERROR, "Failed to open %s", file_name);
@@ -88,8 +157,13 @@ pkg_hash_add_from_file(const char *file_name,
 
 	buf = xmalloc(len);
 
+	pkg = NULL;
 	do {
-		pkg = pkg_new();
+		/* an entry that is dropped leaves its pkg_t to the next one */
+		if (pkg == NULL)
+			pkg = pkg_new();
+		else
+			pkg_init(pkg);
 		pkg->src = src;
 		pkg->dest = dest;
 
@@ -97,7 +171,6 @@ pkg_hash_add_from_file(const char *file_name,
 				&buf, len);
 		if (ret) {
 			pkg_deinit (pkg);
-			free(pkg);
 			if (ret == -1)
 				break;
 			if (ret == 1)
@@ -112,10 +185,12 @@ pkg_hash_add_from_file(const char *file_name,
 					"valid architecture, ignoring.\n",
 					pkg->name, version_str);
 			free(version_str);
+			pkg_deinit(pkg);
 			continue;
 		}
 
 		hash_insert_pkg(pkg, is_status_file);
+		pkg = NULL;
 
 	} while (!feof(fp));
 
@@ -189,13 +264,16 @@ pkg_hash_load_feeds(void)
 					err = strncmp(stored_md5, md5, 32);
 
 					free(stored_md5);
-					free(md5);
 
 					if (!err) {
 
 					pkg_src_t *src = xcalloc(1, sizeof(pkg_src_t));
-					pkg_src_init(src, comp_file, NULL, NULL, 0);
-					if (pkg_hash_add_from_file(comp_file, src, NULL, 0)) {
+					pkg_src_init(src, comp_file, NULL, NULL, NULL);
+					err = pkg_index_load(comp_file, md5, src, NULL);
+					if (err)
+						err = pkg_hash_add_from_file(comp_file, src, NULL, 0);
+					free(md5);
+					if (err) {
 						pkg_src_deinit(src);
 						free(comp_file);
 						free(list_file);
@@ -204,6 +282,7 @@ pkg_hash_load_feeds(void)
 					pkg_src_deinit(src);
 
 					} else {
+					     free(md5);
 					     opkg_msg(ERROR, "Checksum mismatch on component %s from %s\n", *comp, dist->name);
 					     return -1;
 					}
@@ -228,7 +307,10 @@ pkg_hash_load_feeds(void)
 		sprintf_alloc(&list_file, "%s/%s", lists_dir, src->name);
 
 		if (file_exists(list_file)) {
-			if (pkg_hash_add_from_file(list_file, src, NULL, 0)) {
+			int err = pkg_index_load(list_file, NULL, src, NULL);
+			if (err)
+				err = pkg_hash_add_from_file(list_file, src, NULL, 0);
+			if (err) {
 				free(list_file);
 				return -1;
 			}
@@ -264,57 +346,46 @@ pkg_hash_load_status_files(void)
 	return 0;
 }
 
-static abstract_pkg_t *
+abstract_pkg_t *
 abstract_pkg_fetch_by_name(const char * pkg_name)
 {
 	return (abstract_pkg_t *)hash_table_get(&conf->pkg_hash, pkg_name);
 }
 
-pkg_t *
-pkg_hash_fetch_best_installation_candidate(abstract_pkg_t *apkg,
-		int (*constraint_fcn)(pkg_t *pkg, void *cdata),
-		void *cdata, int quiet)
+
+static pkg_vec_t *
+pkg_hash_fetch_candidates(abstract_pkg_t *apkg)
 {
      int i, j;
-     int nprovides = 0;
-     int nmatching = 0;
-     int wrong_arch_found = 0;
-     pkg_vec_t *matching_pkgs;
-     abstract_pkg_vec_t *matching_apkgs;
-     abstract_pkg_vec_t *provided_apkg_vec;
+     int nprovides;
      abstract_pkg_t **provided_apkgs;
-     abstract_pkg_vec_t *providers;
-     pkg_t *latest_installed_parent = NULL;
-     pkg_t *latest_matching = NULL;
-     pkg_t *priorized_matching = NULL;
-     pkg_t *held_pkg = NULL;
-     pkg_t *good_pkg_by_name = NULL;
+     pkg_vec_t *matching_pkgs;
+     id_set_t providers, matched;
 
-     if (apkg == NULL || apkg->provided_by == NULL || (apkg->provided_by->len == 0))
-	  return NULL;
+     if (apkg->candidates && apkg->candidates_serial == pkg_hash_serial)
+	  return apkg->candidates;
 
+     if (apkg->candidates)
+	  pkg_vec_free(apkg->candidates);
      matching_pkgs = pkg_vec_alloc();
-     matching_apkgs = abstract_pkg_vec_alloc();
-     providers = abstract_pkg_vec_alloc();
+     apkg->candidates = matching_pkgs;
+     apkg->candidates_serial = pkg_hash_serial;
+     apkg->candidates_wrong_arch = 0;
 
      opkg_msg(DEBUG, "Best installation candidate for %s:\n", apkg->name);
 
-     provided_apkg_vec = apkg->provided_by;
-     nprovides = provided_apkg_vec->len;
-     provided_apkgs = provided_apkg_vec->pkgs;
+     nprovides = apkg->provided_by->len;
+     provided_apkgs = apkg->provided_by->pkgs;
      if (nprovides > 1)
 	  opkg_msg(DEBUG, "apkg=%s nprovides=%d.\n", apkg->name, nprovides);
 
-     /* accumulate all the providers */
-     for (i = 0; i < nprovides; i++) {
-	  abstract_pkg_t *provider_apkg = provided_apkgs[i];
-	  opkg_msg(DEBUG, "Adding %s to providers.\n", provider_apkg->name);
-	  abstract_pkg_vec_insert(providers, provider_apkg);
-     }
-     nprovides = providers->len;
+     id_set_init(&providers);
+     id_set_init(&matched);
+     for (i = 0; i < nprovides; i++)
+	  id_set_insert(&providers, provided_apkgs[i]->id);
 
      for (i = 0; i < nprovides; i++) {
-	  abstract_pkg_t *provider_apkg = abstract_pkg_vec_get(providers, i);
+	  abstract_pkg_t *provider_apkg = provided_apkgs[i];
 	  abstract_pkg_t *replacement_apkg = NULL;
 	  pkg_vec_t *vec;
 
@@ -332,7 +403,7 @@ pkg_hash_fetch_best_installation_candidate(abstract_pkg_t *apkg,
 			    replacement_apkg->name, provider_apkg->name);
 
 	  if (replacement_apkg && (replacement_apkg != provider_apkg)) {
-	       if (abstract_pkg_vec_contains(providers, replacement_apkg))
+	       if (id_set_contains(&providers, replacement_apkg->id))
 		    continue;
 	       else
 		    provider_apkg = replacement_apkg;
@@ -343,51 +414,72 @@ pkg_hash_fetch_best_installation_candidate(abstract_pkg_t *apkg,
 			       provider_apkg->name);
 	       continue;
 	  }
-    
 
 	  /* now check for supported architecture */
-	  {
-	       int max_count = 0;
-
-	       /* count packages matching max arch priority and keep track of last one */
-	       for (j=0; j<vec->len; j++) {
-		    pkg_t *maybe = vec->pkgs[j];
-		    opkg_msg(DEBUG, "%s arch=%s arch_priority=%d version=%s.\n",
-				 maybe->name, maybe->architecture,
-				 maybe->arch_priority, maybe->version);
-                    /* We make sure not to add the same package twice. Need to search for the reason why 
-                       they show up twice sometimes. */
-		    if ((maybe->arch_priority > 0) && (! pkg_vec_contains(matching_pkgs, maybe))) {
-			 max_count++;
-			 abstract_pkg_vec_insert(matching_apkgs, maybe->parent);
-			 pkg_vec_insert(matching_pkgs, maybe);
-		    }
-	       }
-
-		if (vec->len > 0 && matching_pkgs->len < 1)
-			wrong_arch_found = 1;
+	  for (j=0; j<vec->len; j++) {
+	       pkg_t *maybe = vec->pkgs[j];
+	       opkg_msg(DEBUG, "%s arch=%s arch_priority=%d version=%s.\n",
+			    maybe->name, maybe->architecture,
+			    maybe->arch_priority, maybe->version);
+	       /* We make sure not to add the same package twice. Need to search for the reason why 
+		  they show up twice sometimes. */
+	       if ((maybe->arch_priority > 0) && id_set_insert(&matched, maybe->id))
+		    pkg_vec_insert(matching_pkgs, maybe);
 	  }
+
+	  if (vec->len > 0 && matching_pkgs->len < 1)
+	       apkg->candidates_wrong_arch = 1;
+     }
+
+     id_set_deinit(&providers);
+     id_set_deinit(&matched);
+
+     if (matching_pkgs->len > 1) {
+	  pkg_vec_sort(matching_pkgs, pkg_name_version_and_architecture_compare);
+	  abstract_pkg_vec_sort(matching_pkgs, abstract_pkg_name_compare);
      }
 
+     return matching_pkgs;
+}
+
+pkg_t *
+pkg_hash_fetch_best_installation_candidate(abstract_pkg_t *apkg,
+		int (*constraint_fcn)(pkg_t *pkg, void *cdata),
+		void *cdata, int quiet)
+{
+     int i;
+     int nmatching = 0;
+     int planned = 0;
+     pkg_vec_t *matching_pkgs;
+     pkg_t *latest_installed_parent = NULL;
+     pkg_t *latest_matching = NULL;
+     pkg_t *priorized_matching = NULL;
+     pkg_t *held_pkg = NULL;
+     pkg_t *good_pkg_by_name = NULL;
+
+     if (apkg == NULL || apkg->provided_by == NULL || (apkg->provided_by->len == 0))
+	  return NULL;
+
+     matching_pkgs = pkg_hash_fetch_candidates(apkg);
+
      if (matching_pkgs->len < 1) {
-	  if (wrong_arch_found)
+	  if (apkg->candidates_wrong_arch)
 	        opkg_msg(ERROR, "Packages for %s found, but"
 			" incompatible with the architectures configured\n",
 			apkg->name);
-          pkg_vec_free(matching_pkgs);
-          abstract_pkg_vec_free(matching_apkgs);
-          abstract_pkg_vec_free(providers);
 	  return NULL;
      }
 
-
-     if (matching_pkgs->len > 1)
-	  pkg_vec_sort(matching_pkgs, pkg_name_version_and_architecture_compare);
-     if (matching_apkgs->len > 1)
-	  abstract_pkg_vec_sort(matching_pkgs, abstract_pkg_name_compare);
+     /* Once the solver picked some of them for the whole transaction,
+      * the others are out of the question. */
+     for (i = 0; i < matching_pkgs->len; i++)
+	  if (opkg_solver_chosen(matching_pkgs->pkgs[i]))
+	       planned = 1;
 
      for (i = 0; i < matching_pkgs->len; i++) {
 	  pkg_t *matching = matching_pkgs->pkgs[i];
+	  if (planned && !opkg_solver_chosen(matching))
+	       continue;
           if (constraint_fcn(matching, cdata)) {
              opkg_msg(DEBUG, "Candidate: %s %s.\n",
 			     matching->name, matching->version) ;
@@ -401,6 +493,9 @@ pkg_hash_fetch_best_installation_candidate(abstract_pkg_t *apkg,
 
      for (i = 0; i < matching_pkgs->len; i++) {
 	  pkg_t *matching = matching_pkgs->pkgs[i];
+	  if (planned && !opkg_solver_chosen(matching))
+	       continue;
+	  nmatching++;
 	  latest_matching = matching;
 	  if (matching->parent->state_status == SS_INSTALLED || matching->parent->state_status == SS_UNPACKED)
 	       latest_installed_parent = matching;
@@ -414,10 +509,12 @@ pkg_hash_fetch_best_installation_candidate(abstract_pkg_t *apkg,
 	  }
      }
 
-     if (!good_pkg_by_name && !held_pkg && !latest_installed_parent && matching_apkgs->len > 1 && !quiet) {
+     if (!good_pkg_by_name && !held_pkg && !latest_installed_parent && nmatching > 1 && !quiet) {
           int prio = 0;
           for (i = 0; i < matching_pkgs->len; i++) {
               pkg_t *matching = matching_pkgs->pkgs[i];
+                  if (planned && !opkg_solver_chosen(matching))
+                      continue;
                   if (matching->arch_priority > prio) {
                       priorized_matching = matching;
                       prio = matching->arch_priority;
@@ -428,7 +525,7 @@ pkg_hash_fetch_best_installation_candidate(abstract_pkg_t *apkg,
           
           }
 
-     if (conf->verbosity >= INFO && matching_apkgs->len > 1) {
+     if (conf->verbosity >= INFO && matching_pkgs->len > 1) {
 	  opkg_msg(INFO, "%d matching pkgs for apkg=%s:\n",
 				matching_pkgs->len, apkg->name);
 	  for (i = 0; i < matching_pkgs->len; i++) {
@@ -439,12 +536,6 @@ pkg_hash_fetch_best_installation_candidate(abstract_pkg_t *apkg,
 	  }
      }
 
-     nmatching = matching_apkgs->len;
-
-     pkg_vec_free(matching_pkgs);
-     abstract_pkg_vec_free(matching_apkgs);
-     abstract_pkg_vec_free(providers);
-
      if (good_pkg_by_name) {   /* We found a good candidate, we will install it */ 
 	  return good_pkg_by_name;
      }
@@ -650,7 +741,8 @@ add_new_abstract_pkg_by_name(const char *pkg_name)
 
 	ab_pkg = abstract_pkg_new();
 
-	ab_pkg->name = xstrdup(pkg_name);
+	ab_pkg->id = ++pkg_hash_apkg_ids;
+	ab_pkg->name = arena_strdup(&conf->pkg_arena, pkg_name);
 	hash_table_insert(&conf->pkg_hash, pkg_name, ab_pkg);
 
 	return ab_pkg;
@@ -698,19 +790,28 @@ hash_insert_pkg(pkg_t *pkg, int set_status)
 
 	pkg_vec_insert_merge(ab_pkg->pkgs, pkg, set_status);
 	pkg->parent = ab_pkg;
+	if (!pkg->id)
+		pkg->id = ++pkg_hash_pkg_ids;
+
+	pkg_hash_serial++;
 }
 
 
 pkg_t *
 file_hash_get_file_owner(const char *file_name)
 {
-	return hash_table_get(&conf->file_hash, file_name); 
+	pkg_t *owner = hash_table_get(&conf->file_hash, file_name);
+
+	if (owner == NULL)
+		owner = file_index_get_owner(file_name);
+
+	return owner;
 }
 
 void
 file_hash_set_file_owner(const char *file_name, pkg_t *owning_pkg)
 {
-	pkg_t *old_owning_pkg = hash_table_get(&conf->file_hash, file_name);
+	pkg_t *old_owning_pkg = file_hash_get_file_owner(file_name);
 	int file_name_len = strlen(file_name);
 
 	if (file_name[file_name_len -1] == '/')
@@ -723,7 +824,13 @@ file_hash_set_file_owner(const char *file_name, pkg_t *owning_pkg)
 		}
 	}
 
-	hash_table_insert(&conf->file_hash, file_name, owning_pkg); 
+	/* the owned_files sets share the copy of the name file_hash keeps */
+	file_name = hash_table_insert_key(&conf->file_hash, file_name,
+			owning_pkg);
+
+	if (old_owning_pkg)
+		pkg_remove_owned_file(old_owning_pkg, file_name);
+	pkg_add_owned_file(owning_pkg, file_name);
 
 	if (old_owning_pkg) {
 		pkg_get_installed_files(old_owning_pkg);
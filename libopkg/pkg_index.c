@@ -0,0 +1,765 @@
+/* pkg_index.c - the opkg package management system
+
+   Javier Palacios
+
+   Copyright (C) 2010 Javier Palacios
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "pkg.h"
+#include "pkg_hash.h"
+#include "pkg_parse.h"
+#include "pkg_index.h"
+#include "str_atom.h"
+#include "opkg_message.h"
+#include "sprintf_alloc.h"
+#include "file_util.h"
+#include "libbb/libbb.h"
+
+/*
+ * Layout of an index file:
+ *
+ *   header | record | record | ...
+ *
+ * Each record is a sequence of fields terminated by a zero tag. A field is
+ * a one byte tag, which is the bit number of the matching PFM_* mask, and
+ * a payload whose shape depends on the tag. Strings are stored as a
+ * 32 bit length (including the terminating NUL) followed by the bytes.
+ * Everything is in host byte order, the index is never shared between
+ * machines.
+ */
+
+#define PKG_INDEX_MAGIC "OPKGIDX"
+
+struct pkg_index_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t count;
+	uint64_t list_size;
+	int64_t list_mtime;
+	int64_t list_mtime_nsec;
+	uint64_t data_len;
+	uint64_t checksum;
+	char md5sum[33];
+};
+
+/* FNV-1a over 64 bit words, enough to tell a torn or bit-flipped
+ * index from a good one before anything is taken from it. */
+static uint64_t
+index_checksum(const char *data, size_t len)
+{
+	uint64_t h = 0xcbf29ce484222325ULL, w;
+
+	for (; len >= sizeof(w); data += sizeof(w), len -= sizeof(w)) {
+		memcpy(&w, data, sizeof(w));
+		h = (h ^ w) * 0x100000001b3ULL;
+	}
+	for (; len; data++, len--)
+		h = (h ^ (unsigned char)*data) * 0x100000001b3ULL;
+
+	return h;
+}
+
+enum pkg_index_tag {
+	TAG_END = 0,
+	TAG_ARCHITECTURE = 1,
+	TAG_AUTO_INSTALLED,
+	TAG_CONFFILES,
+	TAG_CONFLICTS,
+	TAG_DESCRIPTION,
+	TAG_DEPENDS,
+	TAG_ESSENTIAL,
+	TAG_FILENAME,
+	TAG_INSTALLED_SIZE,
+	TAG_INSTALLED_TIME,
+	TAG_MD5SUM,
+	TAG_MAINTAINER,
+	TAG_PACKAGE,
+	TAG_PRIORITY,
+	TAG_PROVIDES,
+	TAG_PRE_DEPENDS,
+	TAG_RECOMMENDS,
+	TAG_REPLACES,
+	TAG_SECTION,
+	TAG_SHA256SUM,
+	TAG_SIZE,
+	TAG_SOURCE,
+	TAG_STATUS,
+	TAG_SUGGESTS,
+	TAG_TAGS,
+	TAG_VERSION,
+};
+
+static int
+write_tag(FILE *fp, enum pkg_index_tag tag)
+{
+	unsigned char t = tag;
+
+	return fwrite(&t, 1, 1, fp) != 1;
+}
+
+static int
+write_u64(FILE *fp, uint64_t v)
+{
+	return fwrite(&v, sizeof(v), 1, fp) != 1;
+}
+
+static int
+write_raw_str(FILE *fp, const char *s)
+{
+	uint32_t len = strlen(s) + 1;
+
+	if (fwrite(&len, sizeof(len), 1, fp) != 1)
+		return 1;
+	return fwrite(s, 1, len, fp) != len;
+}
+
+static int
+write_str(FILE *fp, enum pkg_index_tag tag, const char *s)
+{
+	if (s == NULL)
+		return 0;
+	return write_tag(fp, tag) || write_raw_str(fp, s);
+}
+
+static int
+write_num(FILE *fp, enum pkg_index_tag tag, uint64_t v)
+{
+	if (v == 0)
+		return 0;
+	return write_tag(fp, tag) || write_u64(fp, v);
+}
+
+static int
+write_str_list(FILE *fp, enum pkg_index_tag tag, char **list,
+		unsigned int count)
+{
+	uint32_t n = count;
+	int i, err;
+
+	if (count == 0)
+		return 0;
+
+	err = write_tag(fp, tag);
+	err |= fwrite(&n, sizeof(n), 1, fp) != 1;
+	for (i = 0; i < count; i++)
+		err |= write_raw_str(fp, list[i]);
+
+	return err;
+}
+
+static int
+write_pkg(FILE *fp, pkg_t *pkg)
+{
+	conffile_list_elt_t *iter;
+	uint32_t n;
+	char *version;
+	int err = 0;
+
+	err |= write_str(fp, TAG_PACKAGE, pkg->name);
+
+	if (pkg->version) {
+		if (pkg->revision)
+			sprintf_alloc(&version, "%s-%s",
+					pkg->version, pkg->revision);
+		else
+			version = xstrdup(pkg->version);
+		err |= write_tag(fp, TAG_VERSION);
+		err |= write_u64(fp, pkg->epoch);
+		err |= write_raw_str(fp, version);
+		free(version);
+	}
+
+	err |= write_str(fp, TAG_ARCHITECTURE, pkg->architecture);
+	err |= write_str(fp, TAG_SECTION, pkg->section);
+	err |= write_str(fp, TAG_MAINTAINER, pkg->maintainer);
+	err |= write_str(fp, TAG_DESCRIPTION, pkg->description);
+	err |= write_str(fp, TAG_TAGS, pkg->tags);
+	err |= write_str(fp, TAG_FILENAME, pkg->filename);
+	err |= write_str(fp, TAG_MD5SUM, pkg->md5sum);
+#if defined HAVE_SHA256
+	err |= write_str(fp, TAG_SHA256SUM, pkg->sha256sum);
+#endif
+	err |= write_str(fp, TAG_PRIORITY, pkg->priority);
+	err |= write_str(fp, TAG_SOURCE, pkg->source);
+
+	err |= write_num(fp, TAG_SIZE, pkg->size);
+	err |= write_num(fp, TAG_INSTALLED_SIZE, pkg->installed_size);
+	err |= write_num(fp, TAG_INSTALLED_TIME, pkg->installed_time);
+	err |= write_num(fp, TAG_ESSENTIAL, pkg->essential);
+	err |= write_num(fp, TAG_AUTO_INSTALLED, pkg->auto_installed);
+
+	err |= write_str_list(fp, TAG_DEPENDS,
+			pkg->depends_str, pkg->depends_count);
+	err |= write_str_list(fp, TAG_PRE_DEPENDS,
+			pkg->pre_depends_str, pkg->pre_depends_count);
+	err |= write_str_list(fp, TAG_RECOMMENDS,
+			pkg->recommends_str, pkg->recommends_count);
+	err |= write_str_list(fp, TAG_SUGGESTS,
+			pkg->suggests_str, pkg->suggests_count);
+	err |= write_str_list(fp, TAG_CONFLICTS,
+			pkg->conflicts_str, pkg->conflicts_count);
+	err |= write_str_list(fp, TAG_REPLACES,
+			pkg->replaces_str, pkg->replaces_count);
+	err |= write_str_list(fp, TAG_PROVIDES,
+			pkg->provides_str, pkg->provides_count);
+
+	if (!nv_pair_list_empty(&pkg->conffiles)) {
+		n = 0;
+		list_for_each_entry(iter, &pkg->conffiles.head, node)
+			n++;
+		err |= write_tag(fp, TAG_CONFFILES);
+		err |= fwrite(&n, sizeof(n), 1, fp) != 1;
+		list_for_each_entry(iter, &pkg->conffiles.head, node) {
+			conffile_t *cf = (conffile_t *)iter->data;
+			err |= write_raw_str(fp, cf->name);
+			err |= write_raw_str(fp, cf->value);
+		}
+	}
+
+	err |= write_tag(fp, TAG_END);
+
+	return err;
+}
+
+static void
+free_str_list(char **list, unsigned int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		free(list[i]);
+	free(list);
+}
+
+/* The *_str arrays are normally consumed by buildDepends() and friends,
+ * which are never run here. */
+static void
+pkg_free_dependency_strs(pkg_t *pkg)
+{
+	free_str_list(pkg->depends_str, pkg->depends_count);
+	free_str_list(pkg->pre_depends_str, pkg->pre_depends_count);
+	free_str_list(pkg->recommends_str, pkg->recommends_count);
+	free_str_list(pkg->suggests_str, pkg->suggests_count);
+	free_str_list(pkg->conflicts_str, pkg->conflicts_count);
+	free_str_list(pkg->replaces_str, pkg->replaces_count);
+	free_str_list(pkg->provides_str, pkg->provides_count);
+	pkg->depends_count = pkg->pre_depends_count = 0;
+	pkg->recommends_count = pkg->suggests_count = 0;
+	pkg->conflicts_count = pkg->replaces_count = 0;
+	pkg->provides_count = 0;
+}
+
+int
+pkg_index_write(const char *list_file)
+{
+	struct pkg_index_header hdr;
+	struct stat st;
+	FILE *in, *out;
+	char *index_file, *tmp_file, *md5, *buf;
+	const size_t len = 4096;
+	unsigned int saved_pfm;
+	long data_start;
+	pkg_t pkg;
+	int ret = 0, err = 0;
+
+	if (stat(list_file, &st) == -1) {
+		opkg_perror(ERROR, "Failed to stat %s", list_file);
+		return -1;
+	}
+
+	md5 = file_md5sum_alloc(list_file);
+	if (md5 == NULL)
+		return -1;
+
+	in = fopen(list_file, "r");
+	if (in == NULL) {
+		opkg_perror(ERROR, "Failed to open %s", list_file);
+		free(md5);
+		return -1;
+	}
+
+	sprintf_alloc(&index_file, "%s%s", list_file, PKG_INDEX_SUFFIX);
+	sprintf_alloc(&tmp_file, "%s.tmp", index_file);
+
+	out = fopen(tmp_file, "w+");
+	if (out == NULL) {
+		opkg_perror(ERROR, "Failed to open %s", tmp_file);
+		fclose(in);
+		free(md5);
+		free(tmp_file);
+		free(index_file);
+		return -1;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, PKG_INDEX_MAGIC, sizeof(PKG_INDEX_MAGIC));
+	hdr.version = PKG_INDEX_VERSION;
+	hdr.list_size = st.st_size;
+	hdr.list_mtime = st.st_mtim.tv_sec;
+	hdr.list_mtime_nsec = st.st_mtim.tv_nsec;
+	strncpy(hdr.md5sum, md5, sizeof(hdr.md5sum) - 1);
+	free(md5);
+
+	err |= fwrite(&hdr, sizeof(hdr), 1, out) != 1;
+	data_start = ftell(out);
+
+	/* The index has to hold every field, whatever the current command
+	 * would rather skip. */
+	saved_pfm = conf->pfm;
+	conf->pfm = 0;
+
+	buf = xmalloc(len);
+
+	do {
+		/* parsed only to be written out, so not in conf->pkg_arena */
+		pkg_init(&pkg);
+
+		ret = pkg_parse_from_stream_nomalloc(&pkg, in, 0, &buf, len);
+		if (ret == 0 && pkg.name) {
+			err |= write_pkg(out, &pkg);
+			hdr.count++;
+		}
+
+		pkg_free_dependency_strs(&pkg);
+		pkg_deinit(&pkg);
+
+		if (ret == -1)
+			break;
+		ret = 0;
+	} while (!feof(in));
+
+	free(buf);
+	conf->pfm = saved_pfm;
+	fclose(in);
+
+	hdr.data_len = ftell(out) - data_start;
+	err |= fflush(out) != 0;
+	if (!err && !ret && hdr.data_len) {
+		void *map = mmap(NULL, data_start + hdr.data_len, PROT_READ,
+				MAP_SHARED, fileno(out), 0);
+		if (map == MAP_FAILED) {
+			opkg_perror(ERROR, "Failed to mmap %s", tmp_file);
+			err = 1;
+		} else {
+			hdr.checksum = index_checksum((char *)map + data_start,
+					hdr.data_len);
+			munmap(map, data_start + hdr.data_len);
+		}
+	} else
+		hdr.checksum = index_checksum(NULL, 0);
+	if (!err && !ret) {
+		rewind(out);
+		err |= fwrite(&hdr, sizeof(hdr), 1, out) != 1;
+	}
+	err |= fclose(out) != 0;
+
+	if (err || ret) {
+		opkg_msg(ERROR, "Failed to write package index %s.\n",
+				index_file);
+		unlink(tmp_file);
+		ret = -1;
+	} else if (rename(tmp_file, index_file) == -1) {
+		opkg_perror(ERROR, "Failed to rename %s to %s",
+				tmp_file, index_file);
+		unlink(tmp_file);
+		ret = -1;
+	} else
+		opkg_msg(DEBUG, "Wrote %u packages to %s.\n",
+				hdr.count, index_file);
+
+	free(tmp_file);
+	free(index_file);
+
+	return ret;
+}
+
+/*
+ * Bounds checked reader over the mapped index.
+ */
+struct index_reader {
+	const char *p;
+	const char *end;
+	int err;
+};
+
+static int
+read_bytes(struct index_reader *r, void *dst, size_t n)
+{
+	if (r->err || r->end - r->p < n) {
+		r->err = 1;
+		return 1;
+	}
+	memcpy(dst, r->p, n);
+	r->p += n;
+	return 0;
+}
+
+static uint32_t
+read_u32(struct index_reader *r)
+{
+	uint32_t v = 0;
+
+	read_bytes(r, &v, sizeof(v));
+	return v;
+}
+
+static uint64_t
+read_u64(struct index_reader *r)
+{
+	uint64_t v = 0;
+
+	read_bytes(r, &v, sizeof(v));
+	return v;
+}
+
+static char *
+read_str(struct index_reader *r)
+{
+	uint32_t len;
+	char *s;
+
+	len = read_u32(r);
+	if (r->err || len == 0 || r->end - r->p < len
+			|| r->p[len - 1] != '\0') {
+		r->err = 1;
+		return NULL;
+	}
+
+	s = xmalloc(len);
+	memcpy(s, r->p, len);
+	r->p += len;
+
+	return s;
+}
+
+static char **
+read_str_list(struct index_reader *r, unsigned int *count)
+{
+	char **list;
+	uint32_t i, n;
+
+	n = read_u32(r);
+	if (r->err || n == 0 || n > r->end - r->p) {
+		r->err = 1;
+		*count = 0;
+		return NULL;
+	}
+
+	list = xcalloc(n, sizeof(char *));
+	for (i = 0; i < n && !r->err; i++)
+		list[i] = read_str(r);
+	*count = r->err ? 0 : n;
+
+	if (r->err)
+		free_str_list(list, i);
+
+	return r->err ? NULL : list;
+}
+
+/* Like read_str(), but honours the field mask of the current command. */
+static void
+read_field_str(struct index_reader *r, char **field, uint mask)
+{
+	char *s = read_str(r);
+
+	if (conf->pfm & mask)
+		free(s);
+	else
+		*field = s;
+}
+
+static void
+read_field_atom(struct index_reader *r, char **field, uint mask)
+{
+	uint32_t len;
+
+	len = read_u32(r);
+	if (r->err || len == 0 || r->end - r->p < len
+			|| r->p[len - 1] != '\0') {
+		r->err = 1;
+		return;
+	}
+
+	if (!(conf->pfm & mask))
+		*field = str_atom_n(r->p, len - 1);
+	r->p += len;
+}
+
+static void
+read_field_str_list(struct index_reader *r, char ***field,
+		unsigned int *count, uint mask)
+{
+	unsigned int n;
+	char **list = read_str_list(r, &n);
+
+	if (conf->pfm & mask)
+		free_str_list(list, n);
+	else {
+		*field = list;
+		*count = n;
+	}
+}
+
+static int
+read_pkg(struct index_reader *r, pkg_t *pkg)
+{
+	unsigned char tag;
+	uint32_t i, n;
+	char *name, *value;
+
+	while (!read_bytes(r, &tag, 1) && tag != TAG_END) {
+		switch (tag) {
+		case TAG_PACKAGE:
+			read_field_str(r, &pkg->name, 0);
+			break;
+		case TAG_VERSION:
+			pkg->epoch = read_u64(r);
+			read_field_str(r, &pkg->version, PFM_VERSION);
+			if (pkg->version) {
+				pkg->revision = strrchr(pkg->version, '-');
+				if (pkg->revision)
+					*pkg->revision++ = '\0';
+			}
+			break;
+		case TAG_ARCHITECTURE:
+			read_field_atom(r, &pkg->architecture,
+					PFM_ARCHITECTURE);
+			if (pkg->architecture)
+				pkg->arch_priority =
+					get_arch_priority(pkg->architecture);
+			break;
+		case TAG_SECTION:
+			read_field_atom(r, &pkg->section, PFM_SECTION);
+			break;
+		case TAG_MAINTAINER:
+			read_field_atom(r, &pkg->maintainer, PFM_MAINTAINER);
+			break;
+		case TAG_DESCRIPTION:
+			read_field_str(r, &pkg->description, PFM_DESCRIPTION);
+			break;
+		case TAG_TAGS:
+			read_field_str(r, &pkg->tags, PFM_TAGS);
+			break;
+		case TAG_FILENAME:
+			read_field_str(r, &pkg->filename, PFM_FILENAME);
+			break;
+		case TAG_MD5SUM:
+			read_field_str(r, &pkg->md5sum, PFM_MD5SUM);
+			break;
+		case TAG_SHA256SUM:
+#if defined HAVE_SHA256
+			read_field_str(r, &pkg->sha256sum, PFM_SHA256SUM);
+#else
+			free(read_str(r));
+#endif
+			break;
+		case TAG_PRIORITY:
+			read_field_atom(r, &pkg->priority, PFM_PRIORITY);
+			break;
+		case TAG_SOURCE:
+			read_field_atom(r, &pkg->source, PFM_SOURCE);
+			break;
+		case TAG_SIZE:
+			pkg->size = read_u64(r);
+			break;
+		case TAG_INSTALLED_SIZE:
+			pkg->installed_size = read_u64(r);
+			break;
+		case TAG_INSTALLED_TIME:
+			pkg->installed_time = read_u64(r);
+			break;
+		case TAG_ESSENTIAL:
+			pkg->essential = read_u64(r);
+			break;
+		case TAG_AUTO_INSTALLED:
+			pkg->auto_installed = read_u64(r);
+			break;
+		case TAG_DEPENDS:
+			read_field_str_list(r, &pkg->depends_str,
+					&pkg->depends_count, PFM_DEPENDS);
+			break;
+		case TAG_PRE_DEPENDS:
+			read_field_str_list(r, &pkg->pre_depends_str,
+					&pkg->pre_depends_count, PFM_PRE_DEPENDS);
+			break;
+		case TAG_RECOMMENDS:
+			read_field_str_list(r, &pkg->recommends_str,
+					&pkg->recommends_count, PFM_RECOMMENDS);
+			break;
+		case TAG_SUGGESTS:
+			read_field_str_list(r, &pkg->suggests_str,
+					&pkg->suggests_count, PFM_SUGGESTS);
+			break;
+		case TAG_CONFLICTS:
+			read_field_str_list(r, &pkg->conflicts_str,
+					&pkg->conflicts_count, PFM_CONFLICTS);
+			break;
+		case TAG_REPLACES:
+			read_field_str_list(r, &pkg->replaces_str,
+					&pkg->replaces_count, PFM_REPLACES);
+			break;
+		case TAG_PROVIDES:
+			read_field_str_list(r, &pkg->provides_str,
+					&pkg->provides_count, PFM_PROVIDES);
+			break;
+		case TAG_CONFFILES:
+			n = read_u32(r);
+			for (i = 0; i < n && !r->err; i++) {
+				name = read_str(r);
+				value = read_str(r);
+				if (!r->err && !(conf->pfm & PFM_CONFFILES))
+					conffile_list_append(&pkg->conffiles,
+							name, value);
+				free(name);
+				free(value);
+			}
+			break;
+		default:
+			r->err = 1;
+			break;
+		}
+
+		if (r->err)
+			break;
+	}
+
+	return r->err ? -1 : 0;
+}
+
+int
+pkg_index_load(const char *list_file, const char *md5sum,
+		pkg_src_t *src, pkg_dest_t *dest)
+{
+	struct pkg_index_header hdr;
+	struct index_reader r;
+	struct stat list_st, st;
+	char *index_file;
+	void *map;
+	pkg_vec_t *pkgs;
+	pkg_t *pkg;
+	uint32_t i;
+	int fd, ret = 0;
+
+	if (stat(list_file, &list_st) == -1)
+		return 1;
+
+	sprintf_alloc(&index_file, "%s%s", list_file, PKG_INDEX_SUFFIX);
+
+	fd = open(index_file, O_RDONLY);
+	if (fd == -1) {
+		free(index_file);
+		return 1;
+	}
+
+	if (fstat(fd, &st) == -1 || st.st_size < sizeof(hdr)
+			|| read(fd, &hdr, sizeof(hdr)) != sizeof(hdr)
+			|| memcmp(hdr.magic, PKG_INDEX_MAGIC,
+				sizeof(PKG_INDEX_MAGIC))
+			|| hdr.version != PKG_INDEX_VERSION
+			|| hdr.data_len != st.st_size - sizeof(hdr)
+			|| hdr.list_size != list_st.st_size
+			|| hdr.list_mtime != list_st.st_mtim.tv_sec
+			|| hdr.list_mtime_nsec != list_st.st_mtim.tv_nsec
+			|| (md5sum && strncmp(hdr.md5sum, md5sum, 32))) {
+		opkg_msg(DEBUG, "Ignoring stale package index %s.\n",
+				index_file);
+		close(fd);
+		free(index_file);
+		return 1;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		opkg_perror(ERROR, "Failed to mmap %s", index_file);
+		free(index_file);
+		return 1;
+	}
+
+	r.p = (const char *)map + sizeof(hdr);
+	r.end = (const char *)map + st.st_size;
+	r.err = 0;
+
+	/* Everything is read before anything goes into the hash, so a bad
+	 * index leaves nothing behind for the text list to collide with. */
+	if (index_checksum(r.p, hdr.data_len) != hdr.checksum)
+		ret = -1;
+
+	pkgs = pkg_vec_alloc();
+	pkg = NULL;
+	for (i = 0; i < hdr.count && ret == 0; i++) {
+		/* an entry that is dropped leaves its pkg_t to the next one */
+		if (pkg == NULL)
+			pkg = pkg_new();
+		else
+			pkg_init(pkg);
+		pkg->src = src;
+		pkg->dest = dest;
+
+		if (read_pkg(&r, pkg) || pkg->name == NULL) {
+			pkg_free_dependency_strs(pkg);
+			pkg_deinit(pkg);
+			ret = -1;
+			break;
+		}
+
+		if (!pkg->architecture || !pkg->arch_priority) {
+			char *version_str = pkg_version_str_alloc(pkg);
+			opkg_msg(ERROR, "Package %s version %s has no "
+					"valid architecture, ignoring.\n",
+					pkg->name, version_str);
+			free(version_str);
+			pkg_free_dependency_strs(pkg);
+			pkg_deinit(pkg);
+			continue;
+		}
+
+		pkg_vec_insert(pkgs, pkg);
+		pkg = NULL;
+	}
+
+	for (i = 0; i < pkgs->len; i++) {
+		pkg = pkgs->pkgs[i];
+		if (ret == 0)
+			hash_insert_pkg(pkg, 0);
+		else {
+			pkg_free_dependency_strs(pkg);
+			pkg_deinit(pkg);
+		}
+	}
+	pkg_vec_free(pkgs);
+
+	munmap(map, st.st_size);
+
+	if (ret == 0)
+		opkg_msg(DEBUG, "Loaded %u packages from %s.\n",
+				hdr.count, index_file);
+	else {
+		opkg_msg(NOTICE, "Corrupted package index %s, "
+				"parsing %s instead.\n", index_file, list_file);
+		if (unlink(index_file) == -1)
+			opkg_perror(ERROR, "Failed to remove %s", index_file);
+	}
+	free(index_file);
+
+	return ret;
+}
@@ -0,0 +1,39 @@
+/* pkg_index.h - the opkg package management system
+
+   Javier Palacios
+
+   Copyright (C) 2010 Javier Palacios
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#ifndef PKG_INDEX_H
+#define PKG_INDEX_H
+
+#include "pkg_src.h"
+#include "pkg_dest.h"
+
+/* Compiled, binary form of a Packages list, stored as <list>.idx next
+ * to the text list and tied to its size, mtime and md5sum. */
+
+#define PKG_INDEX_SUFFIX	".idx"
+#define PKG_INDEX_VERSION	2
+
+int pkg_index_write(const char *list_file);
+
+/* Returns 0 when the index was loaded, 1 when it is missing or stale and
+ * -1 when it was corrupted, in which case it is removed. Either way the
+ * text list has to be parsed instead. Nothing is added to the hash
+ * unless the whole index loads. */
+int pkg_index_load(const char *list_file, const char *md5sum,
+		pkg_src_t *src, pkg_dest_t *dest);
+
+#endif
@@ -20,10 +20,15 @@
 
 #include <stdio.h>
 #include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #include "pkg.h"
 #include "opkg_utils.h"
 #include "pkg_parse.h"
+#include "str_atom.h"
 #include "libbb/libbb.h"
 
 static int
@@ -40,6 +45,49 @@ parse_simple(const char *type, const char *line)
 	return trim_xstrdup(line + strlen(type) + 1);
 }
 
+/*
+ * For fields with few distinct values, returns the shared atom.
+ */
+static char *
+parse_atom(const char *type, const char *line)
+{
+	const char *start, *end;
+
+	start = line + strlen(type) + 1;
+	while (isspace(*start))
+		start++;
+
+	end = start + strlen(start);
+	while (end > start && isspace(end[-1]))
+		end--;
+
+	return str_atom_n(start, end - start);
+}
+
+/*
+ * Like parse_simple(), but for packages parsed from a mapped buffer the
+ * value is trimmed in place and returned without copying.
+ */
+static char *
+parse_str(pkg_t *pkg, const char *type, char *line)
+{
+	char *start, *end;
+
+	if (!pkg->strings_mapped)
+		return parse_simple(type, line);
+
+	start = line + strlen(type) + 1;
+	while (isspace(*start))
+		start++;
+
+	end = start + strlen(start);
+	while (end > start && isspace(end[-1]))
+		end--;
+	*end = '\0';
+
+	return start;
+}
+
 /*
  * Parse a comma separated string into an array.
  */
@@ -139,8 +187,10 @@ parse_version(pkg_t *pkg, const char *vstr)
 		pkg->epoch= 0;
 	}
 
-	pkg->version= xstrdup(vstr);
+	/* A mapped buffer is writable, see pkg_parse_buffer_open(). */
+	pkg->version = pkg->strings_mapped ? (char *)vstr : xstrdup(vstr);
 	pkg->revision = strrchr(pkg->version,'-');
+	pkg->version_key = NULL;
 
 	if (pkg->revision)
 		*pkg->revision++ = '\0';
@@ -148,7 +198,7 @@ parse_version(pkg_t *pkg, const char *vstr)
 	return 0;
 }
 
-static int
+int
 get_arch_priority(const char *arch)
 {
 	nv_pair_list_elt_t *l;
@@ -162,7 +212,7 @@ get_arch_priority(const char *arch)
 }
 
 static int
-pkg_parse_line(pkg_t *pkg, const char *line, uint mask)
+pkg_parse_line(pkg_t *pkg, char *line, uint mask)
 {
 	/* these flags are a bit hackish... */
 	static int reading_conffiles = 0, reading_description = 0;
@@ -177,7 +227,7 @@ pkg_parse_line(pkg_t *pkg, const char *line, uint mask)
 	switch (*line) {
 	case 'A':
 		if ((mask & PFM_ARCHITECTURE ) && is_field("Architecture", line)) {
-			pkg->architecture = parse_simple("Architecture", line);
+			pkg->architecture = parse_atom("Architecture", line);
 			pkg->arch_priority = get_arch_priority(pkg->architecture);
 		} else if ((mask & PFM_AUTO_INSTALLED) && is_field("Auto-Installed", line)) {
 			char *tmp = parse_simple("Auto-Installed", line);
@@ -199,7 +249,7 @@ pkg_parse_line(pkg_t *pkg, const char *line, uint mask)
 
 	case 'D':
 		if ((mask & PFM_DESCRIPTION) && is_field("Description", line)) {
-			pkg->description = parse_simple("Description", line);
+			pkg->description = parse_str(pkg, "Description", line);
 			reading_conffiles = 0;
 			reading_description = 1;
 			goto dont_reset_flags;
@@ -218,38 +268,33 @@ pkg_parse_line(pkg_t *pkg, const char *line, uint mask)
 
 	case 'F':
 		if((mask & PFM_FILENAME) && is_field("Filename", line))
-			pkg->filename = parse_simple("Filename", line);
+			pkg->filename = parse_str(pkg, "Filename", line);
 		break;
 
 	case 'I':
-		if ((mask && PFM_INSTALLED_SIZE) && is_field("Installed-Size", line)) {
-			char *tmp = parse_simple("Installed-Size", line);
-			pkg->installed_size = strtoul(tmp, NULL, 0);
-			free (tmp);
-		} else if ((mask && PFM_INSTALLED_TIME) && is_field("Installed-Time", line)) {
-			char *tmp = parse_simple("Installed-Time", line);
-			pkg->installed_time = strtoul(tmp, NULL, 0);
-			free (tmp);
-		}	    
+		if ((mask && PFM_INSTALLED_SIZE) && is_field("Installed-Size", line))
+			pkg->installed_size = strtoul(line + strlen("Installed-Size") + 1, NULL, 0);
+		else if ((mask && PFM_INSTALLED_TIME) && is_field("Installed-Time", line))
+			pkg->installed_time = strtoul(line + strlen("Installed-Time") + 1, NULL, 0);
 		break;
 
 	case 'M':
 		if (mask && PFM_MD5SUM) {
 			if (is_field("MD5sum:", line))
-				pkg->md5sum = parse_simple("MD5sum", line);
+				pkg->md5sum = parse_str(pkg, "MD5sum", line);
 			/* The old opkg wrote out status files with the wrong
 			* case for MD5sum, let's parse it either way */
 			else if (is_field("MD5Sum:", line))
-				pkg->md5sum = parse_simple("MD5Sum", line);
+				pkg->md5sum = parse_str(pkg, "MD5Sum", line);
 		} else if((mask & PFM_MAINTAINER) && is_field("Maintainer", line))
-			pkg->maintainer = parse_simple("Maintainer", line);
+			pkg->maintainer = parse_atom("Maintainer", line);
 		break;
 
 	case 'P':
 		if ((mask & PFM_PACKAGE) && is_field("Package", line)) 
-			pkg->name = parse_simple("Package", line);
+			pkg->name = parse_str(pkg, "Package", line);
 		else if ((mask & PFM_PRIORITY) && is_field("Priority", line))
-			pkg->priority = parse_simple("Priority", line);
+			pkg->priority = parse_atom("Priority", line);
 		else if ((mask & PFM_PROVIDES) && is_field("Provides", line))
 			pkg->provides_str = parse_comma_separated(line, &pkg->provides_count);
 		else if ((mask & PFM_PRE_DEPENDS) && is_field("Pre-Depends", line))
@@ -266,17 +311,15 @@ pkg_parse_line(pkg_t *pkg, const char *line, uint mask)
 
 	case 'S':
 		if ((mask & PFM_SECTION) && is_field("Section", line))
-			pkg->section = parse_simple("Section", line);
+			pkg->section = parse_atom("Section", line);
 #ifdef HAVE_SHA256
 		else if ((mask & PFM_SHA256SUM) && is_field("SHA256sum", line))
-			pkg->sha256sum = parse_simple("SHA256sum", line);
+			pkg->sha256sum = parse_str(pkg, "SHA256sum", line);
 #endif
-		else if ((mask & PFM_SIZE) && is_field("Size", line)) {
-			char *tmp = parse_simple("Size", line);
-			pkg->size = strtoul(tmp, NULL, 0);
-			free (tmp);
-		} else if ((mask & PFM_SOURCE) && is_field("Source", line))
-			pkg->source = parse_simple("Source", line);
+		else if ((mask & PFM_SIZE) && is_field("Size", line))
+			pkg->size = strtoul(line + strlen("Size") + 1, NULL, 0);
+		else if ((mask & PFM_SOURCE) && is_field("Source", line))
+			pkg->source = parse_atom("Source", line);
 		else if ((mask & PFM_STATUS) && is_field("Status", line))
 			parse_status(pkg, line);
 		else if ((mask & PFM_SUGGESTS) && is_field("Suggests", line))
@@ -285,7 +328,7 @@ pkg_parse_line(pkg_t *pkg, const char *line, uint mask)
 
 	case 'T':
 		if ((mask & PFM_TAGS) && is_field("Tags", line))
-			pkg->tags = parse_simple("Tags", line);
+			pkg->tags = parse_str(pkg, "Tags", line);
 		break;
 
 	case 'V':
@@ -295,6 +338,14 @@ pkg_parse_line(pkg_t *pkg, const char *line, uint mask)
 
 	case ' ':
 		if ((mask & PFM_DESCRIPTION) && reading_description) {
+			if (pkg->strings_mapped) {
+				/* Continuation lines follow the description
+				 * in the buffer, move them up behind it. */
+				char *end = pkg->description + strlen(pkg->description);
+				*end++ = '\n';
+				memmove(end, line, strlen(line) + 1);
+				goto dont_reset_flags;
+			}
 			pkg->description = xrealloc(pkg->description,
 						strlen(pkg->description)
 						+ 1 + strlen(line) + 1);
@@ -421,3 +472,150 @@ pkg_parse_from_stream(pkg_t *pkg, FILE *fp, uint mask)
 
 	return ret;
 }
+
+/*
+ * Buffers handed out by pkg_parse_buffer_open(). Packages parsed from them
+ * keep pointers into the buffer, so they live until the package hash is
+ * torn down.
+ */
+struct parse_buffer {
+	char *start;
+	size_t len;
+	int mapped;
+};
+
+static struct parse_buffer *parse_buffers = NULL;
+static int parse_buffers_count = 0;
+
+char *
+pkg_parse_buffer_open(const char *file_name, size_t *len, int is_status_file)
+{
+	struct parse_buffer *pb;
+	struct stat st;
+	char *buf;
+	int fd, mapped = 1;
+
+	fd = open(file_name, O_RDONLY);
+	if (fd == -1) {
+		opkg_perror(ERROR, "Failed to open %s", file_name);
+		return NULL;
+	}
+
+	if (fstat(fd, &st) == -1) {
+		opkg_perror(ERROR, "Failed to stat %s", file_name);
+		close(fd);
+		return NULL;
+	}
+
+	if (st.st_size == 0) {
+		close(fd);
+		*len = 0;
+		return "";
+	}
+
+	/* The status file is truncated and rewritten in place by
+	 * opkg_conf_write_status_files() while packages still refer to
+	 * it, so it gets a private copy instead of a mapping. */
+	if (is_status_file) {
+		mapped = 0;
+		buf = xmalloc(st.st_size);
+		if (read(fd, buf, st.st_size) != st.st_size) {
+			opkg_perror(ERROR, "Failed to read %s", file_name);
+			free(buf);
+			close(fd);
+			return NULL;
+		}
+	} else {
+		/* Private and writable: the parser terminates fields in
+		 * place, which only dirties the pages it touches. */
+		buf = mmap(NULL, st.st_size, PROT_READ|PROT_WRITE,
+				MAP_PRIVATE, fd, 0);
+		if (buf == MAP_FAILED) {
+			opkg_perror(ERROR, "Failed to mmap %s", file_name);
+			close(fd);
+			return NULL;
+		}
+	}
+	close(fd);
+
+	/* Every line, including the last one, must be newline terminated
+	 * so that it can be split in place. */
+	if (buf[st.st_size-1] != '\n') {
+		if (mapped)
+			munmap(buf, st.st_size);
+		else
+			free(buf);
+		return NULL;
+	}
+
+	parse_buffers = xrealloc(parse_buffers,
+			sizeof(*parse_buffers) * (parse_buffers_count + 1));
+	pb = &parse_buffers[parse_buffers_count++];
+	pb->start = buf;
+	pb->len = st.st_size;
+	pb->mapped = mapped;
+
+	*len = st.st_size;
+	return buf;
+}
+
+int
+pkg_parse_buffer_contains(const char *p)
+{
+	int i;
+
+	for (i = 0; i < parse_buffers_count; i++) {
+		if (p >= parse_buffers[i].start
+				&& p < parse_buffers[i].start + parse_buffers[i].len)
+			return 1;
+	}
+
+	return 0;
+}
+
+void
+pkg_parse_buffers_release(void)
+{
+	int i;
+
+	for (i = 0; i < parse_buffers_count; i++) {
+		if (parse_buffers[i].mapped)
+			munmap(parse_buffers[i].start, parse_buffers[i].len);
+		else
+			free(parse_buffers[i].start);
+	}
+
+	free(parse_buffers);
+	parse_buffers = NULL;
+	parse_buffers_count = 0;
+}
+
+/*
+ * Parse one package from a buffer returned by pkg_parse_buffer_open(),
+ * advancing *pos past it. String fields of pkg point into the buffer.
+ */
+int
+pkg_parse_from_buffer(pkg_t *pkg, char **pos, char *end, uint mask)
+{
+	char *line, *nl;
+	int ret = 0;
+
+	pkg->strings_mapped = 1;
+
+	while (*pos < end) {
+		line = *pos;
+		nl = memchr(line, '\n', end - line);
+		*nl = '\0';
+		*pos = nl + 1;
+
+		if (pkg_parse_line(pkg, line, mask))
+			break;
+	}
+
+	if (pkg->name == NULL) {
+		/* probably just a blank line */
+		ret = 1;
+	}
+
+	return ret;
+}
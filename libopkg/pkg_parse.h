@@ -19,10 +19,17 @@
 #define PKG_PARSE_H
 
 int parse_version(pkg_t *pkg, const char *raw);
+int get_arch_priority(const char *arch);
 int pkg_parse_from_stream(pkg_t *pkg, FILE *fp, uint mask);
 int pkg_parse_from_stream_nomalloc(pkg_t *pkg, FILE *fp, uint mask,
 						char **buf0, size_t buf0len);
 
+char *pkg_parse_buffer_open(const char *file_name, size_t *len,
+						int is_status_file);
+int pkg_parse_buffer_contains(const char *p);
+void pkg_parse_buffers_release(void);
+int pkg_parse_from_buffer(pkg_t *pkg, char **pos, char *end, uint mask);
+
 #define EXCESSIVE_LINE_LEN	(4096 << 8)
 
 /* package field mask */
@@ -16,11 +16,12 @@
 */
 
 #include "pkg_src.h"
+#include "sprintf_alloc.h"
 #include "libbb/libbb.h"
 
-int pkg_src_init(pkg_src_t *src, const char *name, const char *base_url, const char *extra_data, int gzip)
+int pkg_src_init(pkg_src_t *src, const char *name, const char *base_url, const char *extra_data, const char *compression)
 {
-    src->gzip = gzip;
+    src->compression = compression;
     src->name = xstrdup(name);
     src->value = xstrdup(base_url);
     if (extra_data)
@@ -37,3 +38,22 @@ void pkg_src_deinit(pkg_src_t *src)
     if (src->extra_data)
 	free (src->extra_data);
 }
+
+/* URL of the Packages list of src, compressed as configured. */
+char *pkg_src_packages_url(pkg_src_t *src)
+{
+    char *list, *url;
+
+    if (src->compression)
+	sprintf_alloc(&list, "Packages.%s", src->compression);
+    else
+	list = xstrdup("Packages");
+
+    if (src->extra_data)	/* debian style? */
+	sprintf_alloc(&url, "%s/%s/%s", src->value, src->extra_data, list);
+    else
+	sprintf_alloc(&url, "%s/%s", src->value, list);
+
+    free(list);
+    return url;
+}
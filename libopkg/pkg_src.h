@@ -25,10 +25,11 @@ typedef struct
   char *name;
   char *value;
   char *extra_data;
-  int gzip;
+  const char *compression;	/* suffix of the compressed list, or NULL */
 } pkg_src_t;
 
-int pkg_src_init(pkg_src_t *src, const char *name, const char *base_url, const char *extra_data, int gzip);
+int pkg_src_init(pkg_src_t *src, const char *name, const char *base_url, const char *extra_data, const char *compression);
 void pkg_src_deinit(pkg_src_t *src);
+char *pkg_src_packages_url(pkg_src_t *src);
 
 #endif
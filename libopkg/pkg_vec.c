@@ -86,9 +86,9 @@ void pkg_vec_insert_merge(pkg_vec_t *vec, pkg_t *pkg, int set_status)
           pkg_merge(pkg, vec->pkgs[i]);
      }
 
-     /* overwrite the old one */
+     /* overwrite the old one, which the new one also takes the id of */
+     pkg->id = vec->pkgs[i]->id;
      pkg_deinit(vec->pkgs[i]);
-     free(vec->pkgs[i]);
      vec->pkgs[i] = pkg;
 }
 
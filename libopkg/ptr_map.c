@@ -0,0 +1,153 @@
+/* ptr_map.c - the opkg package management system
+
+   Javier Palacios
+
+   Copyright (C) 2010 Javier Palacios
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+#include "ptr_map.h"
+#include "libbb/libbb.h"
+
+/* Heap addresses are aligned, drop the low bits and spread the rest. */
+static unsigned long
+ptr_hash(const void *key)
+{
+     unsigned long h = (uintptr_t)key >> 3;
+
+     h ^= h >> 16;
+     h *= 0x45d9f3bUL;
+     h ^= h >> 16;
+     return h;
+}
+
+static ptr_map_entry_t *
+ptr_lookup(ptr_map_t *map, const void *key)
+{
+     unsigned int mask = map->n_buckets - 1;
+     unsigned int i = ptr_hash(key) & mask;
+
+     while (map->entries[i].key && map->entries[i].key != key)
+	  i = (i + 1) & mask;
+
+     return map->entries + i;
+}
+
+static void
+ptr_map_resize(ptr_map_t *map, unsigned int n_buckets)
+{
+     ptr_map_entry_t *old = map->entries;
+     unsigned int i, old_n = map->n_buckets;
+
+     map->entries = xcalloc(n_buckets, sizeof(ptr_map_entry_t));
+     map->n_buckets = n_buckets;
+
+     for (i = 0; i < old_n; i++)
+	  if (old[i].key)
+	       *ptr_lookup(map, old[i].key) = old[i];
+
+     free(old);
+}
+
+void
+ptr_map_init(ptr_map_t *map, int len)
+{
+     unsigned int n_buckets = 16;
+
+     while (n_buckets < (unsigned int)len)
+	  n_buckets <<= 1;
+
+     map->entries = xcalloc(n_buckets, sizeof(ptr_map_entry_t));
+     map->n_buckets = n_buckets;
+     map->n_elements = 0;
+}
+
+void
+ptr_map_deinit(ptr_map_t *map)
+{
+     free(map->entries);
+     map->entries = NULL;
+     map->n_buckets = 0;
+     map->n_elements = 0;
+}
+
+int
+ptr_map_contains(ptr_map_t *map, const void *key)
+{
+     return ptr_lookup(map, key)->key != NULL;
+}
+
+void *
+ptr_map_get(ptr_map_t *map, const void *key)
+{
+     return ptr_lookup(map, key)->data;
+}
+
+void
+ptr_map_insert(ptr_map_t *map, const void *key, void *data)
+{
+     ptr_map_entry_t *entry = ptr_lookup(map, key);
+
+     if (entry->key == NULL) {
+	  /* keep the load factor below 3/4 */
+	  if ((map->n_elements + 1) * 4 > map->n_buckets * 3) {
+	       ptr_map_resize(map, map->n_buckets * 2);
+	       entry = ptr_lookup(map, key);
+	  }
+	  entry->key = key;
+	  map->n_elements++;
+     }
+     entry->data = data;
+}
+
+void
+ptr_map_remove(ptr_map_t *map, const void *key)
+{
+     unsigned int mask = map->n_buckets - 1;
+     unsigned int i, j, k;
+     ptr_map_entry_t *entry = ptr_lookup(map, key);
+
+     if (entry->key == NULL)
+	  return;
+     map->n_elements--;
+
+     /* shift the rest of the probe sequence back, as hash_table_remove() */
+     i = j = entry - map->entries;
+     while (1) {
+	  j = (j + 1) & mask;
+	  if (map->entries[j].key == NULL)
+	       break;
+	  k = ptr_hash(map->entries[j].key) & mask;
+	  if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+	       continue;
+	  map->entries[i] = map->entries[j];
+	  i = j;
+     }
+     memset(map->entries + i, 0, sizeof(ptr_map_entry_t));
+}
+
+void
+ptr_map_foreach(ptr_map_t *map,
+	  void (*f)(const void *key, void *entry, void *data), void *data)
+{
+     unsigned int i;
+
+     if (!map || !f)
+	  return;
+
+     for (i = 0; i < map->n_buckets; i++)
+	  if (map->entries[i].key)
+	       f(map->entries[i].key, map->entries[i].data, data);
+}
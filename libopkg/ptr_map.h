@@ -0,0 +1,48 @@
+/* ptr_map.h - the opkg package management system
+
+   Javier Palacios
+
+   Copyright (C) 2010 Javier Palacios
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#ifndef PTR_MAP_H
+#define PTR_MAP_H
+
+/* Maps pointers, a pkg_t or an abstract_pkg_t most of the time, to
+ * data. Open addressing like hash_table_t, but the keys are compared
+ * by address and never copied. With NULL data it doubles as a set. */
+
+typedef struct ptr_map_entry ptr_map_entry_t;
+typedef struct ptr_map ptr_map_t;
+
+struct ptr_map_entry {
+     const void *key;
+     void *data;
+};
+
+struct ptr_map {
+     ptr_map_entry_t *entries;
+     unsigned int n_buckets;
+     unsigned int n_elements;
+};
+
+void ptr_map_init(ptr_map_t *map, int len);
+void ptr_map_deinit(ptr_map_t *map);
+int ptr_map_contains(ptr_map_t *map, const void *key);
+void *ptr_map_get(ptr_map_t *map, const void *key);
+void ptr_map_insert(ptr_map_t *map, const void *key, void *data);
+void ptr_map_remove(ptr_map_t *map, const void *key);
+void ptr_map_foreach(ptr_map_t *map,
+	  void (*f)(const void *key, void *entry, void *data), void *data);
+
+#endif
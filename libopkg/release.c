@@ -25,6 +25,7 @@
 #include "sprintf_alloc.h"
 #include "file_util.h"
 #include "dist_src_list.h"
+#include "pkg_index.h"
 
 #include "opkg_utils.h"
 
@@ -42,6 +43,8 @@ release_init(release_t *release)
 #if defined HAVE_SHA256
      release->sha256sums = NULL;
 #endif
+     release->lists_pending = 0;
+     release->lists_failed = 0;
 }
 
 release_t *
@@ -268,85 +271,143 @@ release_has_component(const char *compname, release_t *release)
      return ret;
 }
 
+/* A Packages file of a dist whose download is queued. */
+struct release_list {
+     release_t *release;
+     const char *dist_name;
+     char *dist_prefix;		/* <lists_dir>/<dist name> */
+     char *location;
+     char *package;
+     char *list_file_name;
+};
+
+static void
+release_list_free(struct release_list *rl)
+{
+     free(rl->dist_prefix);
+     free(rl->location);
+     free(rl->package);
+     free(rl->list_file_name);
+     free(rl);
+}
+
+static int
+release_list_done(const char *url, const char *list_file_name,
+		int err, void *data)
+{
+     struct release_list *rl = data;
+     release_t *release = rl->release;
+
+     if (err == 0) {
+	  opkg_msg(NOTICE, "Updated list of available packages in %s.\n",
+			  list_file_name);
+	  pkg_index_write(list_file_name);
+     } else
+	  release->lists_failed++;
+
+     if (--release->lists_pending == 0 && release->lists_failed == 0)
+	  opkg_msg(NOTICE, "Downloaded package files for dist %s.\n",
+			  rl->dist_name);
+
+     release_list_free(rl);
+
+     return err;
+}
+
+static int
+release_list_gz_done(const char *url, const char *tmp_file_name,
+		int err, void *data)
+{
+     struct release_list *rl = data;
+
+     if (err == 0) {
+	  FILE *in, *out;
+	  opkg_msg(NOTICE, "Inflating %s.\n", url);
+	  in = fopen (tmp_file_name, "r");
+	  out = fopen (rl->list_file_name, "w");
+	  if (in && out) {
+	       err = unzip (in, out);
+	       if (err)
+		    opkg_msg(INFO, "Corrumpt file at %s.\n", url);
+	  } else
+	       err = 1;
+	  if (in)
+	       fclose (in);
+	  if (out)
+	       fclose (out);
+	  unlink (tmp_file_name);
+
+	  if (!err) {
+	       char *stored_md5 = release_get_md5(rl->package,rl->release,"gz");
+
+	       char *md5fname;
+	       sprintf_alloc(&md5fname, "%s-%s", rl->dist_prefix, stored_md5);
+	       free(stored_md5);
+
+	       char *md5 = file_md5sum_alloc(rl->list_file_name);
+
+	       FILE *md5fd = fopen(md5fname, "w");
+	       fprintf(md5fd, "%s", md5);
+	       fclose(md5fd);
+
+	       free(md5fname);
+	       free(md5);
+	  }
+     }
+
+     if (err) {
+	  /* fall back to the uncompressed list */
+	  char *plain_url;
+	  sprintf_alloc(&plain_url, "%s/%s", rl->location, rl->package);
+	  opkg_download_queue(plain_url, rl->list_file_name,
+			  release_list_done, rl);
+	  free(plain_url);
+	  return 0;
+     }
+
+     return release_list_done(url, rl->list_file_name, 0, rl);
+}
+
+/* Only queues the downloads, opkg_download_wait() runs them. release has
+ * to stay around until then, and counts them down as they finish. */
 int
 release_get_packages(release_t *release, dist_src_t *dist, char *lists_dir, char *tmpdir)
 {
-     int ret = 0;
-
-     int err;
      char **comp = dist->extra_data;
 
      while (*comp != NULL ) {
 	  char *url;
-	  char *tmp_file_name, *list_file_name;
+	  char *tmp_file_name;
 
 	  if (!release_has_component(*comp, release)) {
 	       opkg_msg(ERROR, "Component '%s' not defined on %s.\n", *comp, dist->name);
 	  } else {
+	       struct release_list *rl = xcalloc(1, sizeof(*rl));
 
-	       char *location = dist_src_location(dist);
-	       char *package = dist_src_package(dist, *comp);
-	       sprintf_alloc(&url, "%s/%s.gz", location, package);
-
-	       sprintf_alloc(&list_file_name, "%s/%s-%s", lists_dir, dist->name, *comp);
+	       rl->release = release;
+	       rl->dist_name = dist->name;
+	       rl->location = dist_src_location(dist);
+	       rl->package = dist_src_package(dist, *comp);
+	       sprintf_alloc(&rl->dist_prefix, "%s/%s", lists_dir, dist->name);
+	       sprintf_alloc(&rl->list_file_name, "%s/%s-%s", lists_dir, dist->name, *comp);
 
+	       sprintf_alloc(&url, "%s/%s.gz", rl->location, rl->package);
 	       sprintf_alloc(&tmp_file_name, "%s/%s-%s.gz", tmpdir, dist->name, *comp);
-	       err = opkg_download(url, tmp_file_name, NULL, NULL);
-	       if (err == 0) {
-		    FILE *in, *out;
-		    opkg_msg(NOTICE, "Inflating %s.\n", url);
-		    in = fopen (tmp_file_name, "r");
-		    out = fopen (list_file_name, "w");
-		    if (in && out) {
-			 err = unzip (in, out);
-			 if (err)
-			      opkg_msg(INFO, "Corrumpt file at %s.\n", url);
-		    } else
-			 err = 1;
-		    if (in)
-			 fclose (in);
-		    if (out)
-			 fclose (out);
-		    unlink (tmp_file_name);
-		    free(url);
-
-		    if (!err) {
-			 char *stored_md5 = release_get_md5(package,release,"gz");
-
-			 char *md5fname;
-			 sprintf_alloc(&md5fname, "%s/%s-%s", lists_dir, dist->name, stored_md5);
-			 free(stored_md5);
-
-			 char *md5 = file_md5sum_alloc(list_file_name);
-
-			 FILE *md5fd = fopen(md5fname, "w");
-			 fprintf(md5fd, "%s", md5);
-			 fclose(md5fd);
-
-			 free(md5fname);
-			 free(md5);
-		    }
-
-	       }
-
-	       if (err!=0) {
-		    sprintf_alloc(&url, "%s/%s", location, package);
-		    err = opkg_download(url, list_file_name, NULL, NULL);
-		    if (err!=0)
-			 ret = -1;
-		    free(url);
-	       }
-
-	       free(package);
-	       free(location);
+	       release->lists_pending++;
+	       opkg_download_queue(url, tmp_file_name,
+			       release_list_gz_done, rl);
 
 	       free(tmp_file_name);
-	       free(list_file_name);
+	       free(url);
 	  }
 	  comp++;
      }
 
-     return ret;
+     if (release->lists_pending == 0)
+	  opkg_msg(NOTICE, "Downloaded package files for dist %s.\n",
+			  dist->name);
+
+     return 0;
 }
 
 
@@ -33,6 +33,10 @@ struct release
 #if defined HAVE_SHA256
      release_cksum_list_t *sha256sums;
 #endif
+     /* Packages files queued by release_get_packages() and not yet
+      * downloaded, and how many of them failed */
+     int lists_pending;
+     int lists_failed;
 };
 
 release_t *release_new(void);
@@ -0,0 +1,119 @@
+/* str_atom.c - the opkg package management system
+
+   Javier Palacios
+
+   Copyright (C) 2010 Javier Palacios
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "str_atom.h"
+#include "opkg_conf.h"
+#include "opkg_message.h"
+#include "libbb/libbb.h"
+
+#define ATOM_INITIAL_SLOTS	256
+
+struct atom_slot {
+	unsigned long hash;
+	char *str;
+};
+
+static struct atom_slot *slots = NULL;
+static unsigned int n_slots = 0;
+static unsigned int n_atoms = 0;
+
+static unsigned long
+atom_hash(const char *str, int len)
+{
+	unsigned long hash = 5381;
+	int i;
+
+	for (i = 0; i < len; i++)
+		hash = ((hash << 5) + hash) + (unsigned char)str[i];
+	return hash;
+}
+
+static void
+atom_grow(void)
+{
+	struct atom_slot *old = slots;
+	unsigned int i, j, old_n = n_slots;
+
+	n_slots = n_slots ? n_slots * 2 : ATOM_INITIAL_SLOTS;
+	slots = xcalloc(n_slots, sizeof(struct atom_slot));
+
+	for (i = 0; i < old_n; i++) {
+		if (old[i].str == NULL)
+			continue;
+		j = old[i].hash & (n_slots - 1);
+		while (slots[j].str)
+			j = (j + 1) & (n_slots - 1);
+		slots[j] = old[i];
+	}
+
+	free(old);
+}
+
+char *
+str_atom_n(const char *str, int len)
+{
+	unsigned long hash;
+	unsigned int i;
+
+	if (str == NULL)
+		return NULL;
+
+	/* keep the load factor below 3/4 */
+	if ((n_atoms + 1) * 4 > n_slots * 3)
+		atom_grow();
+
+	hash = atom_hash(str, len);
+	i = hash & (n_slots - 1);
+
+	while (slots[i].str) {
+		if (slots[i].hash == hash
+				&& strncmp(slots[i].str, str, len) == 0
+				&& slots[i].str[len] == '\0')
+			return slots[i].str;
+		i = (i + 1) & (n_slots - 1);
+	}
+
+	slots[i].hash = hash;
+	/* the strings themselves live in conf->pkg_arena */
+	slots[i].str = arena_strndup(&conf->pkg_arena, str, len);
+	n_atoms++;
+
+	return slots[i].str;
+}
+
+char *
+str_atom(const char *str)
+{
+	if (str == NULL)
+		return NULL;
+
+	return str_atom_n(str, strlen(str));
+}
+
+void
+str_atom_deinit(void)
+{
+	opkg_msg(DEBUG, "Released %u interned strings.\n", n_atoms);
+
+	free(slots);
+	slots = NULL;
+	n_slots = 0;
+	n_atoms = 0;
+}
@@ -0,0 +1,29 @@
+/* str_atom.h - the opkg package management system
+
+   Javier Palacios
+
+   Copyright (C) 2010 Javier Palacios
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#ifndef STR_ATOM_H
+#define STR_ATOM_H
+
+/* Interned strings for pkg_t fields that take few distinct values
+ * (architecture, section, maintainer, ...). The returned string is
+ * shared and must neither be modified nor freed. Strings are stored in
+ * conf->pkg_arena, str_atom_deinit() only drops the lookup table. */
+char *str_atom(const char *str);
+char *str_atom_n(const char *str, int len);
+void str_atom_deinit(void);
+
+#endif
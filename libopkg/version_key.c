@@ -0,0 +1,186 @@
+/* version_key.c - the opkg package management system
+
+   Javier Palacios
+
+   Copyright (C) 2010 Javier Palacios
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "version_key.h"
+#include "libbb/libbb.h"
+
+/*
+ * libdpkg - Debian packaging suite library routines
+ * vercmp.c - comparison of version numbers
+ *
+ * Copyright (C) 1995 Ian Jackson <iwj10@cus.cam.ac.uk>
+ */
+
+/* assume ascii; warning: evaluates x multiple times! */
+#define order(x) ((x) == '~' ? -1 \
+		: isdigit((x)) ? 0 \
+		: !(x) ? 0 \
+		: isalpha((x)) ? (x) \
+		: (x) + 256)
+
+/* Digit runs up to 9 digits long are stored as their value, longer
+ * ones as LONG_RUN plus their length followed by 9 digit chunks. Other
+ * characters weigh order() shifted past all of those, except for '~'
+ * which stays below them, as it sorts before the end of a run. */
+#define CHUNK_DIGITS 9
+#define LONG_RUN 1000000000
+#define CHAR_WEIGHT(x) ((x) == '~' ? -1 : order(x) + (1 << 30))
+
+/* Stores the first size runs of str in seg and returns the number of
+ * runs up to the last non zero one, zeroes at the end being implied. */
+static unsigned int
+key_fill(const char *str, int32_t *seg, unsigned int size)
+{
+     unsigned int n = 0, last = 0;
+     int len, chunk, i;
+     int32_t v;
+
+#define STORE(x) do { \
+	  v = (x); \
+	  if (n < size) \
+	       seg[n] = v; \
+	  if (v) \
+	       last = n + 1; \
+	  n++; \
+     } while (0)
+
+     if (!str)
+	  return 0;
+
+     while (*str) {
+	  while (*str && !isdigit(*str)) {
+	       STORE(CHAR_WEIGHT(*str));
+	       str++;
+	  }
+
+	  while (*str == '0')
+	       str++;
+	  for (len = 0; isdigit(str[len]); len++)
+	       ;
+
+	  chunk = len;
+	  if (len > CHUNK_DIGITS) {
+	       STORE(LONG_RUN + len);
+	       /* the first chunk takes the odd digits, so equal
+		* lengths are cut at the same places */
+	       chunk = len % CHUNK_DIGITS ? len % CHUNK_DIGITS : CHUNK_DIGITS;
+	  }
+	  do {
+	       int32_t d = 0;
+
+	       for (i = 0; i < chunk; i++)
+		    d = d * 10 + (*str++ - '0');
+	       STORE(d);
+	       len -= chunk;
+	       chunk = CHUNK_DIGITS;
+	  } while (len > 0);
+     }
+#undef STORE
+
+     return last;
+}
+
+version_key_t *
+version_key_new(arena_t *arena, unsigned long epoch,
+		const char *version, const char *revision)
+{
+     version_key_t *key;
+     unsigned int nversion, nrevision;
+
+     nversion = key_fill(version, NULL, 0);
+     nrevision = key_fill(revision, NULL, 0);
+
+     key = arena_alloc(arena, sizeof(version_key_t)
+		     + (nversion + nrevision) * sizeof(int32_t));
+     key->epoch = epoch;
+     key->nversion = nversion;
+     key->nrevision = nrevision;
+     key_fill(version, key->seg, nversion);
+     key_fill(revision, key->seg + nversion, nrevision);
+
+     return key;
+}
+
+version_key_t *
+version_key_parse(arena_t *arena, const char *vstr)
+{
+     version_key_t *key;
+     unsigned long epoch = 0;
+     const char *colon, *dash;
+     char *version;
+
+     while (*vstr && isspace(*vstr))
+	  vstr++;
+
+     colon = strchr(vstr, ':');
+     if (colon) {
+	  epoch = strtoul(vstr, NULL, 10);
+	  vstr = colon + 1;
+     }
+
+     dash = strrchr(vstr, '-');
+     if (!dash)
+	  return version_key_new(arena, epoch, vstr, NULL);
+
+     version = xstrndup(vstr, dash - vstr);
+     key = version_key_new(arena, epoch, version, dash + 1);
+     free(version);
+
+     return key;
+}
+
+/* A run missing from the shorter key weighs 0. */
+static int
+seg_compare(const int32_t *a, unsigned int na,
+		const int32_t *b, unsigned int nb)
+{
+     unsigned int i, n = na < nb ? na : nb;
+
+     for (i = 0; i < n; i++)
+	  if (a[i] != b[i])
+	       return a[i] < b[i] ? -1 : 1;
+
+     for (; i < na; i++)
+	  if (a[i])
+	       return a[i] < 0 ? -1 : 1;
+     for (; i < nb; i++)
+	  if (b[i])
+	       return b[i] < 0 ? 1 : -1;
+
+     return 0;
+}
+
+int
+version_key_compare(const version_key_t *a, const version_key_t *b)
+{
+     int r;
+
+     if (a->epoch != b->epoch)
+	  return a->epoch < b->epoch ? -1 : 1;
+
+     r = seg_compare(a->seg, a->nversion, b->seg, b->nversion);
+     if (r)
+	  return r;
+
+     return seg_compare(a->seg + a->nversion, a->nrevision,
+		     b->seg + b->nversion, b->nrevision);
+}
@@ -0,0 +1,51 @@
+/* version_key.h - the opkg package management system
+
+   Javier Palacios
+
+   Copyright (C) 2010 Javier Palacios
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+#ifndef VERSION_KEY_H
+#define VERSION_KEY_H
+
+#include <stdint.h>
+
+#include "arena.h"
+
+/* A version split up front into the runs dpkg's verrevcmp() walks, so
+ * that comparing two of them is a loop over integers: one per character
+ * of a non-digit run and one per digit run, for short runs, weighed so
+ * that plain integer order is version order. A missing run weighs 0,
+ * which is also how verrevcmp() sees the end of a string, so trailing
+ * zeroes are not stored. */
+
+typedef struct version_key version_key_t;
+
+struct version_key {
+     unsigned long epoch;
+     unsigned int nversion;
+     unsigned int nrevision;
+     int32_t seg[];		/* version runs, then revision runs */
+};
+
+version_key_t *version_key_new(arena_t *arena, unsigned long epoch,
+		const char *version, const char *revision);
+
+/* Same for a whole "[epoch:]version[-revision]" string, split up like
+ * parse_version() does. */
+version_key_t *version_key_parse(arena_t *arena, const char *vstr);
+
+/* Returns <0, 0 or >0 like pkg_compare_versions(). */
+int version_key_compare(const version_key_t *a, const version_key_t *b);
+
+#endif
@@ -22,18 +22,9 @@
 #include "xsystem.h"
 #include "libbb/libbb.h"
 
-/* Like system(3), but with error messages printed if the fork fails
-   or if the child process dies due to an uncaught signal. Also, the
-   return value is a bit simpler:
-
-   -1 if there was any problem
-   Otherwise, the 8-bit return value of the program ala WEXITSTATUS
-   as defined in <sys/wait.h>.
-*/
-int
-xsystem(const char *argv[])
+pid_t
+xsystem_spawn(const char *argv[])
 {
-	int status;
 	pid_t pid;
 
 	pid = vfork();
@@ -51,23 +42,50 @@ xsystem(const char *argv[])
 		break;
 	}
 
-	if (waitpid(pid, &status, 0) == -1) {
-		opkg_perror(ERROR, "%s: waitpid", argv[0]);
-		return -1;
-	}
+	return pid;
+}
 
+int
+xsystem_status(const char *name, int status)
+{
 	if (WIFSIGNALED(status)) {
 		opkg_msg(ERROR, "%s: Child killed by signal %d.\n",
-			argv[0], WTERMSIG(status));
+			name, WTERMSIG(status));
 		return -1;
 	}
 
 	if (!WIFEXITED(status)) {
 		/* shouldn't happen */
 		opkg_msg(ERROR, "%s: Your system is broken: got status %d "
-			"from waitpid.\n", argv[0], status);
+			"from waitpid.\n", name, status);
 		return -1;
 	}
 
 	return WEXITSTATUS(status);
 }
+
+/* Like system(3), but with error messages printed if the fork fails
+   or if the child process dies due to an uncaught signal. Also, the
+   return value is a bit simpler:
+
+   -1 if there was any problem
+   Otherwise, the 8-bit return value of the program ala WEXITSTATUS
+   as defined in <sys/wait.h>.
+*/
+int
+xsystem(const char *argv[])
+{
+	int status;
+	pid_t pid;
+
+	pid = xsystem_spawn(argv);
+	if (pid == -1)
+		return -1;
+
+	if (waitpid(pid, &status, 0) == -1) {
+		opkg_perror(ERROR, "%s: waitpid", argv[0]);
+		return -1;
+	}
+
+	return xsystem_status(argv[0], status);
+}
@@ -18,6 +18,8 @@
 #ifndef XSYSTEM_H
 #define XSYSTEM_H
 
+#include <sys/types.h>
+
 /* Like system(3), but with error messages printed if the fork fails
    or if the child process dies due to an uncaught signal. Also, the
    return value is a bit simpler:
@@ -28,5 +30,12 @@
 */
 int xsystem(const char *argv[]);
 
+/* The two halves of xsystem(), for callers that run several children at
+   once: xsystem_spawn() returns the pid of the child or -1, and
+   xsystem_status() turns what waitpid() reported into the value xsystem()
+   would have returned. */
+pid_t xsystem_spawn(const char *argv[]);
+int xsystem_status(const char *name, int status);
+
 #endif
 	 
@@ -44,6 +44,7 @@ enum {
 	ARGS_OPT_NODEPS,
 	ARGS_OPT_AUTOREMOVE,
 	ARGS_OPT_CACHE,
+	ARGS_OPT_SOLVER,
 };
 
 static struct option long_options[] = {
@@ -66,6 +67,7 @@ static struct option long_options[] = {
 	{"force-space", 0, 0, ARGS_OPT_FORCE_SPACE},
 	{"force_space", 0, 0, ARGS_OPT_FORCE_SPACE},
 	{"recursive", 0, 0, ARGS_OPT_FORCE_REMOVAL_OF_DEPENDENT_PACKAGES},
+	{"solver", 1, 0, ARGS_OPT_SOLVER},
 	{"force-removal-of-dependent-packages", 0, 0,
 		ARGS_OPT_FORCE_REMOVAL_OF_DEPENDENT_PACKAGES},
 	{"force_removal_of_dependent_packages", 0, 0,
@@ -129,6 +131,10 @@ args_parse(int argc, char *argv[])
 			free(conf->cache);
 			conf->cache = xstrdup(optarg);
 			break;
+		case ARGS_OPT_SOLVER:
+			free(conf->solver);
+			conf->solver = xstrdup(optarg);
+			break;
 		case ARGS_OPT_FORCE_MAINTAINER:
 			conf->force_maintainer = 1;
 			break;
@@ -224,6 +230,9 @@ usage()
 	printf("\t-f <conf_file>		Use <conf_file> as the opkg configuration file\n");
 	printf("\t--conf <conf_file>\n");
 	printf("\t--cache <directory>	Use a package cache\n");
+	printf("\t--solver <solver>	Resolve dependencies with <solver>:\n");
+	printf("\t				internal one at a time (default)\n");
+	printf("\t				sat the whole transaction at once\n");
 	printf("\t-d <dest_name>		Use <dest_name> as the the root directory for\n");
 	printf("\t--dest <dest_name>	package installation, removal, upgrading.\n");
 	printf("				<dest_name> should be a defined dest name from\n");
@@ -0,0 +1,122 @@
+/* gunzip_bench.c - the opkg package management system
+
+   Javier Palacios
+
+   Copyright (C) 2010 Javier Palacios
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+/*
+ * Inflate throughput of libbb's gunzip, in MB/s of inflated data:
+ *
+ *   gunzip_bench [-n runs] Packages.gz data.tar.gz ...
+ *
+ * Each file is inflated runs times (5 by default) and the best run is
+ * reported, so the page cache and not the disk feeds the decoder.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <libbb/libbb.h>
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Returns the inflated size, or -1 on error. */
+static long
+inflate_file(const char *path)
+{
+	FILE *fp;
+	gunzip_t *gz;
+	unsigned char *buf;
+	long total = 0;
+	int n;
+
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		perror(path);
+		return -1;
+	}
+
+	gz = gunzip_new(fp);
+	if (gz == NULL) {
+		fclose(fp);
+		return -1;
+	}
+
+	while ((n = gunzip_read_window(gz, &buf)) > 0)
+		total += n;
+
+	gunzip_free(gz);
+	fclose(fp);
+
+	return n < 0 ? -1 : total;
+}
+
+int
+main(int argc, char *argv[])
+{
+	int runs = 5;
+	int c, i, r;
+	int err = 0;
+
+	while ((c = getopt(argc, argv, "n:")) != -1) {
+		switch (c) {
+		case 'n':
+			runs = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n runs] file.gz...\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind == argc || runs < 1) {
+		fprintf(stderr, "usage: %s [-n runs] file.gz...\n", argv[0]);
+		return 1;
+	}
+
+	for (i = optind; i < argc; i++) {
+		double best = 0, t;
+		long size = 0;
+
+		for (r = 0; r < runs; r++) {
+			t = now();
+			size = inflate_file(argv[i]);
+			t = now() - t;
+			if (size < 0)
+				break;
+			if (r == 0 || t < best)
+				best = t;
+		}
+
+		if (size < 0) {
+			fprintf(stderr, "%s: inflate failed\n", argv[i]);
+			err = 1;
+			continue;
+		}
+
+		printf("%s: %ld bytes in %.3fs, %.1f MB/s\n", argv[i], size,
+				best, size / best / (1024 * 1024));
+	}
+
+	return err;
+}
@@ -0,0 +1,292 @@
+/* solver_test.c - the opkg package management system
+
+   Javier Palacios
+
+   Copyright (C) 2010 Javier Palacios
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+
+/*
+ * Runs opkg_solver_plan() on small feeds and status files and checks
+ * the packages each plan picks, and those the install path then queues:
+ *
+ *   solver_test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <opkg_conf.h>
+#include <pkg_hash.h>
+#include <pkg_depends.h>
+#include <opkg_solver.h>
+
+#define PKG(name, version, fields) \
+	"Package: " name "\nVersion: " version "\nArchitecture: all\n" \
+	fields "\n"
+#define INSTALLED(name, version, flag, fields) \
+	PKG(name, version, "Status: install " flag " installed\n" fields)
+
+static const struct solver_case {
+	const char *title;
+	const char *feed;
+	const char *status;
+	const char *request;	/* space separated, "" for everything */
+	int upgrade;
+	int max_conflicts;
+	int result;
+	const char *chosen;	/* name=version, space separated */
+	const char *not_chosen;
+	const char *queued;	/* depends queued for the first name asked
+				   for, in order, or NULL */
+} cases[] = {
+	{ "first alternative",
+	  PKG("a", "1", "Depends: b | c\n")
+	  PKG("b", "1", "")
+	  PKG("c", "1", ""),
+	  "",
+	  "a", 0, 0, 0,
+	  "a=1 b=1", "c=1", "b=1" },
+	{ "installed alternative",
+	  PKG("a", "1", "Depends: b | c\n")
+	  PKG("b", "1", ""),
+	  INSTALLED("c", "1", "ok", ""),
+	  "a", 0, 0, 0,
+	  "a=1 c=1", "b=1", "" },
+	{ "alternative with a conflict",
+	  PKG("a", "1", "Depends: b | c\n")
+	  PKG("b", "1", "Conflicts: d\n")
+	  PKG("c", "1", ""),
+	  INSTALLED("d", "1", "ok", ""),
+	  "a", 0, 0, 0,
+	  "a=1 c=1 d=1", "b=1", "c=1" },
+	{ "conflict with replaces",
+	  PKG("n", "1", "Conflicts: o\nReplaces: o\n"),
+	  INSTALLED("o", "1", "ok", ""),
+	  "n", 0, 0, 0,
+	  "n=1", "o=1", NULL },
+	{ "conflict without replaces",
+	  PKG("n", "1", "Conflicts: o\n"),
+	  INSTALLED("o", "1", "ok", ""),
+	  "n", 0, 0, -1,
+	  "", "", NULL },
+	{ "held package",
+	  PKG("h", "2", "")
+	  PKG("u", "2", ""),
+	  INSTALLED("h", "1", "hold", "")
+	  INSTALLED("u", "1", "ok", ""),
+	  "", 1, 0, 0,
+	  "h=1 u=2", "h=2 u=1", NULL },
+	{ "held package needed newer",
+	  PKG("h", "2", "")
+	  PKG("x", "1", "Depends: h (>= 2)\n"),
+	  INSTALLED("h", "1", "hold", ""),
+	  "x", 0, 0, -1,
+	  "", "", NULL },
+	{ "missing dependency",
+	  PKG("x", "1", "Depends: gone\n"),
+	  "",
+	  "x", 0, 0, -1,
+	  "", "", NULL },
+	{ "installed with broken depends",
+	  PKG("q", "1", ""),
+	  INSTALLED("p", "1", "ok", "Depends: gone\n"),
+	  "q", 0, 0, 0,
+	  "p=1 q=1", "", NULL },
+	{ "upgrade with broken depends",
+	  PKG("p", "2", "Depends: gone\n")
+	  PKG("r", "2", ""),
+	  INSTALLED("p", "1", "ok", "Depends: gone\n")
+	  INSTALLED("r", "1", "ok", ""),
+	  "", 1, 0, 0,
+	  "p=1 r=2", "p=2 r=1", NULL },
+	/* Trying a1 and then a2 takes two conflicts before b is picked. */
+	{ "conflict bound reached",
+	  PKG("t", "1", "Depends: a1 | a2 | b\n")
+	  PKG("a1", "1", "Depends: x1, y1\n")
+	  PKG("a2", "1", "Depends: x2, y2\n")
+	  PKG("x1", "1", "Conflicts: y1\n")
+	  PKG("x2", "1", "Conflicts: y2\n")
+	  PKG("y1", "1", "")
+	  PKG("y2", "1", "")
+	  PKG("b", "1", ""),
+	  "",
+	  "t", 0, 1, -2,
+	  "", "", NULL },
+	{ "conflict bound not reached",
+	  PKG("t", "1", "Depends: a1 | a2 | b\n")
+	  PKG("a1", "1", "Depends: x1, y1\n")
+	  PKG("a2", "1", "Depends: x2, y2\n")
+	  PKG("x1", "1", "Conflicts: y1\n")
+	  PKG("x2", "1", "Conflicts: y2\n")
+	  PKG("y1", "1", "")
+	  PKG("y2", "1", "")
+	  PKG("b", "1", ""),
+	  "",
+	  "t", 0, 0, 0,
+	  "t=1 b=1", "a1=1 a2=1 x1=1 x2=1 y1=1 y2=1", "b=1" },
+	{ "provider with a conflict",
+	  PKG("a", "1", "Depends: v\n")
+	  PKG("p", "1", "Provides: v\nConflicts: d\n")
+	  PKG("q", "1", "Provides: v\n"),
+	  INSTALLED("d", "1", "ok", ""),
+	  "a", 0, 0, 0,
+	  "a=1 q=1 d=1", "p=1", "q=1" },
+	/* c needs b upgraded, so a must not settle for the installed b. */
+	{ "dependency upgraded by the plan",
+	  PKG("a", "1", "Depends: b\n")
+	  PKG("b", "2", "")
+	  PKG("c", "1", "Depends: b (>= 2)\n"),
+	  INSTALLED("b", "1", "ok", ""),
+	  "a c", 0, 0, 0,
+	  "a=1 b=2 c=1", "b=1", "b=2" },
+};
+
+static char *
+write_tmp(const char *text)
+{
+	char *path = strdup("/tmp/solver_test.XXXXXX");
+	int fd = mkstemp(path);
+	FILE *fp;
+
+	if (fd < 0) {
+		perror("mkstemp");
+		exit(1);
+	}
+	fp = fdopen(fd, "w");
+	fputs(text, fp);
+	fclose(fp);
+	return path;
+}
+
+/* Checks that each name=version in list is chosen or not. */
+static int
+check_chosen(const struct solver_case *c, const char *list, int want)
+{
+	char *copy = strdup(list), *tok, *version;
+	pkg_t *pkg;
+	int err = 0;
+
+	for (tok = strtok(copy, " "); tok; tok = strtok(NULL, " ")) {
+		version = strchr(tok, '=');
+		*version++ = '\0';
+		pkg = pkg_hash_fetch_by_name_version(tok, version);
+		if (!pkg || opkg_solver_chosen(pkg) != want) {
+			fprintf(stderr, "%s: %s %s %s\n", c->title, tok, version,
+					want ? "not chosen" : "chosen");
+			err = 1;
+		}
+	}
+	free(copy);
+	return err;
+}
+
+/* Checks the depends pkg_hash_fetch_unsatisfied_dependencies() queues
+ * for name under the plan. */
+static int
+check_queued(const struct solver_case *c, const char *name)
+{
+	pkg_vec_t *depends = pkg_vec_alloc();
+	char **unresolved, **p, got[256] = "";
+	pkg_t *pkg;
+	int i, err = 0;
+
+	pkg = pkg_hash_fetch_best_installation_candidate_by_name(name);
+	if (pkg == NULL) {
+		fprintf(stderr, "%s: no candidate for %s\n", c->title, name);
+		pkg_vec_free(depends);
+		return 1;
+	}
+
+	pkg_hash_fetch_unsatisfied_dependencies(pkg, depends, &unresolved);
+	for (i = 0; i < depends->len; i++)
+		snprintf(got + strlen(got), sizeof(got) - strlen(got),
+				"%s%s=%s", i ? " " : "",
+				depends->pkgs[i]->name, depends->pkgs[i]->version);
+	if (unresolved || strcmp(got, c->queued)) {
+		fprintf(stderr, "%s: queued \"%s\"%s, expected \"%s\"\n",
+				c->title, got, unresolved ? " and unresolved" : "",
+				c->queued);
+		err = 1;
+	}
+
+	for (p = unresolved; p && *p; p++)
+		free(*p);
+	free(unresolved);
+	pkg_vec_free(depends);
+	return err;
+}
+
+static int
+run_case(const struct solver_case *c)
+{
+	char *feed, *status, *request, *names[8], *tok;
+	int argc = 0, r, err = 0;
+
+	arena_init(&conf->pkg_arena);
+	pkg_hash_init();
+
+	feed = write_tmp(c->feed);
+	status = write_tmp(c->status);
+	pkg_hash_add_from_file(feed, NULL, NULL, 0);
+	pkg_hash_add_from_file(status, NULL, NULL, 1);
+
+	request = strdup(c->request);
+	for (tok = strtok(request, " "); tok; tok = strtok(NULL, " "))
+		names[argc++] = tok;
+
+	conf->solver_max_conflicts = c->max_conflicts;
+	r = opkg_solver_plan(argc, names, c->upgrade);
+	if (r != c->result) {
+		fprintf(stderr, "%s: returned %d, expected %d\n",
+				c->title, r, c->result);
+		err = 1;
+	} else if (r == 0) {
+		err |= check_chosen(c, c->chosen, 1);
+		err |= check_chosen(c, c->not_chosen, 0);
+		if (c->queued)
+			err |= check_queued(c, names[0]);
+	}
+
+	opkg_solver_clear();
+	pkg_hash_deinit();
+	arena_deinit(&conf->pkg_arena);
+
+	unlink(feed);
+	unlink(status);
+	free(feed);
+	free(status);
+	free(request);
+	return err;
+}
+
+int
+main(int argc, char *argv[])
+{
+	int i, err = 0;
+
+	conf->mmap_lists = 0;
+	nv_pair_list_init(&conf->arch_list);
+	nv_pair_list_append(&conf->arch_list, "all", "1");
+
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+		err |= run_case(&cases[i]);
+
+	nv_pair_list_deinit(&conf->arch_list);
+
+	if (!err)
+		printf("%d solver cases passed\n", i);
+	return err;
+}
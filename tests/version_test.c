@@ -0,0 +1,230 @@
+/* version_test.c - the opkg package management system
+
+   Javier Palacios
+
+   Copyright (C) 2010 Javier Palacios
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+*/
+
+
+/*
+ * Checks version_key_compare() against dpkg's verrevcmp(), first on a
+ * table of known orderings and then on random versions:
+ *
+ *   version_test [-n count] [-s seed]
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <version_key.h>
+
+/* The string comparison pkg_compare_versions() used to do. */
+#define order(x) ((x) == '~' ? -1 \
+		: isdigit((x)) ? 0 \
+		: !(x) ? 0 \
+		: isalpha((x)) ? (x) \
+		: (x) + 256)
+
+static int
+verrevcmp(const char *val, const char *ref)
+{
+	if (!val) val = "";
+	if (!ref) ref = "";
+
+	while (*val || *ref) {
+		int first_diff = 0;
+
+		while ((*val && !isdigit(*val)) || (*ref && !isdigit(*ref))) {
+			int vc = order(*val), rc = order(*ref);
+			if (vc != rc) return vc - rc;
+			val++; ref++;
+		}
+
+		while (*val == '0') val++;
+		while (*ref == '0') ref++;
+		while (isdigit(*val) && isdigit(*ref)) {
+			if (!first_diff) first_diff = *val - *ref;
+			val++; ref++;
+		}
+		if (isdigit(*val)) return 1;
+		if (isdigit(*ref)) return -1;
+		if (first_diff) return first_diff;
+	}
+	return 0;
+}
+
+/* Splits vstr like parse_version() and compares like the old
+ * pkg_compare_versions(). */
+static int
+ref_compare(const char *a, const char *b)
+{
+	char *va, *vb, *ra, *rb, *p;
+	unsigned long ea = 0, eb = 0;
+	int r;
+
+	if ((p = strchr(a, ':'))) {
+		ea = strtoul(a, NULL, 10);
+		a = p + 1;
+	}
+	if ((p = strchr(b, ':'))) {
+		eb = strtoul(b, NULL, 10);
+		b = p + 1;
+	}
+	if (ea != eb)
+		return ea < eb ? -1 : 1;
+
+	va = strdup(a);
+	vb = strdup(b);
+	if ((ra = strrchr(va, '-')))
+		*ra++ = '\0';
+	if ((rb = strrchr(vb, '-')))
+		*rb++ = '\0';
+
+	r = verrevcmp(va, vb);
+	if (!r)
+		r = verrevcmp(ra, rb);
+
+	free(va);
+	free(vb);
+	return r;
+}
+
+static int
+sign(int r)
+{
+	return (r > 0) - (r < 0);
+}
+
+static const struct {
+	const char *a, *b;
+	int cmp;
+} known[] = {
+	{ "1.0", "1.0", 0 },
+	{ "1.0", "1.1", -1 },
+	{ "1.2.3", "1.2.10", -1 },
+	{ "1.0001", "1.1", 0 },
+	{ "0", "00", 0 },
+	{ "1.0", "1.0.0", -1 },
+	{ "1.0~rc1", "1.0", -1 },
+	{ "1.0~~", "1.0~~a", -1 },
+	{ "1.0~~a", "1.0~", -1 },
+	{ "1.0~", "1.0", -1 },
+	{ "1.0", "1.0a", -1 },
+	{ "1.0a", "1.0+", -1 },
+	{ "1.0", "1.0+b1", -1 },
+	{ "1.0a", "1.0b", -1 },
+	{ "1.0Z", "1.0a", -1 },
+	{ "9.9", "1:0.1", -1 },
+	{ "2:1.0", "10:0.1", -1 },
+	{ "1.0-1", "1.0-2", -1 },
+	{ "1.0-9", "1.0-10", -1 },
+	{ "1.0-r1", "1.0-r1.1", -1 },
+	{ "1.0-r1", "1.0", 1 },
+	{ "1.2-3-4", "1.2-3-5", -1 },
+	{ "1.0", "", 1 },
+	{ "~", "", -1 },
+	{ "1.999999999999999999999", "2.0", -1 },
+	{ "123456789012345678900", "123456789012345678901", -1 },
+	{ "999999999", "1000000000", -1 },
+	{ "1000000000", "0001000000000", 0 },
+	{ "2010.01.01", "2010.1.2", -1 },
+};
+
+/* Something like a version, with long digit runs now and then. */
+static void
+random_version(char *buf, int len)
+{
+	static const char chars[] = "0123456789.~+-:ab";
+	int i, d, n = rand() % len;
+
+	for (i = 0; i < n; ) {
+		if (rand() % 16 == 0) {
+			for (d = rand() % 25; d && i < n; d--)
+				buf[i++] = '0' + rand() % 10;
+		} else
+			buf[i++] = chars[rand() % (sizeof(chars) - 1)];
+	}
+	buf[n] = '\0';
+}
+
+int
+main(int argc, char *argv[])
+{
+	arena_t arena;
+	version_key_t *ka, *kb;
+	char a[32], b[32];
+	int count = 1000000;
+	unsigned int seed = 1;
+	int c, i, r, want;
+	int err = 0;
+
+	while ((c = getopt(argc, argv, "n:s:")) != -1) {
+		switch (c) {
+		case 'n':
+			count = atoi(optarg);
+			break;
+		case 's':
+			seed = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n count] [-s seed]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	arena_init(&arena);
+
+	for (i = 0; i < sizeof(known) / sizeof(known[0]); i++) {
+		ka = version_key_parse(&arena, known[i].a);
+		kb = version_key_parse(&arena, known[i].b);
+		if (sign(version_key_compare(ka, kb)) != known[i].cmp
+				|| sign(version_key_compare(kb, ka)) != -known[i].cmp
+				|| sign(ref_compare(known[i].a, known[i].b)) != known[i].cmp) {
+			fprintf(stderr, "%s vs %s: expected %d\n",
+					known[i].a, known[i].b, known[i].cmp);
+			err = 1;
+		}
+	}
+
+	srand(seed);
+	for (i = 0; i < count; i++) {
+		random_version(a, sizeof(a));
+		if (rand() % 4) {
+			random_version(b, sizeof(b));
+		} else {
+			/* a prefix, so they differ late if at all */
+			strcpy(b, a);
+			b[rand() % (strlen(b) + 1)] = '\0';
+		}
+
+		ka = version_key_parse(&arena, a);
+		kb = version_key_parse(&arena, b);
+		want = sign(ref_compare(a, b));
+		r = sign(version_key_compare(ka, kb));
+		if (r != want) {
+			fprintf(stderr, "'%s' vs '%s': got %d, expected %d\n",
+					a, b, r, want);
+			err = 1;
+		}
+	}
+
+	arena_deinit(&arena);
+
+	if (!err)
+		printf("%d known and %d random comparisons ok\n",
+				(int)(sizeof(known) / sizeof(known[0])), count);
+	return err;
+}